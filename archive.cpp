@@ -0,0 +1,430 @@
+//Copyright (C) 2025 makischu
+
+//archive: daily files of received telegrams with an index on the register, see archive.h
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "archive.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+#define ARCHIVE_MAGIC       0x41424531  // "1EBA"
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_IDX_MAGIC   0x49424531  // "1EBI"
+#define ARCHIVE_IDX_VERSION 1
+#define ARCHIVE_IDX_HEADER_LEN 32
+#define ARCHIVE_RECNR_BITS  24          // ARCHIVE_MAX_RECORDS
+
+struct ArchiveIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t covered;
+    uint32_t nkeys;
+    uint32_t reserved;
+    uint64_t npostings;
+};
+static_assert(sizeof(ArchiveHeader) == ARCHIVE_HEADER_LEN, "see archive.h for the format");
+static_assert(sizeof(ArchiveRecord) == ARCHIVE_RECORD_LEN, "see archive.h for the format");
+static_assert(sizeof(ArchiveIndexHeader) == ARCHIVE_IDX_HEADER_LEN, "see archive.h for the format");
+static_assert(ARCHIVE_MAX_RECORDS <= (1<<ARCHIVE_RECNR_BITS), "record nr and key are sorted as one u64");
+
+uint64_t archiveKey(const uint8_t* data, int len) {
+    if (len < 5) {
+        return UINT64_MAX;
+    }
+    uint8_t id = (data[4] >= 1 && len >= 6) ? data[5] : 0;
+    return (uint64_t)data[0]<<32 | (uint64_t)data[1]<<24 | (uint64_t)data[2]<<16 | (uint64_t)data[3]<<8 | id;
+}
+
+static size_t fileLen(uint64_t records) {
+    return ARCHIVE_HEADER_LEN + records*ARCHIVE_RECORD_LEN;
+}
+
+
+//////////////////////////
+// Index
+
+// all (key, record nr) pairs as one number each, sorted: grouped by key, in time order within.
+// the result is one block in the file format, so that it can be written as it is.
+static void* indexBuild(const ArchiveRecord* records, uint64_t count, size_t* len) {
+    uint64_t* pairs = (uint64_t*)malloc(count ? count*sizeof(uint64_t) : 1);
+    uint64_t n = 0;
+    if (!pairs) {
+        return 0;
+    }
+    for (uint64_t i=0; i<count; i++) {
+        uint64_t key = archiveKey(records[i].data, MIN(records[i].len, ARCHIVE_DATA_LEN));
+        if (key != UINT64_MAX) {
+            pairs[n++] = key<<ARCHIVE_RECNR_BITS | i;
+        }
+    }
+    std::sort(pairs, pairs+n);
+    uint32_t nkeys = 0;
+    for (uint64_t i=0; i<n; i++) {
+        if (i == 0 || (pairs[i]>>ARCHIVE_RECNR_BITS) != (pairs[i-1]>>ARCHIVE_RECNR_BITS)) {
+            nkeys++;
+        }
+    }
+    *len = ARCHIVE_IDX_HEADER_LEN + nkeys*sizeof(ArchiveKeyEntry) + n*sizeof(uint32_t);
+    uint8_t* index = (uint8_t*)calloc(1, *len);
+    if (!index) {
+        free(pairs);
+        return 0;
+    }
+    ArchiveIndexHeader* h = (ArchiveIndexHeader*)index;
+    ArchiveKeyEntry* keys = (ArchiveKeyEntry*)(index + ARCHIVE_IDX_HEADER_LEN);
+    uint32_t* postings    = (uint32_t*)(keys + nkeys);
+    h->magic     = ARCHIVE_IDX_MAGIC;
+    h->version   = ARCHIVE_IDX_VERSION;
+    h->covered   = count;
+    h->nkeys     = nkeys;
+    h->npostings = n;
+    int k = -1;
+    for (uint64_t i=0; i<n; i++) {
+        uint64_t key = pairs[i]>>ARCHIVE_RECNR_BITS;
+        if (k < 0 || keys[k].key != key) {
+            k++;
+            keys[k].key   = key;
+            keys[k].first = i;
+        }
+        keys[k].count++;
+        postings[i] = pairs[i] & ((1<<ARCHIVE_RECNR_BITS)-1);
+    }
+    free(pairs);
+    return index;
+}
+
+static bool indexSave(const char* path, const void* index, size_t len) {
+    char idx[ARCHIVE_PATH_LEN+8], tmp[ARCHIVE_PATH_LEN+16];
+    if (snprintf(idx, sizeof(idx), "%s.idx", path) >= (int)sizeof(idx) || snprintf(tmp, sizeof(tmp), "%s.tmp", idx) >= (int)sizeof(tmp)) {
+        return false;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, index, len) == (ssize_t)len;
+    ok &= close(fd) == 0;
+    if (!ok || rename(tmp, idx) != 0) { // readers see the old one or the new one, never half of it
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+static bool indexValid(const void* index, size_t len, uint64_t count) {
+    const ArchiveIndexHeader* h = (const ArchiveIndexHeader*)index;
+    return len >= ARCHIVE_IDX_HEADER_LEN && h->magic == ARCHIVE_IDX_MAGIC && h->version == ARCHIVE_IDX_VERSION
+        && h->covered == count && h->npostings <= count
+        && len == ARCHIVE_IDX_HEADER_LEN + h->nkeys*sizeof(ArchiveKeyEntry) + h->npostings*sizeof(uint32_t);
+}
+
+
+//////////////////////////
+// Writing
+
+bool archiveWriterInit(ArchiveWriter* w, const char* dir, const char* bus) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    if (strlen(dir) >= sizeof(w->dir) || strlen(bus) >= sizeof(w->bus)) {
+        printf("archive: directory or bus name too long\n");
+        return false;
+    }
+    strcpy(w->dir, dir);
+    strcpy(w->bus, bus);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("archive: could not create %s\n", dir);
+        return false;
+    }
+    return true;
+}
+
+void archiveWriterClose(ArchiveWriter* w) {
+    if (!w->map) {
+        return;
+    }
+    ArchiveHeader* h = (ArchiveHeader*)w->map;
+    size_t indexLen;
+    void* index = indexBuild((const ArchiveRecord*)(w->map + ARCHIVE_HEADER_LEN), h->count, &indexLen);
+    if (!index || !indexSave(w->path, index, indexLen)) {
+        printf("archive: could not write the index of %s\n", w->path);
+    }
+    free(index);
+    uint64_t count = h->count;
+    munmap(w->map, fileLen(w->capacity));
+    ftruncate(w->fd, fileLen(count)); // the unused rest
+    close(w->fd);
+    w->map = 0;
+    w->fd  = -1;
+    w->path[0] = 0;
+}
+
+// the local day of t, [start, end) in µs. not always 24 h.
+static void dayOf(int64_t t, int64_t* start, int64_t* end, struct tm* tm) {
+    time_t s = t / 1000000;
+    localtime_r(&s, tm);
+    tm->tm_hour = tm->tm_min = tm->tm_sec = 0;
+    tm->tm_isdst = -1;
+    struct tm next = *tm;
+    *start = (int64_t)mktime(tm) * 1000000;
+    next.tm_mday++;
+    *end = (int64_t)mktime(&next) * 1000000;
+}
+
+static bool dayOpen(ArchiveWriter* w, int64_t t) {
+    struct tm tm;
+    struct stat st;
+    dayOf(t, &w->dayStart, &w->dayEnd, &tm);
+    if (snprintf(w->path, sizeof(w->path), "%s/ebus-%s%s%04d%02d%02d.arc", w->dir, w->bus, w->bus[0] ? "-" : "",
+            tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday) >= (int)sizeof(w->path)) {
+        printf("archive: path too long in %s\n", w->dir);
+        w->path[0] = 0;
+        return false;
+    }
+    w->fd = open(w->path, O_RDWR | O_CREAT, 0644);
+    if (w->fd < 0 || fstat(w->fd, &st) != 0) {
+        printf("archive: could not open %s\n", w->path);
+        if (w->fd >= 0) close(w->fd);
+        w->fd = -1;
+        return false;
+    }
+    // continue what is there (of the same day), as far as the header says
+    uint64_t count = 0;
+    ArchiveHeader h;
+    if (st.st_size >= ARCHIVE_HEADER_LEN && pread(w->fd, &h, sizeof(h), 0) == sizeof(h) && h.magic == ARCHIVE_MAGIC
+        && h.version == ARCHIVE_VERSION && h.recordLen == ARCHIVE_RECORD_LEN && fileLen(h.count) <= (size_t)st.st_size) {
+        count = h.count;
+    }
+    w->capacity = (count / ARCHIVE_GROW_RECORDS + 1) * ARCHIVE_GROW_RECORDS;
+    w->map = (uint8_t*)MAP_FAILED;
+    if (ftruncate(w->fd, fileLen(w->capacity)) == 0) {
+        w->map = (uint8_t*)mmap(0, fileLen(w->capacity), PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+    }
+    if (w->map == MAP_FAILED) {
+        printf("archive: could not map %s\n", w->path);
+        close(w->fd);
+        w->fd  = -1;
+        w->map = 0;
+        return false;
+    }
+    ArchiveHeader* hp = (ArchiveHeader*)w->map;
+    if (count == 0) {
+        memset(hp, 0, sizeof(*hp));
+        hp->magic     = ARCHIVE_MAGIC;
+        hp->version   = ARCHIVE_VERSION;
+        hp->recordLen = ARCHIVE_RECORD_LEN;
+        hp->day       = w->dayStart;
+        strcpy(hp->bus, w->bus);
+    }
+    w->countDays++;
+    return true;
+}
+
+static bool grow(ArchiveWriter* w) {
+    uint64_t capacity = w->capacity + ARCHIVE_GROW_RECORDS;
+    if (capacity > ARCHIVE_MAX_RECORDS || ftruncate(w->fd, fileLen(capacity)) != 0) {
+        return false;
+    }
+    void* map = mremap(w->map, fileLen(w->capacity), fileLen(capacity), MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    w->map = (uint8_t*)map;
+    w->capacity = capacity;
+    return true;
+}
+
+bool archiveAppend(ArchiveWriter* w, int64_t t, uint8_t flags, const uint8_t* data, int len) {
+    if (w->map && (t >= w->dayEnd || t < w->dayStart)) {
+        archiveWriterClose(w);
+    }
+    if (!w->map) {
+        // once per day, not once per telegram
+        if ((w->failed && t >= w->dayStart && t < w->dayEnd) || !(w->failed = !dayOpen(w, t), w->map)) {
+            w->countDropped++;
+            return false;
+        }
+    }
+    if (((ArchiveHeader*)w->map)->count >= w->capacity && !grow(w)) {
+        w->countDropped++;
+        return false;
+    }
+    ArchiveHeader* h = (ArchiveHeader*)w->map; // grow may have moved it
+    ArchiveRecord* r = (ArchiveRecord*)(w->map + fileLen(h->count));
+    r->t     = t;
+    r->flags = flags | (len > ARCHIVE_DATA_LEN ? ARCHIVE_TRUNCATED : 0);
+    r->len   = MIN(len, 255);
+    memcpy(r->data, data, MIN(len, ARCHIVE_DATA_LEN));
+    h->count++; // last, see archive.h
+    return true;
+}
+
+
+//////////////////////////
+// Reading
+
+bool archiveOpen(Archive* a, const char* path) {
+    struct stat st;
+    memset(a, 0, sizeof(*a));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < ARCHIVE_HEADER_LEN) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    a->mapLen = st.st_size;
+    a->map = mmap(0, a->mapLen, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (a->map == MAP_FAILED) {
+        a->map = 0;
+        return false;
+    }
+    a->header  = (const ArchiveHeader*)a->map;
+    a->records = (const ArchiveRecord*)((const uint8_t*)a->map + ARCHIVE_HEADER_LEN);
+    if (a->header->magic != ARCHIVE_MAGIC || a->header->version != ARCHIVE_VERSION || a->header->recordLen != ARCHIVE_RECORD_LEN) {
+        archiveClose(a);
+        return false;
+    }
+    // records written after we looked at the header are not ours
+    a->count = MIN(a->header->count, (uint64_t)(a->mapLen - ARCHIVE_HEADER_LEN) / ARCHIVE_RECORD_LEN);
+
+    char idx[ARCHIVE_PATH_LEN+8];
+    if (snprintf(idx, sizeof(idx), "%s.idx", path) < (int)sizeof(idx) && (fd = open(idx, O_RDONLY)) >= 0) {
+        if (fstat(fd, &st) == 0 && st.st_size >= ARCHIVE_IDX_HEADER_LEN) {
+            a->index = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            a->indexLen = st.st_size;
+            if (a->index == MAP_FAILED) {
+                a->index = 0;
+            } else if (!indexValid(a->index, a->indexLen, a->count)) {
+                munmap(a->index, a->indexLen);
+                a->index = 0;
+            }
+        }
+        close(fd);
+    }
+    if (!a->index) {
+        // missing, or the day is still being written
+        if (!(a->index = indexBuild(a->records, a->count, &a->indexLen))) {
+            archiveClose(a);
+            return false;
+        }
+        a->indexBuilt = true;
+        indexSave(path, a->index, a->indexLen); // read-only is fine, just slower next time
+    }
+    const ArchiveIndexHeader* h = (const ArchiveIndexHeader*)a->index;
+    a->nkeys    = h->nkeys;
+    a->keys     = (const ArchiveKeyEntry*)((const uint8_t*)a->index + ARCHIVE_IDX_HEADER_LEN);
+    a->postings = (const uint32_t*)(a->keys + a->nkeys);
+    return true;
+}
+
+void archiveClose(Archive* a) {
+    if (a->index) {
+        if (a->indexBuilt) free(a->index);
+        else               munmap(a->index, a->indexLen);
+    }
+    if (a->map) {
+        munmap(a->map, a->mapLen);
+    }
+    memset(a, 0, sizeof(*a));
+}
+
+// the postings of one key in [from, to]: [*lo, *hi). they are in time order, so that is two binary searches.
+static void postingsRange(Archive* a, const uint32_t* p, uint32_t n, int64_t from, int64_t to, uint32_t* lo, uint32_t* hi) {
+    uint32_t l = 0, h = n;
+    while (l < h) {
+        uint32_t mid = l + (h-l)/2;
+        if (a->records[p[mid]].t < from) l = mid+1;
+        else                             h = mid;
+    }
+    *lo = l;
+    for (h = n; l < h;) {
+        uint32_t mid = l + (h-l)/2;
+        if (a->records[p[mid]].t <= to) l = mid+1;
+        else                            h = mid;
+    }
+    *hi = l;
+}
+
+uint64_t archiveFind(Archive* a, uint64_t key, uint64_t mask, int64_t from, int64_t to, ArchiveRecordFn* fn, void* ctx) {
+    uint32_t lo, hi;
+    key &= mask;
+    if (mask == ARCHIVE_KEY_ALL) {
+        uint32_t l = 0, h = a->nkeys;
+        while (l < h) {
+            uint32_t mid = l + (h-l)/2;
+            if (a->keys[mid].key < key) l = mid+1;
+            else                        h = mid;
+        }
+        if (l == a->nkeys || a->keys[l].key != key) {
+            return 0;
+        }
+        const uint32_t* p = &a->postings[a->keys[l].first];
+        postingsRange(a, p, a->keys[l].count, from, to, &lo, &hi);
+        for (uint32_t i=lo; i<hi; i++) {
+            fn(ctx, &a->records[p[i]]);
+        }
+        return hi-lo;
+    }
+    // several keys (e.g. any QQ): what they have in range, merged into time order
+    uint64_t n = 0;
+    for (uint32_t k=0; k<a->nkeys; k++) {
+        if ((a->keys[k].key & mask) == key) {
+            postingsRange(a, &a->postings[a->keys[k].first], a->keys[k].count, from, to, &lo, &hi);
+            n += hi-lo;
+        }
+    }
+    uint32_t* merged = (uint32_t*)malloc(n ? n*sizeof(uint32_t) : 1);
+    if (!merged) {
+        return 0;
+    }
+    n = 0;
+    for (uint32_t k=0; k<a->nkeys; k++) {
+        if ((a->keys[k].key & mask) == key) {
+            const uint32_t* p = &a->postings[a->keys[k].first];
+            postingsRange(a, p, a->keys[k].count, from, to, &lo, &hi);
+            memcpy(&merged[n], &p[lo], (hi-lo)*sizeof(uint32_t));
+            n += hi-lo;
+        }
+    }
+    std::sort(merged, merged+n);
+    for (uint64_t i=0; i<n; i++) {
+        fn(ctx, &a->records[merged[i]]);
+    }
+    free(merged);
+    return n;
+}
+
+uint64_t archiveScan(Archive* a, uint64_t key, uint64_t mask, int64_t from, int64_t to, ArchiveRecordFn* fn, void* ctx) {
+    uint64_t found = 0;
+    key &= mask;
+    for (uint64_t i=0; i<a->count; i++) {
+        const ArchiveRecord* r = &a->records[i];
+        uint64_t k = archiveKey(r->data, MIN(r->len, ARCHIVE_DATA_LEN));
+        if (k != UINT64_MAX && (k & mask) == key && r->t >= from && r->t <= to) {
+            fn(ctx, r);
+            found++;
+        }
+    }
+    return found;
+}
@@ -0,0 +1,125 @@
+//Copyright (C) 2025 makischu
+
+//archive: daily files of received telegrams, fixed-size records, with an index on the register for offline queries.
+// written by ebusd-light (-d dir), read through mmap by ebusarchive (archive_query.cpp): "all telegrams of register X
+// between t1 and t2" touches only the records of X, instead of a whole day of CSV per day.
+// see README for the query tool.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// <dir>/ebus-YYYYMMDD.arc, ebus-<bus>-YYYYMMDD.arc with several buses. one file per local day, host byte order:
+//  header  ARCHIVE_HEADER_LEN: u32 magic, u32 version, u32 record length, u32 reserved, i64 start of the day [µs since
+//          epoch], u64 nr of records, bus name (zero-terminated)
+//  records ARCHIVE_RECORD_LEN each, in the order received: i64 time [µs since epoch], u8 flags, u8 length of the
+//          telegram, the telegram (escapes resolved, as on ebus/ll/rx). longer ones are cut, see ARCHIVE_TRUNCATED.
+// the count in the header is updated after each record, so the file is readable while it is written.
+//
+// <file>.idx, the index: u32 magic, u32 version, u64 records covered, u32 nr of keys, u32 reserved, u64 nr of postings,
+//  then the keys (u64 key, u32 first posting, u32 count), ascending, then the postings (u32 record nr), per key in
+//  time order. written when the day is over, built (and saved if possible) by archiveOpen if missing or behind.
+#define ARCHIVE_HEADER_LEN   64
+#define ARCHIVE_RECORD_LEN   64
+#define ARCHIVE_DATA_LEN     (ARCHIVE_RECORD_LEN-10)  // a full master-slave telegram has up to 44 bytes
+#define ARCHIVE_MAX_RECORDS  (1<<24)                  // per day, the rest is dropped. ~200 telegrams/s
+#define ARCHIVE_GROW_RECORDS 65536                    // the file grows in steps of 4 MB
+#define ARCHIVE_BUS_LEN      32
+#define ARCHIVE_DIR_LEN      200
+#define ARCHIVE_PATH_LEN     (ARCHIVE_DIR_LEN + ARCHIVE_BUS_LEN + 24)  // dir/ebus-bus-YYYYMMDD.arc
+#define ARCHIVE_TRUNCATED    0x80                     // in flags, besides TELEGRAM_*: len is more than data holds
+
+struct ArchiveHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordLen;
+    uint32_t reserved;
+    int64_t  day;
+    uint64_t count;
+    char     bus[ARCHIVE_BUS_LEN];
+};
+
+struct ArchiveRecord {
+    int64_t t;
+    uint8_t flags;
+    uint8_t len;
+    uint8_t data[ARCHIVE_DATA_LEN];
+};
+
+// the register: QQ ZZ PB SB and the first payload byte (0 if there is none), 40 bits.
+// mask: ARCHIVE_KEY_ANY_QQ etc. cleared for positions that don't matter.
+#define ARCHIVE_KEY_ALL      0xFFFFFFFFFFULL
+#define ARCHIVE_KEY_ANY_QQ   0x00FFFFFFFFULL
+uint64_t archiveKey(const uint8_t* data, int len);  // len >= 5, otherwise not indexed (returns UINT64_MAX)
+
+
+//////////////////////////
+// Writing
+
+struct ArchiveWriter {
+    char     dir[ARCHIVE_DIR_LEN];
+    char     bus[ARCHIVE_BUS_LEN];
+    char     path[ARCHIVE_PATH_LEN];  // current day, "" before the first record
+    int      fd;
+    uint8_t* map;
+    uint64_t capacity;       // records the file has room for at the moment
+    int64_t  dayStart, dayEnd;
+    bool     failed;         // could not open the file of the day, drop until the next one
+    // statistics
+    int      countDropped, countDays;
+};
+
+// creates dir if needed. bus: "" for a single bus.
+bool archiveWriterInit(ArchiveWriter* w, const char* dir, const char* bus);
+// t in µs since epoch. a new day starts a new file, the previous one gets its index (on the caller's thread, some
+// 10 ms for a busy day). a file of the same day is continued, e.g. after a restart.
+bool archiveAppend(ArchiveWriter* w, int64_t t, uint8_t flags, const uint8_t* data, int len);
+// ends the current file and writes its index.
+void archiveWriterClose(ArchiveWriter* w);
+
+
+//////////////////////////
+// Reading
+
+struct ArchiveKeyEntry {
+    uint64_t key;
+    uint32_t first;
+    uint32_t count;
+};
+
+struct Archive {
+    const ArchiveHeader*   header;
+    const ArchiveRecord*   records;
+    uint64_t               count;
+    const ArchiveKeyEntry* keys;
+    uint32_t               nkeys;
+    const uint32_t*        postings;
+    void*                  map;
+    size_t                 mapLen;
+    void*                  index;      // mapped, or built here (malloc)
+    size_t                 indexLen;
+    bool                   indexBuilt;
+};
+
+// maps the file and its index. false if it is not an archive.
+bool archiveOpen(Archive* a, const char* path);
+void archiveClose(Archive* a);
+
+// records of the register with from <= t <= to, in time order. returns their number.
+typedef void ArchiveRecordFn(void* ctx, const ArchiveRecord* r);
+uint64_t archiveFind(Archive* a, uint64_t key, uint64_t mask, int64_t from, int64_t to, ArchiveRecordFn* fn, void* ctx);
+// the same without index, by looking at every record. reference for the query tool (-S).
+uint64_t archiveScan(Archive* a, uint64_t key, uint64_t mask, int64_t from, int64_t to, ArchiveRecordFn* fn, void* ctx);
@@ -0,0 +1,253 @@
+//Copyright (C) 2025 makischu
+
+//ebusarchive: offline queries on the telegram archive of ebusd-light (-d dir), see archive.h.
+// the counterpart of dfe['telegram'].str.startswith(...) and str[a:b].value_counts() on whole-day CSVs:
+// only the records of the register are looked at, through the index, so a year of archives answers interactively.
+// build: see CMakeLists.txt
+// run:   ebusarchive [-d dir] [-b bus] [-f from] [-t to] [-S] tel REGISTER         telegrams of the register, in time order
+//        ebusarchive [-d dir] [-b bus] [-f from] [-t to] [-S] hist REGISTER N M    histogram of the bytes N..M of them
+//        ebusarchive [-d dir] [-b bus] [-f from] [-t to] keys                       registers and their counts
+// REGISTER: QQ ZZ PB SB and the first payload byte, e.g. "71 08 B5 1A 05" or 7108B51A05, xx for any QQ.
+// N M:      offsets into the telegram, 0 is QQ, inclusive, up to 8 bytes. "71 08 B5 1A 04 05 ..." str[21:26] is 7 8.
+// from/to:  local time, 2025-09-26, "2025-09-26 14:00", 2025-09-26T14:00:00 or seconds since epoch.
+//           a date alone as to means the end of that day.
+// -S:       scan every record instead of using the index, for comparison.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "archive.h"
+#include "hexcodec.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+static double nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+// µs since epoch. endOfDay: a date alone means its last µs.
+static bool parseTime(const char* s, bool endOfDay, int64_t* t) {
+    static const char* formats[] = { "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+    char* end;
+    long long secs = strtoll(s, &end, 10);
+    if (*s && !*end) {
+        *t = secs * 1000000;
+        return true;
+    }
+    for (int i=0; i<(int)(sizeof(formats)/sizeof(formats[0])); i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* rest = strptime(s, formats[i], &tm);
+        if (rest && !*rest) {
+            bool dateOnly = (i == 4);
+            tm.tm_isdst = -1;
+            if (dateOnly && endOfDay) tm.tm_mday++;
+            *t = (int64_t)mktime(&tm) * 1000000 - (dateOnly && endOfDay ? 1 : 0);
+            return true;
+        }
+    }
+    printf("time %s: use 2025-09-26, \"2025-09-26 14:00[:00]\" or seconds since epoch\n", s);
+    return false;
+}
+
+// "71 08 B5 1A 05", 7108B51A05, "xx 08 B5 11 01": key and mask.
+static bool parseRegister(const char* s, uint64_t* key, uint64_t* mask) {
+    char hex[16];
+    int n = 0;
+    for (; *s; s++) {
+        if (*s == ' ') continue;
+        if (n == 10 || !(isxdigit(*s) || *s == 'x' || *s == 'X')) return false;
+        hex[n++] = *s;
+    }
+    if (n != 10) return false;
+    *key = 0;
+    *mask = 0;
+    for (int i=0; i<5; i++) {
+        uint8_t b;
+        *key <<= 8;
+        *mask <<= 8;
+        if (tolower(hex[2*i]) == 'x' && tolower(hex[2*i+1]) == 'x') continue;
+        if (hexstr2bytes(&hex[2*i], 2, &b, 1) != 1) return false;
+        *key |= b;
+        *mask |= 0xFF;
+    }
+    return true;
+}
+
+// archives of the bus whose day overlaps [from, to], oldest first. the day is in the name, so others are not opened.
+static std::vector<std::string> archiveFiles(const char* dir, const char* bus, int64_t from, int64_t to) {
+    std::vector<std::string> files;
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "ebus-%s%s", bus, bus[0] ? "-" : "");
+    int fromDay = 0, toDay = 99999999;
+    struct tm tm;
+    time_t s;
+    if (from > INT64_MIN) { s = from / 1000000; localtime_r(&s, &tm); fromDay = (tm.tm_year+1900)*10000 + (tm.tm_mon+1)*100 + tm.tm_mday; }
+    if (to < INT64_MAX)   { s = to / 1000000;   localtime_r(&s, &tm); toDay   = (tm.tm_year+1900)*10000 + (tm.tm_mon+1)*100 + tm.tm_mday; }
+    DIR* d = opendir(dir);
+    struct dirent* e;
+    while (d && (e = readdir(d))) {
+        int day, len = strlen(prefix);
+        char ext[8];
+        if (strncmp(e->d_name, prefix, len) != 0 || strlen(e->d_name) != (size_t)len+12
+            || sscanf(e->d_name+len, "%8d.%3s", &day, ext) != 2 || strcmp(ext, "arc") != 0) {
+            continue;
+        }
+        if (day >= fromDay && day <= toDay) {
+            files.push_back(std::string(dir) + "/" + e->d_name);
+        }
+    }
+    if (d) closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+#define HIST_SHORT UINT64_MAX  // telegrams that end before M
+struct Query {
+    int n, m;  // hist: byte range, at most 8 bytes
+    std::unordered_map<uint64_t, uint64_t> hist;
+};
+
+static void printRecord(void* ctx, const ArchiveRecord* r) {
+    char hex[3*ARCHIVE_DATA_LEN+1], when[32];
+    time_t s = r->t / 1000000;
+    struct tm tm;
+    localtime_r(&s, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    bytes2hexstr(r->data, MIN(r->len, ARCHIVE_DATA_LEN), hex, sizeof(hex));
+    printf("%s.%03d %s%s\n", when, (int)(r->t / 1000 % 1000), hex, (r->flags & ARCHIVE_TRUNCATED) ? " ..." : "");
+}
+
+static void histRecord(void* ctx, const ArchiveRecord* r) {
+    Query* q = (Query*)ctx;
+    uint64_t v = 0;
+    if (q->m >= MIN(r->len, ARCHIVE_DATA_LEN)) {
+        q->hist[HIST_SHORT]++;
+        return;
+    }
+    for (int i=q->n; i<=q->m; i++) {
+        v = v<<8 | r->data[i];
+    }
+    q->hist[v]++;
+}
+
+// the hist or key value as hex bytes, e.g. "3D 3E"
+static std::string hexValue(uint64_t v, int bytes) {
+    uint8_t b[8];
+    char hex[3*8+1];
+    if (v == HIST_SHORT) {
+        return "(short)";
+    }
+    for (int i=bytes-1; i>=0; i--, v>>=8) {
+        b[i] = v & 0xFF;
+    }
+    bytes2hexstr(b, bytes, hex, sizeof(hex));
+    return hex;
+}
+
+int main(int argc, char* argv[]) {
+    const char* dir = ".";
+    const char* bus = "";
+    int64_t from = INT64_MIN, to = INT64_MAX;
+    bool scan = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:f:t:S")) != -1) {
+        switch (opt) {
+            case 'd': dir  = optarg; break;
+            case 'b': bus  = optarg; break;
+            case 'f': if (!parseTime(optarg, false, &from)) return 1; break;
+            case 't': if (!parseTime(optarg, true,  &to))   return 1; break;
+            case 'S': scan = true; break;
+            default: optind = argc; break;
+        }
+    }
+    const char* cmd = optind < argc ? argv[optind] : "";
+    Query q;
+    uint64_t key = 0, mask = 0;
+    bool tel  = strcmp(cmd, "tel") == 0  && argc-optind == 2;
+    bool hist = strcmp(cmd, "hist") == 0 && argc-optind == 4;
+    bool keys = strcmp(cmd, "keys") == 0 && argc-optind == 1;
+    if ((tel || hist) && !parseRegister(argv[optind+1], &key, &mask)) {
+        printf("register %s: QQ ZZ PB SB and the first payload byte, hex, xx for any\n", argv[optind+1]);
+        return 1;
+    }
+    if (hist) {
+        q.n = atoi(argv[optind+2]);
+        q.m = atoi(argv[optind+3]);
+        hist = q.n >= 0 && q.m >= q.n && q.m < ARCHIVE_DATA_LEN && q.m-q.n < 8;
+    }
+    if (!tel && !hist && !keys) {
+        printf("usage: %s [-d dir] [-b bus] [-f from] [-t to] [-S] tel REGISTER\n"
+               "       %s [-d dir] [-b bus] [-f from] [-t to] [-S] hist REGISTER N M\n"
+               "       %s [-d dir] [-b bus] [-f from] [-t to] keys\n"
+               "see archive_query.cpp\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    double start = nowMs();
+    uint64_t records = 0, found = 0;
+    std::unordered_map<uint64_t, uint64_t> keyCounts;
+    std::vector<std::string> files = archiveFiles(dir, bus, from, to);
+    for (const std::string& path : files) {
+        Archive a;
+        if (!archiveOpen(&a, path.c_str())) {
+            fprintf(stderr, "%s is not an archive, skipped\n", path.c_str());
+            continue;
+        }
+        records += a.count;
+        if (keys) {
+            // the index alone, unless the day is only partly asked for
+            bool whole = a.count == 0 || (a.records[0].t >= from && a.records[a.count-1].t <= to);
+            for (uint32_t k=0; k<a.nkeys; k++) {
+                uint64_t n = whole ? a.keys[k].count : archiveFind(&a, a.keys[k].key, ARCHIVE_KEY_ALL, from, to, [](void*, const ArchiveRecord*){}, 0);
+                if (n) keyCounts[a.keys[k].key] += n;
+                found += n;
+            }
+        } else {
+            ArchiveRecordFn* fn = tel ? printRecord : histRecord;
+            found += scan ? archiveScan(&a, key, mask, from, to, fn, &q) : archiveFind(&a, key, mask, from, to, fn, &q);
+        }
+        archiveClose(&a);
+    }
+
+    if (hist || keys) {
+        std::vector<std::pair<std::string, uint64_t>> rows;
+        for (auto& h : q.hist) {
+            rows.push_back(std::make_pair(hexValue(h.first, q.m-q.n+1), h.second));
+        }
+        for (auto& k : keyCounts) {
+            rows.push_back(std::make_pair(hexValue(k.first, 5), k.second));
+        }
+        std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        for (auto& r : rows) {
+            printf("%-16s %10llu %6.2f%%\n", r.first.c_str(), (unsigned long long)r.second, 100.0*r.second/(found ? found : 1));
+        }
+    }
+    fprintf(stderr, "%zu files, %llu records, %llu found, %.1f ms\n", files.size(), (unsigned long long)records, (unsigned long long)found, nowMs()-start);
+    return 0;
+}
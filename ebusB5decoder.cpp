@@ -0,0 +1,460 @@
+//Copyright (C) 2025 makischu
+
+//ebusB5decoder: translates vaillant-specific ebus-telegrams to readable json.
+// C++ counterpart of decodeTelegram in ebusB5decoder.py, so that ebusd-light can publish decoded values itself.
+// see README for details.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// the python version is a tree of if-statements. here the same knowledge is a table instead,
+// one row per register (or sub-register), which is easier to extend and faster to look up.
+// when adding registers, keep both in sync (python is still the place for reverse engineering).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ebusB5decoder.h"
+
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+
+
+//////////////////////////
+// JSON output, formatted like python's json.dumps: {"key": value, "key2": value}
+
+struct JsonObj {
+    char* str;
+    int   maxLen;
+    int   len;
+    int   count;
+    bool  overflow;
+    B5Values* values;   // optional, numbers as they are added
+};
+
+static void valuesAdd(JsonObj* o, const char* key, double value) {
+    if (o->values && o->values->count < B5_MAX_VALUES) {
+        o->values->name[o->values->count]    = key;
+        o->values->value[o->values->count++] = value;
+    }
+}
+
+static void jsonPut(JsonObj* o, const char* s, int n) {
+    if (o->len+n >= o->maxLen) {
+        o->overflow = true;
+        return;
+    }
+    memcpy(o->str+o->len, s, n);
+    o->len += n;
+}
+
+// appends ["key": value], the value already formatted (and quoted if it's a string).
+// this runs for every decoded value, so no printf here.
+static void jsonAppend(JsonObj* o, const char* key, const char* value, bool quote) {
+    if (o->count++) jsonPut(o, ", ", 2);
+    jsonPut(o, "\"", 1);
+    jsonPut(o, key, strlen(key));
+    jsonPut(o, quote ? "\": \"" : "\": ", quote ? 4 : 3);
+    jsonPut(o, value, strlen(value));
+    if (quote) jsonPut(o, "\"", 1);
+}
+
+// python's repr of a float: the shortest representation that reads back the same, at least one decimal.
+static void fmtFloat(char* s, int maxLen, double v) {
+    for (int decimals=0; decimals<=17; decimals++) {
+        snprintf(s, maxLen, "%.*f", decimals, v);
+        if (strtod(s, 0) == v) {
+            break;
+        }
+    }
+    if (!strchr(s, '.')) {
+        strncat(s, ".0", maxLen-strlen(s)-1);
+    }
+}
+
+// python's repr of value/div. the quotient of an integer by 10 or 2^n has at most 1 or n decimals,
+// and the exact decimal is also the shortest one, so one printf is enough. other divisors take the long way.
+static void fmtQuotient(char* s, int maxLen, long value, int div) {
+    int decimals = -1;
+    if (div == 10) {
+        decimals = 1;
+    } else if ((div & (div-1)) == 0) {
+        for (decimals=0; (1<<decimals) < div; decimals++);
+    }
+    if (decimals < 0) {
+        fmtFloat(s, maxLen, (double)value/div);
+        return;
+    }
+    int len = snprintf(s, maxLen, "%.*f", MAX(decimals, 1), (double)value/div);
+    while (len > 2 && s[len-1] == '0' && s[len-2] != '.') {
+        s[--len] = 0;
+    }
+}
+
+static void jsonAddInt(JsonObj* o, const char* key, long value) {
+    char tmp[24];
+    char* p = tmp+sizeof(tmp)-1;
+    unsigned long u = value < 0 ? -(unsigned long)value : value;
+    *p = 0;
+    do {
+        *--p = '0' + u%10;
+        u /= 10;
+    } while (u);
+    if (value < 0) *--p = '-';
+    jsonAppend(o, key, p, false);
+    valuesAdd(o, key, value);
+}
+
+static void jsonAddQuotient(JsonObj* o, const char* key, long value, int div) {
+    char tmp[32];
+    fmtQuotient(tmp, sizeof(tmp), value, div);
+    jsonAppend(o, key, tmp, false);
+    valuesAdd(o, key, (double)value/div);
+}
+
+static void jsonAddStr(JsonObj* o, const char* key, const char* value) {
+    jsonAppend(o, key, value, true);
+    if (o->values) o->values->strings++;
+}
+
+
+//////////////////////////
+// Register table
+
+enum B5Src  : uint8_t { M, S };          // M: master payload after ID (python: pay_m_v), S: slave payload (pay_s)
+enum B5Type : uint8_t { U8, S8, U16, S16 }; // little endian
+
+struct B5Match {          // bytes that must match, e.g. a sub-register or test nr. len 0: unused
+    B5Src   src;
+    uint8_t ofs;
+    uint8_t len;
+    uint8_t val[3];
+};
+
+typedef void B5FieldFn(const char* name, const uint8_t* p, uint16_t div, JsonObj* out);
+
+struct B5Field {
+    const char* name;
+    B5Src      src;
+    uint8_t    ofs;
+    uint16_t   div;       // 1: integer, otherwise a float value/div (like python's "/")
+    B5FieldFn* decode;    // decodeInt/decodeFloat, instantiated for the field type. see FIELD
+};
+
+struct B5Register;
+typedef void B5DecodeFn(const B5Register* reg, const uint8_t* m, const uint8_t* s, JsonObj* out);
+
+#define ANYQQ -1
+struct B5Register {
+    int16_t     QQ;       // ANYQQ: register is identified by ZZ PB SB ID only
+    uint8_t     ZZ, PB, SB, ID;
+    int8_t      lenM;     // required payload lengths, -1: don't care
+    int8_t      lenS;
+    B5Match     match[2];
+    B5Field     fields[4];
+    B5DecodeFn* decode;   // for values that are not plain numbers. uses fields[0].name
+};
+
+// one instance per type, so that decoding a field does not branch on its type at runtime.
+template<B5Type T> static long readValue(const uint8_t* p);
+template<> long readValue<U8> (const uint8_t* p) { return p[0]; }
+template<> long readValue<S8> (const uint8_t* p) { return (int8_t)p[0]; }
+template<> long readValue<U16>(const uint8_t* p) { return p[0] | (p[1]<<8); }
+template<> long readValue<S16>(const uint8_t* p) { return (int16_t)(p[0] | (p[1]<<8)); }
+
+template<B5Type T> static void decodeInt(const char* name, const uint8_t* p, uint16_t div, JsonObj* out) {
+    jsonAddInt(out, name, readValue<T>(p));
+}
+
+template<B5Type T> static void decodeFloat(const char* name, const uint8_t* p, uint16_t div, JsonObj* out) {
+    jsonAddQuotient(out, name, readValue<T>(p), div);
+}
+
+#define FIELD(name, src, ofs, type, div) { name, src, ofs, div, (div) == 1 ? decodeInt<type> : decodeFloat<type> }
+
+//Leistungsbegrenzung. FF FF = off
+static void decodePwrLim(const B5Register* reg, const uint8_t* m, const uint8_t* s, JsonObj* out) {
+    if (m[0] == 0xFF && m[1] == 0xFF) {
+        jsonAddStr(out, reg->fields[0].name, "-");
+    } else {
+        jsonAddInt(out, reg->fields[0].name, readValue<U16>(m) * 10);
+    }
+}
+
+//nr slots per weekday
+static void decodeScheduleSlots(const B5Register* reg, const uint8_t* m, const uint8_t* s, JsonObj* out) {
+    char res[64] = "";
+    for (int i=0; i<7; i++) {
+        snprintf(res+strlen(res), sizeof(res)-strlen(res), "%d;", s[1+i]);
+    }
+    jsonAddStr(out, reg->fields[0].name, res);
+}
+
+//schedule read. dow;slot;starthour;startmin;endhour;endmin[;temp]
+static void decodeScheduleSlotR(const B5Register* reg, const uint8_t* m, const uint8_t* s, JsonObj* out) {
+    char res[64], temp[32];
+    snprintf(res, sizeof(res), "%d;%d;%d;%d;%d;%d", m[2], m[3], s[1], s[2], s[3], s[4]);
+    if (m[1] == 0x00) { // heating, with room temperature
+        fmtQuotient(temp, sizeof(temp), readValue<U16>(&s[5]), 10);
+        snprintf(res+strlen(res), sizeof(res)-strlen(res), ";%s", temp);
+    }
+    jsonAddStr(out, reg->fields[0].name, res);
+}
+
+//schedule write. dow;slot;slots;starthour;startmin;endhour;endmin[;temp]
+static void decodeScheduleSlotW(const B5Register* reg, const uint8_t* m, const uint8_t* s, JsonObj* out) {
+    char res[64], temp[32];
+    snprintf(res, sizeof(res), "%d;%d;%d;%d;%d;%d;%d", m[2], m[3], m[4], m[5], m[6], m[7], m[8]);
+    if (m[1] == 0x00) {
+        fmtQuotient(temp, sizeof(temp), readValue<U16>(&m[9]), 10);
+        snprintf(res+strlen(res), sizeof(res)-strlen(res), ";%s", temp);
+    }
+    jsonAddStr(out, reg->fields[0].name, res);
+}
+
+//DCF-Clock, BCD
+static void decodeDCFTime(const B5Register* reg, const uint8_t* m, const uint8_t* s, JsonObj* out) {
+    char res[16];
+    snprintf(res, sizeof(res), "%02x:%02x:%02x", s[3], s[2], s[1]);
+    jsonAddStr(out, reg->fields[0].name, res);
+}
+
+// 71 08 | B5 14 xx 05  | XN 03 FF FF  |  XN 00 AA AA     test menu values T.0.xxx
+#define TEST(nr, name, type, div) \
+    { ANYQQ, 0x08, 0xB5, 0x14, 0x05,  4,  4, {{M,1,3,{0x03,0xFF,0xFF}}, {S,0,1,{nr}}}, {FIELD(name, S, 2, type, div)}, 0 }
+// 71 08 | B5 1A xx 05  | xx 32 PA |  xx 08 0E AA BB xx xx xx xx xx   AA BB depends on additional parameter PA!
+#define EXT(pa, name, type, div) \
+    { ANYQQ, 0x08, 0xB5, 0x1A, 0x05,  3, 10, {{M,1,2,{0x32,pa}}}, {FIELD(name, S, 3, type, div)}, 0 }
+
+static constexpr B5Register registers[] = {
+    //QQ    ZZ    PB    SB    ID   lenM lenS  match                                   fields / decode
+    //Leistungsbegrenzung  f108b53103012c01 / 0101  300 *10 = 3000W
+    { ANYQQ, 0x08, 0xB5, 0x31, 0x01,  2,  1, {},                                      {{"HpElPwrLim[W]"}}, decodePwrLim },
+    //"31 15 B5 55 07 A4 00 04 FF FF FF FF 82 00 09 00 02 02 02 02 02 02 02 00 23 00 AA"
+    { ANYQQ, 0x15, 0xB5, 0x55, 0xA4,  6,  9, {{M,0,2,{0x00,0x04}}, {S,0,1,{0x00}}}, {{"SilentScheduleSlots"}},  decodeScheduleSlots },
+    { ANYQQ, 0x15, 0xB5, 0x55, 0xA4,  6,  9, {{M,0,2,{0x00,0x00}}, {S,0,1,{0x00}}}, {{"HeatingScheduleSlots"}}, decodeScheduleSlots },
+    //"31 15 B5 55 07 A5 00 04 00 01 FF FF 1E 00 07 00 15 00 18 00 FF FF 8E 00 AA"
+    { ANYQQ, 0x15, 0xB5, 0x55, 0xA5,  6,  7, {{M,0,2,{0x00,0x04}}, {S,0,1,{0x00}}}, {{"SilentScheduleSlotR"}},  decodeScheduleSlotR },
+    { ANYQQ, 0x15, 0xB5, 0x55, 0xA5,  6,  7, {{M,0,2,{0x00,0x00}}, {S,0,1,{0x00}}}, {{"HeatingScheduleSlotR"}}, decodeScheduleSlotR },
+    //"31 15 B5 55 0C A6 00 04 00 01 02 15 00 18 00 FF FF 64 00 01 00 9B 00 AA"
+    { ANYQQ, 0x15, 0xB5, 0x55, 0xA6, 11,  1, {{M,0,2,{0x00,0x04}}, {S,0,1,{0x00}}}, {{"SilentScheduleSlotW"}},  decodeScheduleSlotW },
+    { ANYQQ, 0x15, 0xB5, 0x55, 0xA6, 11,  1, {{M,0,2,{0x00,0x00}}, {S,0,1,{0x00}}}, {{"HeatingScheduleSlotW"}}, decodeScheduleSlotW },
+
+    TEST( 43, "WFlowT[l/h]",       U16,  1),
+    TEST(  1, "WPumpLvl[%]",       U16,  1),
+    TEST( 17, "Fan1Lvl[%]",        U16,  1),
+    TEST( 19, "CondHeat[on]",      U16,  1),
+    TEST( 20, "4PortV[on]",        U16,  1),
+    TEST( 21, "EEV[%]",            U16,  1),
+    TEST( 23, "CompHeat[on]",      U16,  1),
+    TEST( 40, "ForwTempT[C]",      S16, 10),
+    TEST( 41, "RetnTempT[C]",      S16, 10),
+    //TEST(41, "WPresT[bar]",      U16, 10), nr clash with RetnTempT, never reached in python either.
+    TEST( 48, "AirInTT[C]",        S16, 10),
+    TEST( 55, "CompOutT[C]",       S16, 10),
+    TEST( 56, "CompInT[C]",        S16, 10),
+    TEST( 57, "EEVOutT[C]",        S16, 10),
+    TEST( 59, "CondOutT[C]",       S16, 10),
+    TEST( 63, "HighPres[bar]",     U16, 10),
+    TEST( 64, "LowSPres[bar]",     U16, 10),
+    TEST( 67, "HighPresSw[ok]",    U16,  1),
+    TEST( 85, "EvapTemp[C]",       S16, 10),
+    TEST( 86, "CondTemp[C]",       S16, 10),
+    TEST( 87, "OverheatSet[K]",    S16, 10),
+    TEST( 88, "OverheatAct[K]",    S16, 10),
+    TEST( 89, "SubcoolSet[K]",     S16, 10),
+    TEST( 90, "SubcoolAct[K]",     S16, 10),
+    TEST( 93, "CompSpeed[rps]",    U16, 10),
+    TEST(123, "CompOutTempSw[ok]", U16,  1),
+    TEST( 46, "DigInS20[closed]",  U16,  1),
+    TEST( 72, "DigInS21[closed]",  U16,  1),
+    TEST(119, "DigOutMA1[on]",     U16,  1),
+    TEST(125, "DigInME[closed]",   U16,  1),
+    TEST(126, "DigOutMA2[on]",     U16,  1),
+
+    EXT(0x1E, "VV1E[?]",           U16,  1),
+    EXT(0x1F, "ForwSetT1F[C]",     U16, 16),
+    EXT(0x20, "ForwTemp20[C]",     U16, 16),
+    EXT(0x21, "EnInt[Cmin]",       S16,  1), //not sure if 1 or 2 byte
+    EXT(0x23, "PEnv[kW]",          U8,  10),
+    EXT(0x24, "PEle[kW]",          U8,  10),
+    EXT(0x25, "CompMod[%]",        U16, 16),
+    EXT(0x26, "AirInT[C]",         S16, 16),
+    EXT(0x3C, "WFlow[l/h]",        S16,  1),
+    EXT(0x3D, "VV3D[?]",           U16,  1), //not sure if 1 or 2 byte
+
+    // 03 76 | B5 12 xx 13  | xx PR FL FL xx | xx xx                     PR=Pressure (bar/10), FL=Flow (l/h)
+    { 0x03,  0x76, 0xB5, 0x12, 0x13,  5,  2, {}, {FIELD("WPres[bar]", M, 1, U8, 10), FIELD("WFlow[l/h]", M, 2, U16, 1)}, 0 },
+    //71 08 | B5 11 xx 07  |    |  LS TE TE xx xx xx xx xx xx xx        LS=kind of power level (%), TE=day yield (?)
+    { 0x71,  0x08, 0xB5, 0x11, 0x07,  0, 10, {}, {FIELD("PwrLvl[%?]", S, 0, U8, 1), FIELD("EHeatDay[kWh]", S, 1, U16, 10)}, 0 },
+    // 10 76 | B5 11 xx 01  |    |  xx xx AT AT xx xx xx xx xx           AT=outdoor temp(deg/256).
+    { 0x10,  0x76, 0xB5, 0x11, 0x01,  0,  9, {}, {FIELD("OutdTemp[C]", S, 2, S16, 256)}, 0 },
+    // 10 08 | B5 11 xx 01  |    |  VL RL xx xx xx xx xx xx xx           VL=forward flow temp RL=return flow temp  (deg/2)
+    { 0x10,  0x08, 0xB5, 0x11, 0x01,  0,  9, {}, {FIELD("ForwTempL[C]", S, 0, S8, 2), FIELD("RetnTempL[C]", S, 1, S8, 2)}, 0 },
+    // 10 08 | B5 11 xx 00  |    |  VL VL PR AA AA BB xx xx xx           VL=forw flow (deg/16). AA=analog?? BB=analog?/state?
+    { 0x10,  0x08, 0xB5, 0x11, 0x00,  0,  9, {}, {FIELD("ForwTemp[C]", S, 0, S16, 16), FIELD("WPres[bar]", S, 2, U8, 10), FIELD("AAAA[?]", S, 3, S16, 1), FIELD("OpMode", S, 5, S8, 1)}, 0 },
+    // 10 08 | B5 10 xx 00  | xx VS xx xx xx xx xx xx      | xx        VS=VLset(deg/2)
+    { 0x10,  0x08, 0xB5, 0x10, 0x00,  8,  1, {}, {FIELD("ForwSetT[C]", M, 1, U8, 2)}, 0 },
+    // 10 08 | B5 07 xx 09  | VS |  LA LA                                VS=VLset(deg/2). Air out ?? (Grad/64)
+    { 0x10,  0x08, 0xB5, 0x07, 0x09,  1,  2, {}, {FIELD("ForwSetT[C]", M, 0, U8, 2), FIELD("AirOutT?[C]", S, 0, S16, 64)}, 0 },
+    // 10 76 | B5 04 xx 00  |    |  QQ ss mm HH DD MM wd YY AT AT        DCF-Clock and Outdoortemp.
+    { 0x10,  0x76, 0xB5, 0x04, 0x00,  0, 10, {{S,0,1,{0x03}}}, {{"DCFTime"}}, decodeDCFTime },
+    // 10 FE | B5 08 xx 09  | QM                                         QM=Quiet Mode
+    { 0x10,  0xFE, 0xB5, 0x08, 0x09,  1, -1, {}, {FIELD("QuietMode", M, 0, U8, 1)}, 0 },
+};
+
+static bool registerMatches(const B5Register* reg, const uint8_t* tel, const uint8_t* m, int lenM, const uint8_t* s, int lenS) {
+    if ((reg->QQ != ANYQQ && reg->QQ != tel[0]) || reg->ZZ != tel[1] || reg->PB != tel[2] || reg->SB != tel[3] || reg->ID != tel[5]) {
+        return false;
+    }
+    if ((reg->lenM >= 0 && reg->lenM != lenM) || (reg->lenS >= 0 && reg->lenS != lenS)) {
+        return false;
+    }
+    for (int i=0; i<2; i++) {
+        const B5Match* match = &reg->match[i];
+        if (match->len && memcmp(match->src == M ? &m[match->ofs] : &s[match->ofs], match->val, match->len) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define NREGISTERS ((int)(sizeof(registers)/sizeof(registers[0])))
+
+
+//////////////////////////
+// Register index: perfect hash on the packed ZZ PB SB ID key, built at compile time.
+// QQ is not part of the key because many registers accept any master, it is checked per row.
+// rows sharing a key (test values, sub-registers) must be adjacent in the table, they form one bucket.
+
+#define INDEX_BITS 6     // 64 buckets, keep it > 2x the number of distinct keys
+#define INDEX_SIZE (1<<INDEX_BITS)
+
+struct B5Index {
+    uint32_t mult;              // 0: table could not be built
+    uint32_t key[INDEX_SIZE];
+    uint8_t  first[INDEX_SIZE]; // rows [first, first+count) of registers[]
+    uint8_t  count[INDEX_SIZE]; // 0: empty bucket
+};
+
+static constexpr uint32_t registerKey(uint8_t ZZ, uint8_t PB, uint8_t SB, uint8_t ID) {
+    return (uint32_t)ZZ<<24 | (uint32_t)PB<<16 | (uint32_t)SB<<8 | ID;
+}
+
+static constexpr uint32_t indexHash(uint32_t key, uint32_t mult) {
+    return (key*mult) >> (32-INDEX_BITS);
+}
+
+// try multipliers until no two keys share a bucket.
+static constexpr B5Index buildIndex() {
+    for (uint32_t mult=0x9E3779B1; mult<0x9E3779B1+2*1000; mult+=2) {
+        B5Index idx = {};
+        bool ok = true;
+        for (int i=0, j=0; i<NREGISTERS && ok; i=j) {
+            uint32_t key = registerKey(registers[i].ZZ, registers[i].PB, registers[i].SB, registers[i].ID);
+            for (j=i+1; j<NREGISTERS && registerKey(registers[j].ZZ, registers[j].PB, registers[j].SB, registers[j].ID) == key; j++);
+            uint32_t h = indexHash(key, mult);
+            if (idx.count[h] && idx.key[h] == key) {
+                return B5Index{};   // key split across the table
+            }
+            if (idx.count[h]) {
+                ok = false;         // collision, next multiplier
+            }
+            idx.key[h]   = key;
+            idx.first[h] = i;
+            idx.count[h] = j-i;
+        }
+        if (ok) {
+            idx.mult = mult;
+            return idx;
+        }
+    }
+    return B5Index{};
+}
+
+static constexpr B5Index registerIndex = buildIndex();
+static_assert(registerIndex.mult != 0, "register index: rows of one register must be adjacent, or increase INDEX_BITS");
+static_assert(NREGISTERS < 256, "register index: first is a uint8_t");
+
+
+//////////////////////////
+// Decoding
+
+// rows are candidates for the telegram (same key if coming from the index).
+// the frame tells where request and response are (after a NAK not at the start), see ebusframe.h.
+// we are interested in data, not bus debugging: any valid frame will do, its ACKs don't matter.
+static bool decodeRows(const B5Register* rows, int nrows, const uint8_t* tel, const EbusFrame* frame, char* jsonstr, int maxLen, int* pLen, B5Values* values) {
+    JsonObj out = { jsonstr+1, maxLen-2, 0, 0, false, values }; // room for the braces
+    if (values) {
+        values->count = values->strings = 0;
+    }
+    if (maxLen < 3 || !frame->valid) {
+        return false;
+    }
+    const uint8_t* req = &tel[frame->master];
+    int lenM = req[4];
+    if (lenM < 1) {
+        return false;
+    }
+    const uint8_t* pay_s = frame->slave >= 0 ? &tel[frame->slave+1] : 0;
+    int lenS = frame->slave >= 0 ? tel[frame->slave] : -1;
+    // first byte of the payload is a kind of index, it belongs to the register address.
+    const uint8_t* m = &req[6];
+    lenM--;
+    for (const B5Register* reg=rows; reg<rows+nrows; reg++) {
+        if (!registerMatches(reg, req, m, lenM, pay_s, lenS)) {
+            continue;
+        }
+        if (reg->decode) {
+            reg->decode(reg, m, pay_s, &out);
+        } else {
+            for (const B5Field& field : reg->fields) {
+                if (!field.name) break;
+                field.decode(field.name, field.src == M ? &m[field.ofs] : &pay_s[field.ofs], field.div, &out);
+            }
+        }
+        break; // registers are unique, first match wins.
+    }
+    if (out.count == 0 || out.overflow) {
+        return false;
+    }
+    jsonstr[0] = '{';
+    jsonstr[1+out.len] = '}';
+    jsonstr[2+out.len] = 0;
+    if (pLen) *pLen = 2+out.len;
+    return true;
+}
+
+bool decodeTelegramB5(const uint8_t* tel, int len, char* jsonstr, int maxLen, int* pLen, B5Values* values, const EbusFrame* frame) {
+    const uint8_t* req = frame ? &tel[frame->master < 0 ? 0 : frame->master] : tel;
+    if (len-(req-tel) < 6 || req[4] < 1) {
+        return false;   // no ID, no register
+    }
+    uint32_t key = registerKey(req[1], req[2], req[3], req[5]);
+    uint32_t h   = indexHash(key, registerIndex.mult);
+    if (registerIndex.count[h] == 0 || registerIndex.key[h] != key) {
+        return false;   // unknown register, the usual case. not even worth splitting (and a crc check).
+    }
+    EbusFrame split;
+    if (!frame) {
+        frameSplit(tel, len, -1, &split);
+        frame = &split;
+    }
+    return decodeRows(&registers[registerIndex.first[h]], registerIndex.count[h], tel, frame, jsonstr, maxLen, pLen, values);
+}
+
+bool decodeTelegramB5Scan(const uint8_t* tel, int len, char* jsonstr, int maxLen, int* pLen) {
+    EbusFrame frame;
+    frameSplit(tel, len, -1, &frame);
+    return decodeRows(registers, NREGISTERS, tel, &frame, jsonstr, maxLen, pLen, 0);
+}
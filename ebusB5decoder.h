@@ -0,0 +1,40 @@
+//Copyright (C) 2025 makischu
+
+//ebusB5decoder: translates vaillant-specific ebus-telegrams to readable json.
+// C++ counterpart of decodeTelegram in ebusB5decoder.py, so that ebusd-light can publish decoded values itself.
+// see README for details.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+#include "ebusframe.h"
+
+// decodes a telegram as received on the bus (QQ ZZ PB SB NN ... [ACK NN ... CRC ACK] SYN, escapes resolved)
+// into a json object of known values, e.g. {"ForwTempL[C]": 30.5, "RetnTempL[C]": 31.0}
+// same format as the python decoder (json.dumps), so consumers of ebus/ll/rxd don't see a difference.
+// returns true if anything was decoded, and jsonstr (zero-terminated) with its length in pLen (optional).
+// values (optional) receives the numbers in json order, e.g. to compare them with earlier ones.
+#define B5_MAX_VALUES 4
+struct B5Values {
+    int    count;
+    int    strings;   // values that are not numbers, not in value[]
+    double value[B5_MAX_VALUES];
+    const char* name[B5_MAX_VALUES];  // their json keys, e.g. "ForwTemp[C]". static, valid for the lifetime of the process
+};
+// frame: if the caller already split the telegram (frameSplit), 0 to split it here.
+bool decodeTelegramB5(const uint8_t* tel, int len, char* jsonstr, int maxLen, int* pLen, B5Values* values = 0, const EbusFrame* frame = 0);
+
+// same result, by scanning the whole register table. reference for ebusB5decoder_bench only.
+bool decodeTelegramB5Scan(const uint8_t* tel, int len, char* jsonstr, int maxLen, int* pLen);
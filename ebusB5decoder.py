@@ -70,27 +70,18 @@ CRC_LOOKUP_TABLE = [
 ]
     
 def ebusCRC(arraydata):
-    data = bytes(arraydata)
-    crc  = b'\x00';
-    byte = b'\x00';
-    inject=b'\xFF'
-    i=0
-    while i<len(data):
-        byte = data[i:i+1];
+    crc = 0
+    for byte in bytes(arraydata):
         # "the CRC is calculated over the EXPANDED byte transmission sequence"
-        if inject!=b'\xFF':
-            byte   = inject
-            inject = b'\xFF'
-            i-=1
-        if byte == b'\xAA':
-            byte   = b'\xA9'
-            inject = b'\x01'
-        if byte == b'\xA9':
-            byte   = b'\xA9'
-            inject = b'\x00'
-        crc = bytes([ CRC_LOOKUP_TABLE[crc[0]]  ^  byte[0] ]);
-        i+=1
-    return bytearray([ crc[0] ])
+        if byte == 0xAA:
+            expanded = [0xA9, 0x01]
+        elif byte == 0xA9:
+            expanded = [0xA9, 0x00]
+        else:
+            expanded = [byte]
+        for b in expanded:
+            crc = CRC_LOOKUP_TABLE[crc] ^ b
+    return bytearray([ crc ])
 
 def isMaster(ZZ):
     ZZi = ZZ[0]
@@ -112,7 +103,8 @@ def isACK(ACK):
     return ACK[0] == 0x00 
 
 #divide request and response, remove ACK/SYN, and make some checks to simplify further processing.
-def divideTelegram(tel):
+#mcrc/scrc: crc results as published by ebusd-light along with the telegram. None: check here.
+def divideTelegram(tel, mcrc=None, scrc=None):
     tel_m = None
     tel_s = None
     pay_m = None
@@ -124,9 +116,9 @@ def divideTelegram(tel):
         req_len = 5+NN_m[0]+1           #request-len
         if len(tel) >= req_len:
             tel_m   = tel[0:req_len]    #request
-            CRC_m   = tel_m[-1:]         
-            CRC_calc= ebusCRC(tel_m[0:-1])
-            if CRC_m == CRC_calc:
+            if mcrc is None:
+                mcrc = tel_m[-1:] == ebusCRC(tel_m[0:-1])
+            if mcrc:
                 if isBroadcast(ZZ):
                     tel_valid = True
                 else:
@@ -142,9 +134,9 @@ def divideTelegram(tel):
                                     res_len = 2+NN_s[0]+1
                                     if len(tel_s) >= res_len:
                                         tel_s = tel_s[0:res_len]
-                                        CRC_s    = tel_s[-1:]
-                                        CRC_calc = ebusCRC(tel_s[0:-1])
-                                        if CRC_s == CRC_calc:
+                                        if scrc is None:
+                                            scrc = tel_s[-1:] == ebusCRC(tel_s[0:-1])
+                                        if scrc:
                                             del tel_s[0] #remove ACK - as master's ACK, SYN etc are also not returned.
                                             tel_valid = True;
                                             #a potential master ack and syn are not evaluated as not required for data extraction.
@@ -182,13 +174,13 @@ def u16_2h(i):
     res=int(i).to_bytes(2,'little').hex(' ')
     return res
     
-def decodeTelegram(telegram):
+def decodeTelegram(telegram, mcrc=None, scrc=None):
     #print(telegram);
     tel = bytearray.fromhex(telegram)
     #tel = bytes(tel)
     decoded = {}
     
-    tel_valid, tel_m, tel_s, pay_m, pay_s = divideTelegram(tel)
+    tel_valid, tel_m, tel_s, pay_m, pay_s = divideTelegram(tel, mcrc, scrc)
     
     if tel_valid and len(pay_m)>=1:
         ADDR = tel_m[0:2]               # QQ ZZ 
@@ -661,7 +653,7 @@ if __name__ == '__main__':
             pass
         if data:
             if "telegram" in data:
-                decoded = decodeTelegram(data["telegram"])
+                decoded = decodeTelegram(data["telegram"], data.get("mcrc"), data.get("scrc"))
                 if decoded:
                     publishRxd(decoded)
             if "CMD" in data:
@@ -0,0 +1,115 @@
+//Copyright (C) 2025 makischu
+
+//ebusB5decoder_bench: decode time per telegram, register index vs. scanning the register table.
+// build: see CMakeLists.txt
+// run:   ebusB5decoder_bench [iterations]
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ebusB5decoder.h"
+
+// decodable ones (README, test menu, power limit) and a few that are on the bus but not decoded.
+static const char* corpusKnown[] = {
+    "10 08 B5 11 01 01 89 00 09 3D 3E 00 80 FF FF 00 00 FF C2 00 AA",
+    "10 76 B5 11 01 01 16 00 09 FF FF 20 0A FF FF 00 00 FF 15 00 AA",
+    "10 08 B5 10 09 00 00 40 FF FF FF 06 00 00 BC 00 01 01 9A 00 AA",
+    "03 76 B5 12 06 13 00 0C 4B 03 00 B6 00 02 00 FF D3 00 AA",
+    "10 08 B5 11 01 00 88 00 09 EE 01 0C 00 00 08 00 00 00 D1 00 AA",
+    "71 08 B5 14 05 05 40 03 FF FF 6D 00 04 40 00 32 00 2F 00 AA",
+    "71 08 B5 1A 04 05 01 32 3C 24 00 0A 01 08 0E 4B 03 00 00 00 00 00 86 00 AA",
+};
+static const char* corpusUnknown[] = {
+    "10 FE B5 16 03 01 70 10 52 AA",
+    "10 08 B5 04 01 00 29 00 0A 03 01 02 03 04 05 06 07 08 09 1C 00 AA",
+    "71 08 B5 13 03 05 00 00 6E 00 02 01 00 04 00 AA",
+    "10 26 B5 1D 02 00 00 F1 00 01 00 58 00 AA",
+    "03 76 B5 12 06 14 00 0C 4B 03 00 53 00 02 00 FF D3 00 AA",
+};
+
+struct Tel {
+    uint8_t data[64];
+    int     len;
+};
+
+static int parse(const char** hex, int n, Tel* out) {
+    for (int i=0; i<n; i++) {
+        const char* p = hex[i];
+        char* end;
+        out[i].len = 0;
+        while (*p) {
+            out[i].data[out[i].len++] = strtoul(p, &end, 16);
+            p = end;
+        }
+    }
+    return n;
+}
+
+typedef bool DecodeFn(const uint8_t* tel, int len, char* jsonstr, int maxLen, int* pLen);
+
+// as in ebusd-light without a split frame at hand
+static bool decodeIndex(const uint8_t* tel, int len, char* jsonstr, int maxLen, int* pLen) {
+    return decodeTelegramB5(tel, len, jsonstr, maxLen, pLen);
+}
+
+static double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static double bench(DecodeFn* decode, const Tel* tels, int n, int iterations, int* decoded) {
+    char json[256];
+    int len;
+    *decoded = 0;
+    double start = nowNs();
+    for (int it=0; it<iterations; it++) {
+        for (int i=0; i<n; i++) {
+            *decoded += decode(tels[i].data, tels[i].len, json, sizeof(json), &len);
+        }
+    }
+    return (nowNs()-start) / ((double)iterations*n);
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    const int nKnown   = sizeof(corpusKnown)/sizeof(corpusKnown[0]);
+    const int nUnknown = sizeof(corpusUnknown)/sizeof(corpusUnknown[0]);
+    Tel known[nKnown], unknown[nUnknown], mixed[nKnown+nUnknown];
+    parse(corpusKnown, nKnown, known);
+    parse(corpusUnknown, nUnknown, unknown);
+    memcpy(mixed, known, sizeof(known));
+    memcpy(mixed+nKnown, unknown, sizeof(unknown));
+
+    struct { const char* name; const Tel* tels; int n; } sets[] = {
+        { "known",   known,   nKnown },
+        { "unknown", unknown, nUnknown },
+        { "mixed",   mixed,   nKnown+nUnknown },
+    };
+    printf("%-8s %12s %12s %8s\n", "corpus", "index[ns]", "scan[ns]", "decoded");
+    for (auto& set : sets) {
+        int decodedIndex, decodedScan;
+        double nsIndex = bench(decodeIndex,          set.tels, set.n, iterations, &decodedIndex);
+        double nsScan  = bench(decodeTelegramB5Scan, set.tels, set.n, iterations, &decodedScan);
+        if (decodedIndex != decodedScan) {
+            printf("mismatch: index decoded %d, scan %d\n", decodedIndex, decodedScan);
+            return 1;
+        }
+        printf("%-8s %12.1f %12.1f %8d\n", set.name, nsIndex, nsScan, decodedIndex/iterations);
+    }
+    return 0;
+}
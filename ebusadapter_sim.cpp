@@ -0,0 +1,447 @@
+//Copyright (C) 2025 makischu
+
+//ebusadapter_sim: stands in for the ebus adapter (enhanced protocol over tcp) and a bus with some traffic on it.
+// so that ebusd-light can be tested and stressed without hardware, e.g. ebusd-light -a 127.0.0.1:9999
+// simulates: init handshake, arbitration won/lost, echo of sent bytes, slave ACK/NAK and response after
+// a latency, background B5 traffic at a given bus load, auto-SYN. one client at a time.
+// buffers SEND symbols, so ebusd-light can be started with -P (see sendPipelined in ebusd-light). -1 behaves like
+// firmware 20250615 instead: it takes one symbol while another one is on the bus (e.g. ACK then SYN), any further
+// one gets lost.
+// build: see CMakeLists.txt
+// run:   ebusadapter_sim [-p port] [-l load%] [-L slave latency ms] [-A arbitration loss%] [-N nak%]
+//                        [-x speed factor] [-R network round trip ms] [-d duration s] [-s seed] [-1] [-v]
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "ebusll.h"
+#include "hexcodec.h"
+
+#define SIM_PORT          9999
+#define BUS_BYTE_NS       4166667LL  // 2400 baud, 10 bit per byte
+#define AUTOSYN_BYTES     10         // idle bus: a SYN every ~40 ms
+#define SYN               0xAA
+
+// enhanced protocol, see processEnhBusChar
+#define ENH_INIT          0x0
+#define ENH_SEND          0x1        // client -> adapter
+#define ENH_RECEIVED      0x1        // adapter -> client
+#define ENH_START         0x2
+#define ENH_STARTED       0x2
+#define ENH_INFO          0x3
+#define ENH_FAILED        0xA
+
+#define SIM_VERSION       0x01
+
+struct SimOptions {
+    int      port;
+    int      load;       // [%] background traffic
+    int      latencyMs;  // slave ACK after the request
+    int      rttMs;      // network between client and adapter, applied to what the client sends
+    int      arbLoss;    // [%] arbitrations lost against another master, besides contention with the background
+    int      nak;        // [%] requests answered with NAK
+    double   speed;      // >1: faster than the real bus
+    int      duration;   // [s], 0: until SIGINT
+    unsigned seed;
+    bool     single;     // one symbol at a time, like firmware 20250615
+    bool     verbose;
+};
+SimOptions opt = { SIM_PORT, 30, 10, 0, 0, 0, 1.0, 0, 1, false, false };
+volatile bool run = true;
+
+typedef int64_t mono_t;
+mono_t monoNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (mono_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+// recorded on the bus (see README), injected as background traffic.
+static const char* background[] = {
+    "10 08 B5 11 01 01 89 00 09 3D 3E 00 80 FF FF 00 00 FF C2 00",
+    "10 76 B5 11 01 01 16 00 09 FF FF 20 0A FF FF 00 00 FF 15 00",
+    "10 08 B5 10 09 00 00 40 FF FF FF 06 00 00 BC 00 01 01 9A 00",
+    "03 76 B5 12 06 13 00 0C 4B 03 00 B6 00 02 00 FF D3 00",
+    "10 08 B5 11 01 00 88 00 09 EE 01 0C 00 00 08 00 00 00 D1 00",
+    "10 FE B5 16 03 01 70 10 52",
+};
+#define NBACKGROUND ((int)(sizeof(background)/sizeof(background[0])))
+
+// what goes on the bus next, one byte per byte time. due: not before (e.g. slave latency).
+struct BusByte {
+    uint8_t value;
+    uint8_t cmd;
+    mono_t  due;
+    bool    client;  // sent by the client, not yet echoed
+};
+
+// the client's transaction, from its START to its SYN.
+enum TxnState { TXN_IDLE, TXN_ARBITRATION, TXN_REQUEST, TXN_RESPONSE };
+struct Sim {
+    int      client;
+    bool     initialized;
+    mono_t   byteNs;
+    mono_t   nextTick;
+    int      idleBytes;
+    mono_t   nextBackground;
+    std::deque<BusByte> bus;
+    uint8_t  enh1;           // first of a two byte sequence from the client, 0 if none
+    std::deque<BusByte> inbox; // from the client, not yet arrived (see -R)
+    TxnState txn;
+    uint8_t  txnQQ;
+    mono_t   txnStart;
+    Telegram request;        // escapes resolved
+    bool     escaped;
+    int      clientPending;  // client symbols in bus, see -1
+    // statistics
+    long     ticks, busyTicks, backgroundTelegrams, arbWon, arbLost, answered, naks, symbolsLost;
+    std::vector<double> latencyMs;
+};
+Sim sim;
+
+unsigned rnd(unsigned range) {
+    return range ? (unsigned)rand_r(&opt.seed) % range : 0;
+}
+
+// the client is gone (or its socket broken): back to accept, the next one starts afresh.
+void clientClose(const char* why) {
+    printf("client %s\n", why);
+    close(sim.client);
+    sim.client = -1;
+}
+
+void clientSend(uint8_t cmd, uint8_t value) {
+    uint8_t buf[2];
+    int n = 0;
+    if (sim.client < 0) {
+        return;
+    }
+    if (cmd == ENH_RECEIVED && value < 0x80) {
+        buf[n++] = value;   // short form
+    } else {
+        buf[n++] = 0xC0 | (cmd<<2) | (value>>6);
+        buf[n++] = 0x80 | (value&0x3F);
+    }
+    if (write(sim.client, buf, n) != n && errno != EAGAIN) {
+        printf("write to client: %s\n", strerror(errno));
+        clientClose("dropped");
+    }
+}
+
+// telegram (escapes resolved, without SYN) onto the bus, escaped as on the wire. first byte may be special (arbitration).
+void busPut(const uint8_t* tel, int len, uint8_t firstCmd, mono_t due) {
+    Telegram in, wire;
+    memcpy(in.data, tel, len);
+    in.len = len;
+    telegramExpand(&in, &wire);
+    for (int i=0; i<wire.len; i++) {
+        sim.bus.push_back({ wire.data[i], i == 0 ? firstCmd : (uint8_t)ENH_RECEIVED, due, false });
+    }
+}
+
+void backgroundPut(int i, uint8_t firstCmd) {
+    uint8_t tel[64];
+    int len = hexstr2bytes(background[i], strlen(background[i]), tel, sizeof(tel));
+    busPut(tel, len, firstCmd, 0);
+    sim.bus.push_back({ SYN, ENH_RECEIVED, 0, false });
+    sim.backgroundTelegrams++;
+    // gap so that the background takes opt.load percent of the bus, with some jitter
+    mono_t busy = (len+1) * sim.byteNs;
+    mono_t gap  = opt.load > 0 ? busy * (100-opt.load) / opt.load : 0;
+    sim.nextBackground = monoNow() + busy + gap/2 + rnd(gap+1);
+}
+
+// simulated slave, after the client's request: ACK, NN data CRC. the data is derived from the request.
+// the latency counts from when the request is through, i.e. after what is still queued for the bus.
+void slaveAnswer() {
+    uint8_t ZZ = sim.request.data[1];
+    mono_t due = monoNow() + (mono_t)sim.bus.size()*sim.byteNs + (mono_t)(opt.latencyMs*1000000LL/opt.speed);
+    if (ZZ == 0xFE) {
+        return;                         // broadcast, the client sends SYN
+    }
+    if (rnd(100) < (unsigned)opt.nak) {
+        uint8_t nak = 0xFF;
+        busPut(&nak, 1, ENH_RECEIVED, due);
+        sim.naks++;
+        return;
+    }
+    uint8_t resp[20];
+    int len = 0;
+    resp[len++] = 0x00;                 // ACK
+    if (!isMasterAddr(ZZ)) {
+        int NN = 1 + sim.request.data[4] % 10;
+        resp[len++] = NN;
+        for (int i=0; i<NN; i++) {
+            resp[len++] = sim.request.data[(5+i) % sim.request.len] + i;
+        }
+        resp[len] = calcEbusCrc(resp+1, len-1);
+        len++;
+    }
+    busPut(resp, len, ENH_RECEIVED, due);
+    sim.answered++;
+}
+
+// a byte the client put on the bus, e.g. its request. it is echoed when it was on the bus.
+void clientByte(uint8_t value) {
+    if (opt.single && sim.clientPending > 1) {
+        sim.symbolsLost++;              // the adapter is still busy with the previous one
+        return;
+    }
+    sim.bus.push_back({ value, ENH_RECEIVED, 0, true });
+    sim.clientPending++;
+    if (sim.txn == TXN_REQUEST) {
+        if (value == 0xA9) {
+            sim.escaped = true;
+            return;
+        }
+        if (sim.escaped) {
+            value = value == 0x01 ? 0xAA : 0xA9;
+            sim.escaped = false;
+        }
+        sim.request.data[sim.request.len++] = value;
+        if (sim.request.len >= 6 && sim.request.len == 6 + sim.request.data[4]) {
+            sim.txn = TXN_RESPONSE;
+            slaveAnswer();
+        }
+    } else if (sim.txn != TXN_IDLE && sim.txn != TXN_ARBITRATION && value == SYN) {
+        sim.latencyMs.push_back((monoNow() - sim.txnStart) / 1e6);
+        sim.txn = TXN_IDLE;
+    }
+}
+
+void clientCommand(uint8_t cmd, uint8_t value) {
+    switch (cmd) {
+        case ENH_INIT:
+            clientSend(ENH_INIT, 0x01);  // RESETTED, ebusd-light waits for C0 81
+            sim.initialized = true;
+            sim.txn = TXN_IDLE;
+            sim.nextTick = sim.nextBackground = monoNow();
+            break;
+        case ENH_SEND:
+            clientByte(value);
+            break;
+        case ENH_INFO:
+            // length, then the data. only the version is known here.
+            if (value == 0x00) {
+                clientSend(ENH_INFO, 2);
+                clientSend(ENH_INFO, SIM_VERSION);
+                clientSend(ENH_INFO, 0x00); // features
+            } else {
+                clientSend(ENH_INFO, 0);
+            }
+            break;
+        case ENH_START:
+            sim.txn      = TXN_ARBITRATION;
+            sim.txnQQ    = value;
+            sim.txnStart = monoNow();
+            break;
+        default:
+            if (opt.verbose) printf("ignoring command %d\n", cmd);
+            break;
+    }
+}
+
+void clientReceive() {
+    uint8_t buf[256];
+    int n = read(sim.client, buf, sizeof(buf));
+    if (n <= 0) {
+        if (n == 0 || errno != EAGAIN) {
+            clientClose("disconnected");
+        }
+        return;
+    }
+    mono_t due = monoNow() + opt.rttMs*1000000LL;
+    for (int i=0; i<n; i++) {
+        uint8_t b = buf[i];
+        if ((b & 0xC0) == 0xC0) {
+            sim.enh1 = b;
+        } else if ((b & 0xC0) == 0x80 && sim.enh1) {
+            sim.inbox.push_back({ (uint8_t)(((sim.enh1 & 0x3) << 6) | (b & 0x3F)), (uint8_t)((sim.enh1 >> 2) & 0xF), due, false });
+            sim.enh1 = 0;
+        } else if (b < 0x80) {
+            sim.inbox.push_back({ b, ENH_SEND, due, false });
+        }
+    }
+}
+
+// the bus does one byte per byte time: queued bytes, arbitration at a free bus, background traffic or auto-SYN.
+void busTick(mono_t now) {
+    sim.ticks++;
+    if (!sim.bus.empty()) {
+        if (sim.bus.front().due > now) {
+            return;                     // slave still thinking, the bus is silent
+        }
+        BusByte b = sim.bus.front();
+        sim.bus.pop_front();
+        if (b.client) {
+            sim.clientPending--;
+        }
+        clientSend(b.cmd, b.value);
+        sim.busyTicks++;
+        sim.idleBytes = 0;
+        return;
+    }
+    bool backgroundDue = opt.load > 0 && now >= sim.nextBackground;
+    if (sim.txn == TXN_ARBITRATION) {
+        // lower address wins. the background masters are 10 and 03, other masters show up as lost arbitrations.
+        int i = rnd(NBACKGROUND);
+        uint8_t other = background[i][0] == '0' ? 0x03 : 0x10;
+        if ((backgroundDue && other < sim.txnQQ) || rnd(100) < (unsigned)opt.arbLoss) {
+            backgroundPut(i, ENH_FAILED);
+            sim.txn = TXN_IDLE;
+            sim.arbLost++;
+        } else {
+            sim.bus.push_back({ sim.txnQQ, ENH_STARTED, 0, false });
+            sim.request.data[0] = sim.txnQQ;
+            sim.request.len = 1;
+            sim.escaped = false;
+            sim.txn = TXN_REQUEST;
+            sim.arbWon++;
+        }
+        busTick(now);
+        return;
+    }
+    if (sim.txn != TXN_IDLE) {
+        return;                         // client's turn
+    }
+    if (backgroundDue) {
+        backgroundPut(rnd(NBACKGROUND), ENH_RECEIVED);
+        busTick(now);
+        return;
+    }
+    if (++sim.idleBytes >= AUTOSYN_BYTES) {
+        clientSend(ENH_RECEIVED, SYN);
+        sim.idleBytes = 0;
+    }
+}
+
+void statistics() {
+    std::sort(sim.latencyMs.begin(), sim.latencyMs.end());
+    size_t n = sim.latencyMs.size();
+    printf("statistics: bus load %.1f%% (%ld of %ld byte times), %ld background telegrams\n",
+        100.0*sim.busyTicks/std::max(1L, sim.ticks), sim.busyTicks, sim.ticks, sim.backgroundTelegrams);
+    printf("statistics: arbitration %ld won, %ld lost, %ld answered, %ld NAKs\n", sim.arbWon, sim.arbLost, sim.answered, sim.naks);
+    if (opt.single) {
+        printf("statistics: %ld symbols lost, sent while the adapter was busy\n", sim.symbolsLost);
+    }
+    if (n) {
+        printf("statistics: %zu requests START..SYN [ms] p50 %.1f p90 %.1f p99 %.1f max %.1f\n", n,
+            sim.latencyMs[n/2], sim.latencyMs[n*9/10], sim.latencyMs[n*99/100], sim.latencyMs[n-1]);
+    }
+}
+
+void sig_handler(int /*signo*/) {
+    run = false;
+}
+
+int main(int argc, char* argv[]) {
+    int o;
+    while ((o = getopt(argc, argv, "p:l:L:R:A:N:x:d:s:1v")) != -1) {
+        switch (o) {
+            case 'p': opt.port      = atoi(optarg); break;
+            case 'l': opt.load      = atoi(optarg); break;
+            case 'L': opt.latencyMs = atoi(optarg); break;
+            case 'R': opt.rttMs     = atoi(optarg); break;
+            case 'A': opt.arbLoss   = atoi(optarg); break;
+            case 'N': opt.nak       = atoi(optarg); break;
+            case 'x': opt.speed     = atof(optarg); break;
+            case 'd': opt.duration  = atoi(optarg); break;
+            case 's': opt.seed      = atoi(optarg); break;
+            case '1': opt.single    = true;         break;
+            case 'v': opt.verbose   = true;         break;
+            default:
+                printf("usage: %s [-p port] [-l load%%] [-L latency ms] [-R rtt ms] [-A arbitration loss%%] [-N nak%%] [-x speed] [-d duration s] [-s seed] [-1] [-v]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (opt.load < 0 || opt.load > 95 || opt.speed <= 0) {
+        printf("load 0..95 and a positive speed please\n");
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, sig_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    int srv = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(opt.port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (srv < 0 || bind(srv, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(srv, 1) != 0) {
+        printf("could not listen on port %d\n", opt.port);
+        return EXIT_FAILURE;
+    }
+    printf("listening on port %d, load %d%%, latency %d ms, speed x%.1f\n", opt.port, opt.load, opt.latencyMs, opt.speed);
+
+    sim.client = -1;
+    sim.byteNs = (mono_t)(BUS_BYTE_NS / opt.speed);
+    mono_t end = opt.duration ? monoNow() + opt.duration*1000000000LL : 0;
+    while (run && (!end || monoNow() < end)) {
+        mono_t now = monoNow();
+        struct pollfd pfd;
+        pfd.fd     = sim.client >= 0 ? sim.client : srv;
+        pfd.events = POLLIN;
+        mono_t wait = sim.client >= 0 && sim.initialized ? std::max<mono_t>(0, sim.nextTick - now) : 100000000LL;
+        if (!sim.inbox.empty()) {
+            wait = std::max<mono_t>(0, std::min(wait, sim.inbox.front().due - now));
+        }
+        struct timespec timeout = { (time_t)(wait / 1000000000LL), (long)(wait % 1000000000LL) };
+        if (ppoll(&pfd, 1, &timeout, 0) > 0) {
+            if (sim.client < 0) {
+                sim.client = accept(srv, 0, 0);
+                setsockopt(sim.client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                sim.initialized = false;
+                sim.bus.clear();
+                sim.inbox.clear();
+                sim.clientPending = 0;
+                sim.enh1 = 0;
+                sim.txn = TXN_IDLE;
+                printf("client connected\n");
+            } else {
+                clientReceive();
+            }
+        }
+        now = monoNow();
+        while (!sim.inbox.empty() && sim.inbox.front().due <= now) {
+            clientCommand(sim.inbox.front().cmd, sim.inbox.front().value);
+            sim.inbox.pop_front();
+        }
+        // catch up with the bus clock, in case we were late
+        while (sim.client >= 0 && sim.initialized && now >= sim.nextTick) {
+            busTick(now);
+            sim.nextTick += sim.byteNs;
+        }
+    }
+    if (sim.client >= 0) close(sim.client);
+    close(srv);
+    statistics();
+    return 0;
+}
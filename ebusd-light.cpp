@@ -22,13 +22,23 @@
 // uses: paho mqtt https://github.com/eclipse/paho.mqtt.c
 // parts copied from https://github.com/eclipse/paho.mqtt.c/blob/master/src/samples/MQTTClient_subscribe.c
 
-// build: g++ ...c -lpaho-mqtt3c  
+// build: cmake -S . -B build && cmake --build build   (see CMakeLists.txt)
 
 // requires an ebus adapter e.g. https://adapter.ebusd.eu/v5-c6/ 
 // requires an mqtt broker[+client], e.g. mosquitto_sub -h localhost -p 1883 -t ebus/ll/rx   
-// format:                                {"telegram":"10 08 B5 10 09 00 00 3D FF FF FF 06 00 00 26 00 01 01 9A 00 AA"}
+// format:                                {"telegram":"10 08 B5 10 09 00 00 3D FF FF FF 06 00 00 26 00 01 01 9A 00 AA","mcrc":true,"scrc":true}
 // tx test example mosquitto_pub -h localhost -t "ebus/ll/tx" -m '{"telegram":"31 08 B5 14 05 05 40 03 FF FF AA"}'
 
+// usage: ebusd-light [-a [name=]ip[:port]]... [-b broker] [-c capturefile] [-d archivedir] [-m metricsport] [-p pollfile]
+//                    [-s storedir] [-t tracefile] [-P]
+//                    normal operation, optionally logging all bytes from the adapter, archiving all telegrams (see
+//                    archive.h), serving metrics to prometheus (see metricsServe), polling registers (see Polling),
+//                    keeping decoded values (see Time series), dumping the trace on SIGUSR1 (see Tracing)
+//        ebusd-light [-a name=ip] -r [-f] [-v] capturefile...             replay a log without adapter and mqtt, see replay()
+// -a/-b override ADAPTER_ADDRESS:ADAPTER_PORT and ADDRESS, e.g. -a 127.0.0.1 for ebusadapter_sim.
+// -a may be given several times, one per adapter (bus), each with a name for its topics. see Bus.
+// -P sends requests pipelined, for adapters that buffer SEND symbols (see sendPipelined).
+
 
 #include <stdio.h> //printf
 #include <fcntl.h>
@@ -53,10 +63,20 @@
 #include <sys/socket.h>  // fpr socket(), connect()
 #include <netinet/in.h>  // for sockaddr_in
 #include <arpa/inet.h>   // for inet_addr()
-#include <thread>        // for yield
 #include <netinet/tcp.h>  // Defines TCP_NODELAY
+#include <sys/epoll.h>    // event loop, see eventWait
+#include <sys/timerfd.h>
+#include <atomic>         // publish queue
+#include <thread>         // publisher
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>     // capture log
+#include <sys/stat.h>
+#include <stdarg.h>
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
 volatile bool run = true;
 
@@ -67,12 +87,28 @@ void sig_handler(int signo)
   run=false;
 }
 
+#include "ebusll.h"
+#include "ebusB5decoder.h"
+#include "hexcodec.h"
+#include "timeseries.h"
+#include "archive.h"
 #include "MQTTClient.h" //see above for installtion (clone local, make, sudo make install)
 
 #define ADDRESS     "tcp://192.168.2.43:1883"  //"tcp://localhost:1883"
 #define CLIENTID    "ebusd-light"
 #define TOPIC_TX    "ebus/ll/tx"            // mqtt-messages to this topic are received and valid requests are sent on the ebus. format:  {"telegram":"AB CD ..."} 
-#define TOPIC_RXD   "ebus/ll/rx"            // valid received ebus telegrams are sent to this mqtt topic. example: {"telegram":"10 FE B5 16 03 01 70 10 52 AA"}
+#define TOPIC_RXD   "ebus/ll/rx"            // valid received ebus telegrams are sent to this mqtt topic. example: {"telegram":"10 FE B5 16 03 01 70 10 52 AA","mcrc":true}
+#define TOPIC_RXB   "ebus/ll/rxb"           // same as TOPIC_RXD, binary. see struct2bin for the format
+#define PUBLISH_RX_JSON   true              // rx telegrams as json on TOPIC_RXD
+#define PUBLISH_RX_BINARY true              // rx telegrams binary on TOPIC_RXB
+#define TOPIC_RXF   "ebus/ll/rxf"           // same as TOPIC_RXD, split into its parts. see frame2json for the format
+#define PUBLISH_RX_FRAMES true              // rx telegrams split on TOPIC_RXF
+#define TOPIC_DECODED "ebus/ll/rxd"         // known registers, decoded by ebusB5decoder. example: {"ForwTempL[C]": 30.5, "RetnTempL[C]": 31.0}
+#define DECODE_B5   true                    // false: leave decoding to ebusB5decoder.py
+#define TOPIC_STATS "ebus/ll/stats"         // counters and gauges, see busStatsJson
+#define TOPIC_LATENCY "ebus/ll/stats/latency" // latencies and the mqtt counters, see busLatencyJson
+#define STATS_INTERVAL_S  60                // [s] how often TOPIC_STATS is published
+#define METRICS_PORT      0                 // same in prometheus text format on 127.0.0.1:port, 0: off. -m port
 #define QOS         0
 #define TIMEOUT     2000L
 #define USERTOKEN   "notused"
@@ -81,16 +117,7 @@ void sig_handler(int signo)
 #define ADAPTER_PORT    9999
 
 
-// "the sequence of individual characters that a participant must use, when accessing the bus"
-// may or may not be valid, may contain slave response too, may end with SYN or not, may be expanded or not, simple multi-purpose-struct.
-// for RX: it is assumed that a telegram consists of all bytes between two SYN symbols. at least these are our candidates.
-struct Telegram {
-  uint8_t data[256]; //bytes (the actual data)
-  int     len;       //nr of bytes
-};
-
-
-//program is implemented as a state machine
+//program is implemented as a state machine: mqtt in main, the adapter part (INIT2..INIT4, DEIN4..DEIN2) per bus in busStep.
 enum State {
 START=0,
 INIT1_MQTT, // MQTT connect
@@ -105,20 +132,309 @@ DEIN2_ATCP, // TCP  close
 DEIN1_MQTT, // MQTT disconnect
 DEIN0_PAUS, // wait before retry.
 };
+#define ADAPTER_CONNECT_TIMEOUT_MS 5000  // INIT2_ATCP: tcp connect to the adapter
+#define ADAPTER_INIT_TIMEOUT_MS 2000  // INIT3_AINI: adapter has to answer the init sequence
+#define RETRY_PAUSE_MS         10000  // DEIN0_PAUS: wait before retry
+
+
+//////////////////////////
+// Timers
+
+// monotonic clock, in ns. not affected by changes of the system time.
+typedef int64_t mono_t;
+#define MSEC(ms) ((mono_t)(ms)*1000000LL)
+mono_t monoNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (mono_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+// hashed timer wheel. a timer is kept in the slot of its deadline, the ones further away
+// than one revolution just stay there for some more rounds. 
+// timerWheelAdvance moves expired timers out and marks them fired, the state machines poll timerExpired,
+// and timerWheelNext tells the event loop when to wake up next. no ticking in between.
+#define TIMER_WHEEL_SLOTS      256 // must be a power of 2
+#define TIMER_WHEEL_TICK_SHIFT  20 // slot width 2^20 ns ~ 1 ms
+struct Timer {
+    mono_t deadline;
+    bool   armed;  // waiting in the wheel
+    bool   fired;  // deadline has passed
+    int    slot;
+    Timer* next;
+    Timer* prev;
+};
+Timer* timerWheel[TIMER_WHEEL_SLOTS];
+int64_t timerWheelTick = 0; // last tick processed
+
+void timerStop(Timer* t) {
+    if (t->armed) {
+        if (t->prev) t->prev->next = t->next;
+        else         timerWheel[t->slot] = t->next;
+        if (t->next) t->next->prev = t->prev;
+        t->armed = false;
+    }
+    t->fired = false;
+}
+
+void timerStart(Timer* t, mono_t delay) {
+    int64_t tick;
+    timerStop(t);
+    t->deadline = monoNow() + delay;
+    tick = MAX(t->deadline>>TIMER_WHEEL_TICK_SHIFT, timerWheelTick); // overdue ones go to the current slot
+    t->slot  = tick & (TIMER_WHEEL_SLOTS-1);
+    t->prev  = 0;
+    t->next  = timerWheel[t->slot];
+    if (t->next) t->next->prev = t;
+    timerWheel[t->slot] = t;
+    t->armed = true;
+}
+
+bool timerExpired(Timer* t) {
+    return t->fired;
+}
+
+void timerWheelAdvance(mono_t now) {
+    int64_t nowTick = now>>TIMER_WHEEL_TICK_SHIFT;
+    int64_t tick = timerWheelTick;
+    Timer* t; Timer* next;
+    if (nowTick - tick >= TIMER_WHEEL_SLOTS) {
+        tick = nowTick - TIMER_WHEEL_SLOTS + 1; // long sleep. looking at every slot once is enough.
+    }
+    for (; tick <= nowTick; tick++) {
+        for (t = timerWheel[tick & (TIMER_WHEEL_SLOTS-1)]; t; t = next) {
+            next = t->next;
+            if (t->deadline <= now) {
+                timerStop(t);
+                t->fired = true;
+            }
+        }
+    }
+    timerWheelTick = nowTick;
+}
+
+// earliest deadline of all armed timers, or -1 if there is none.
+mono_t timerWheelNext() {
+    mono_t next = -1;
+    Timer* t;
+    // usually there is one within the next revolution, so the first slot with one is the answer.
+    for (int64_t tick = timerWheelTick; tick < timerWheelTick + TIMER_WHEEL_SLOTS; tick++) {
+        for (t = timerWheel[tick & (TIMER_WHEEL_SLOTS-1)]; t; t = t->next) {
+            if ((t->deadline>>TIMER_WHEEL_TICK_SHIFT) <= tick && (next < 0 || t->deadline < next)) {
+                next = t->deadline;
+            }
+        }
+        if (next >= 0) {
+            return next;
+        }
+    }
+    for (int i=0; i<TIMER_WHEEL_SLOTS; i++) {
+        for (t = timerWheel[i]; t; t = t->next) {
+            if (next < 0 || t->deadline < next) {
+                next = t->deadline;
+            }
+        }
+    }
+    return next;
+}
+
+
+//////////////////////////
+// Metrics
+
+// latency histogram, log-linear like HdrHistogram with 3 significant bits: every power of 2 is split into HIST_SUB
+// buckets, so a value is known within 12.5% whatever its magnitude, in fixed memory and without allocation.
+// values in µs. the buckets (percentiles, max) cover the current stats interval, see histReset, count and sum all time.
+#define HIST_SUB_BITS 3
+#define HIST_SUB      (1<<HIST_SUB_BITS)
+#define HIST_BUCKETS  (40*HIST_SUB)  // up to 2^41 µs
+struct Histogram {
+    uint32_t bucket[HIST_BUCKETS];
+    uint32_t n;
+    int64_t  max;
+    uint64_t totalCount;
+    int64_t  totalSum;
+};
+
+int histBucket(int64_t v) {
+    if (v < HIST_SUB) {
+        return v < 0 ? 0 : (int)v;
+    }
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return MIN((shift+1)*HIST_SUB + (int)(v>>shift) - HIST_SUB, HIST_BUCKETS-1);
+}
+
+// lowest value that goes into bucket i
+int64_t histBucketValue(int i) {
+    if (i < HIST_SUB) {
+        return i;
+    }
+    return (int64_t)(HIST_SUB + i%HIST_SUB) << (i/HIST_SUB - 1);
+}
+
+void histRecord(Histogram* h, int64_t us) {
+    h->bucket[histBucket(us)]++;
+    h->n++;
+    h->max = MAX(h->max, us);
+    h->totalCount++;
+    h->totalSum += us;
+}
+
+// p percent of the values are below. the middle of the bucket, but not more than the max.
+int64_t histPercentile(Histogram* h, double p) {
+    uint64_t rank = MAX(1, (uint64_t)ceil(h->n * p / 100.0)), seen = 0;
+    if (h->n == 0) {
+        return 0;
+    }
+    for (int i=0; i<HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            return MIN((histBucketValue(i) + histBucketValue(i+1)) / 2, h->max);
+        }
+    }
+    return h->max;
+}
+
+void histReset(Histogram* h) {
+    memset(h->bucket, 0, sizeof(h->bucket));
+    h->n   = 0;
+    h->max = 0;
+}
+
+// printf to the end of buf, as far as there is room. false once it is full.
+bool bufPrintf(char* buf, int size, int* len, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || *len + n >= size) {
+        *len = size - 1;
+        return false;
+    }
+    *len += n;
+    return true;
+}
+
+// {"n":..,"p50":..,"p90":..,"p99":..,"max":..} in ms
+bool histJson(Histogram* h, char* buf, int size, int* len) {
+    return bufPrintf(buf, size, len, "{\"n\":%u,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}", h->n,
+        histPercentile(h, 50)/1e3, histPercentile(h, 90)/1e3, histPercentile(h, 99)/1e3, h->max/1e3);
+}
+
+// prometheus summary, in seconds. labels: "" or e.g. bus="hp1"
+bool histPrometheus(Histogram* h, const char* name, const char* labels, char* buf, int size, int* len) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99 };
+    bool ok = true;
+    for (double q : quantiles) {
+        ok &= bufPrintf(buf, size, len, "%s{%s%squantile=\"%g\"} %g\n", name, labels, labels[0] ? "," : "", q, histPercentile(h, q*100)/1e6);
+    }
+    const char* lb = labels[0] ? "{" : "";
+    const char* rb = labels[0] ? "}" : "";
+    ok &= bufPrintf(buf, size, len, "%s_sum%s%s%s %g\n%s_count%s%s%s %llu\n", name, lb, labels, rb, h->totalSum/1e6,
+        name, lb, labels, rb, (unsigned long long)h->totalCount);
+    return ok;
+}
+
+
+//////////////////////////
+// Tracing
+
+// flight recorder for the way of a telegram: read from the adapter, SYN (telegram complete, processBusChar calls
+// onTelegram right there), into the publish queue, publish call begin and end. always recording, an event is a few
+// stores with a timestamp that is mostly taken anyway. SIGUSR1 or a message to TOPIC_TRACE dumps it to TRACE_FILE
+// in chrome trace format (ui.perfetto.dev, chrome://tracing), see traceDump. args.id follows a telegram.
+#define TRACE           true                      // false: compiled out
+#define TRACE_RING_LEN  4096                      // events per thread, must be a power of 2
+#define TRACE_FILE      "ebusd-light-trace.json"  // -t file
+#define TOPIC_TRACE     "ebus/ll/trace"           // any message: dump
+enum TraceType { TRACE_READ, TRACE_SYN, TRACE_ENQUEUE, TRACE_PUBLISH_BEGIN, TRACE_PUBLISH_END };
+struct TraceEvent {
+    mono_t   t;
+    uint32_t id;    // telegram. TRACE_READ: nr of bytes
+    int16_t  arg;   // TRACE_SYN: telegram length, TRACE_ENQUEUE/PUBLISH_BEGIN: publish queue fill, PUBLISH_END: rc
+    uint8_t  type;
+    uint8_t  bus;
+};
+// one per thread, so that each has a single writer.
+struct TraceRing {
+    TraceEvent ev[TRACE_RING_LEN];
+    std::atomic<unsigned int> head;  // free running
+};
+TraceRing traceMain, tracePublisher;
+uint32_t  traceTelegramId = 0;
+volatile sig_atomic_t traceDumpRequested = 0;
+
+inline void trace(TraceRing* ring, uint8_t type, int bus, uint32_t id, int arg, mono_t t) {
+    if (!TRACE) {
+        return;
+    }
+    unsigned int head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent* e = &ring->ev[head & (TRACE_RING_LEN-1)];
+    e->t    = t;
+    e->id   = id;
+    e->arg  = arg;
+    e->type = type;
+    e->bus  = bus;
+    ring->head.store(head+1, std::memory_order_release);
+}
 
-char topic_to_publish[256]; 
-char message_to_publish[256]; 
-bool message_to_publish_valid = false;
+void traceSignal(int signo) {
+    traceDumpRequested = 1;
+}
 
-uint8_t chars_to_send_bus[256];
-int  chars_to_send_len;
 
+// received telegrams on their way to mqtt.
+// lock-free ring of preallocated slots, single producer (bus framer) and single consumer (mqtt publisher).
+// we don't want to throttle reading the bus just because the broker is slow,
+// so if it is full, the newest telegram is dropped (and counted).
+#define PUBLISH_QUEUE_LEN 64 // must be a power of 2
+#define PUBLISH_DROP_NOTICE_S 60 // at most one "dropping" line per interval, see publishSlotAlloc
+struct PublishSlot {
+    char   topic[64];
+    char   payload[1024];  // TOPIC_STATS takes the most, see busStatsJson
+    int    len;
+    mono_t tRx;            // the bytes came from the adapter, 0 if not from the bus. see Publisher.rxToPublish
+    uint32_t traceId;      // telegram, see Tracing
+    uint8_t  bus;          // index into buses
+};
+struct PublishQueue {
+    PublishSlot slots[PUBLISH_QUEUE_LEN];
+    std::atomic<unsigned int> head; // write index, free running, only modified by producer
+    std::atomic<unsigned int> tail; // read index, free running, only modified by consumer
+    uint64_t dropped;
+    uint64_t droppedNoticed;        // dropped as of the last notice
+    mono_t   droppedNoticeAt;
+};
+PublishQueue publishQueue;
 
-Telegram telegramToSend;
-Telegram telegramToSendExpanded;
-Telegram telegramToSendExpandedEnhanced;
-int telegramToSendExpandedEnhancedIndex;
-//Sending is implemented as a sub-state-machine of WORK.
+// producer: returns the slot to fill, or 0 if full. the slot is not visible to the consumer before publishQueuePush.
+PublishSlot* publishQueueAlloc() {
+    unsigned int head = publishQueue.head.load(std::memory_order_relaxed);
+    if (head - publishQueue.tail.load(std::memory_order_acquire) >= PUBLISH_QUEUE_LEN) {
+        return 0;
+    }
+    return &publishQueue.slots[head & (PUBLISH_QUEUE_LEN-1)];
+}
+// producer: slots that can be allocated without dropping.
+int publishQueueFree() {
+    return PUBLISH_QUEUE_LEN - (int)(publishQueue.head.load(std::memory_order_relaxed) - publishQueue.tail.load(std::memory_order_acquire));
+}
+void publishQueuePush() {
+    publishQueue.head.store(publishQueue.head.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+// consumer: returns the oldest slot, or 0 if empty. it remains valid until publishQueuePop.
+PublishSlot* publishQueueFront() {
+    unsigned int tail = publishQueue.tail.load(std::memory_order_relaxed);
+    if (tail == publishQueue.head.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    return &publishQueue.slots[tail & (PUBLISH_QUEUE_LEN-1)];
+}
+void publishQueuePop() {
+    publishQueue.tail.store(publishQueue.tail.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+
+
+//Sending is implemented as a sub-state-machine of WORK, per bus. see charsPreparedTCP.
 enum TelegramSendState {
     SENDIDLE,
     SENDSTART,
@@ -129,107 +445,1424 @@ enum TelegramSendState {
     AWAITRESPONSE,
     SENDACK,
     SENDSYN,
+    SENDWAITSYN,
     FINISHED
 };
-TelegramSendState sendState;
-
-//escape special chars
-void telegramExpand(Telegram* pIn, Telegram *pOut) {
-    int i=0;
-    uint8_t byte;
-    pOut->len = 0;
-    for(i=0;i<pIn->len;i++) {
-        byte = pIn->data[i];
-        if (pOut->len+2 >= sizeof(pOut->data)) {
-            return; //avoid overflow, just in case, not expected to happen.
-        }
-        if (byte==0xAA) {
-            pOut->data[pOut->len++] = 0xA9;
-            pOut->data[pOut->len++] = 0x01;
-        }
-        else if (byte==0xA9) {
-            pOut->data[pOut->len++] = 0xA9;
-            pOut->data[pOut->len++] = 0x00;
-        }
-        else {
-            pOut->data[pOut->len++] = byte;
-        }
-    }
-}
-// opposite of expand. decode escaped chars.
-void telegramDeflate(Telegram* pIn, Telegram *pOut) {
-    int i=0;
-    uint8_t byte,byte2;
-    pOut->len = 0;
-    for(i=0;i<pIn->len && i+1<sizeof(pIn->data);i++) {
-        byte  = pIn->data[i];
-        byte2 = pIn->data[i+1];
-        if (byte==0xA9) {
-            if(byte2==0x01) {
-                byte = 0xAA;
+
+// timing of the send states. at 2400 Bd one symbol takes ~4.2 ms, plus the tcp round trip to the adapter.
+#define SEND_ARBITRATION_TIMEOUT_MS 1000 // adapter does not answer our arbitration request at all
+#define SEND_ARBITRATION_RETRY_MS    100 // pause after a lost arbitration before the next attempt
+#define SEND_DATA_TIMEOUT_MS        1000 // whole request echoed back
+#define SEND_ACK_TIMEOUT_MS         1000 // slave ACK/NAK
+#define SEND_BROADCAST_SETTLE_MS      10 // no ACK on broadcasts, just wait a little before SYN
+#define SEND_RESPONSE_TIMEOUT_MS    1000 // complete slave response
+#define SEND_WAITSYN_TIMEOUT_MS     1000 // after an echo mismatch: rest of a pipelined request out, then SYN
+
+// what the adapter is. asked for with INFO 00 (version) right after init, answered with a length and that many
+// bytes: version, features, optionally more. only logged.
+#define ADAPTER_INFO_VERSION   0x00
+struct AdapterInfo {
+    int     expected;   // length announced by the adapter, -1 while waiting for it
+    int     got;
+    uint8_t data[16];
+};
+
+// build 20250615 takes only one symbol at a time, so SENDDATA has to wait for every echo before the next one, one tcp
+// round trip per byte. an adapter that buffers SEND symbols and puts them on the bus back to back can take the whole
+// request in one write. the protocol has no way to tell, so this is up to the user (-P), off by default.
+bool sendPipelined = false;
+
+// requests waiting to be sent, so that we do not have to reject them while sending another one.
+// bounded. the one with highest priority goes first, same priority in order of arrival.
+// requests not started before their deadline are dropped, as nobody will wait for the answer anymore.
+// identical requests pending at the same time are sent only once.
+#define TX_QUEUE_LEN          16
+#define TX_QUEUE_DEFAULT_TTL  30 // [s]
+struct TxRequest {
+    Telegram     telegram;
+    int          prio;
+    mono_t       deadline;
+    mono_t       queued;   // arrival, see BusMetrics.txLatency
+    unsigned int seq;
+    bool         used;
+};
+struct TxQueue {
+    TxRequest    req[TX_QUEUE_LEN];
+    unsigned int seq;
+    uint64_t     countFull, countStale;
+    int          countDuplicate;
+};
+
+bool txQueuePut(TxQueue* q, Telegram* pTelegram, int prio, int ttl) {
+    int i, free=-1, lowest=-1;
+    mono_t deadline = monoNow() + MSEC(ttl*1000LL);
+    for (i=0; i<TX_QUEUE_LEN; i++) {
+        if (!q->req[i].used) {
+            free = i;
+            continue;
+        }
+        if (q->req[i].telegram.len == pTelegram->len && memcmp(q->req[i].telegram.data, pTelegram->data, pTelegram->len) == 0) {
+            // already pending. keep it in line, but take over the higher prio and the later deadline.
+            q->req[i].prio     = MAX(q->req[i].prio, prio);
+            q->req[i].deadline = MAX(q->req[i].deadline, deadline);
+            q->countDuplicate++;
+            return true;
+        }
+        if (lowest < 0 || q->req[i].prio < q->req[lowest].prio || (q->req[i].prio == q->req[lowest].prio && q->req[i].seq > q->req[lowest].seq)) {
+            lowest = i;
+        }
+    }
+    if (free < 0) { // full. make room if there is something less important.
+        if (q->req[lowest].prio >= prio) {
+            q->countFull++;
+            return false;
+        }
+        printf("tx queue full, dropping a request with lower priority.\n");
+        q->countFull++;
+        free = lowest;
+    }
+    q->req[free].telegram = *pTelegram;
+    q->req[free].prio     = prio;
+    q->req[free].deadline = deadline;
+    q->req[free].queued   = monoNow();
+    q->req[free].seq      = q->seq++;
+    q->req[free].used     = true;
+    return true;
+}
+
+// returns true and the next telegram to send (and when it arrived), if there is one.
+bool txQueueGet(TxQueue* q, Telegram* pTelegram, mono_t* queued) {
+    int i, next=-1;
+    mono_t now = monoNow();
+    for (i=0; i<TX_QUEUE_LEN; i++) {
+        if (!q->req[i].used) {
+            continue;
+        }
+        if (now > q->req[i].deadline) {
+            printf("tx request expired before sending.\n");
+            q->req[i].used = false;
+            q->countStale++;
+            continue;
+        }
+        if (next < 0 || q->req[i].prio > q->req[next].prio || (q->req[i].prio == q->req[next].prio && q->req[i].seq < q->req[next].seq)) {
+            next = i;
+        }
+    }
+    if (next < 0) {
+        return false;
+    }
+    *pTelegram = q->req[next].telegram;
+    *queued    = q->req[next].queued;
+    q->req[next].used = false;
+    return true;
+}
+
+int txQueueDepth(TxQueue* q) {
+    int n = 0;
+    for (int i=0; i<TX_QUEUE_LEN; i++) {
+        n += q->req[i].used;
+    }
+    return n;
+}
+
+// called when ready to publish a message via mqtt
+// buffers [must] retain valid until next call (must not be freed by caller as with msgarrvd).
+// topic [must] be a valid [=zero-terminated] string (if return true), payload has len bytes.
+// returns true if the returned message should be sent, false if not. info: the whole slot, for metrics and tracing.
+bool msgPreparedMqtt(char** topic, char** payload, int* len, PublishSlot** info) {
+    static bool holding = false;
+    PublishSlot* slot;
+    if (holding) { // the previous one is done now.
+        publishQueuePop();
+        holding = false;
+    }
+    slot = publishQueueFront();
+    if (slot) {
+        *topic   = slot->topic;
+        *payload = slot->payload;
+        *len     = slot->len;
+        *info    = slot;
+        holding  = true;
+        return true;
+    }
+    return false;
+}
+
+// publishing runs on a thread of its own, so a slow broker does not stall bus reception.
+// there is no waitForCompletion per message: up to PUBLISH_MAX_INFLIGHT messages may be unconfirmed,
+// confirmations arrive via the delivered callback. (QoS>0 only, QoS 0 is fire and forget anyhow.)
+// failures are counted and reported, but do not stop the bus. a lost connection is handled by connlost.
+#define PUBLISH_MAX_INFLIGHT 32
+struct InflightEntry {
+    MQTTClient_deliveryToken token;
+    mono_t tSent;
+    bool   used;
+};
+struct Publisher {
+    std::thread       thread;
+    std::atomic<bool> run;
+    int               wakefd;   // eventfd: telegram queued, confirmation arrived, or stop requested.
+    std::mutex        inflightLock;
+    InflightEntry     inflight[PUBLISH_MAX_INFLIGHT];
+    int               inflightCount;
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> timedout;
+    uint64_t          reconnects;   // broker connection lost or failed, counted by the main loop
+    std::mutex        statsLock;    // the histograms are read by the main loop, see statsPublish
+    Histogram         rxToPublish;  // bytes read from the adapter .. handed over to paho
+    Histogram         publishDuration; // MQTTClient_publishMessage
+};
+Publisher publisher;
+
+void publisherWake() {
+    uint64_t one = 1;
+    write(publisher.wakefd, &one, sizeof(one));
+}
+
+void publisherTrack(MQTTClient_deliveryToken token) {
+    std::lock_guard<std::mutex> lock(publisher.inflightLock);
+    for (int i=0; i<PUBLISH_MAX_INFLIGHT; i++) {
+        if (!publisher.inflight[i].used) {
+            publisher.inflight[i].token = token;
+            publisher.inflight[i].tSent = monoNow();
+            publisher.inflight[i].used  = true;
+            publisher.inflightCount++;
+            return;
+        }
+    }
+}
+
+// unconfirmed for too long: give up on them, the broker will not answer anymore.
+void publisherExpire() {
+    std::lock_guard<std::mutex> lock(publisher.inflightLock);
+    mono_t now = monoNow();
+    for (int i=0; i<PUBLISH_MAX_INFLIGHT; i++) {
+        if (publisher.inflight[i].used && now - publisher.inflight[i].tSent > MSEC(TIMEOUT)) {
+            printf("publish not confirmed in time, token %d\n", publisher.inflight[i].token);
+            publisher.inflight[i].used = false;
+            publisher.inflightCount--;
+            publisher.timedout++;
+        }
+    }
+}
+
+int publisherInflight() {
+    std::lock_guard<std::mutex> lock(publisher.inflightLock);
+    return publisher.inflightCount;
+}
+
+// called when the broker confirmed a message (on paho's thread)
+void delivered(void *context, MQTTClient_deliveryToken token)
+{
+    std::lock_guard<std::mutex> lock(publisher.inflightLock);
+    for (int i=0; i<PUBLISH_MAX_INFLIGHT; i++) {
+        if (publisher.inflight[i].used && publisher.inflight[i].token == token) {
+            publisher.inflight[i].used = false;
+            publisher.inflightCount--;
+            publisherWake(); // there may be more waiting for a free place
+            return;
+        }
+    }
+}
+
+// TOPIC_RXB of any bus: the payload is binary, see struct2bin.
+bool topicIsBinary(const char* topic) {
+    const char* suffix = strrchr(TOPIC_RXB, '/');
+    int n = strlen(topic), m = strlen(suffix);
+    return n >= m && strcmp(topic+n-m, suffix) == 0;
+}
+
+void publisherLoop(MQTTClient client) {
+    char* topic;
+    char* payload;
+    int   len, rc;
+    PublishSlot* slot;
+    mono_t tStart, tDone;
+    uint64_t wakeups;
+    MQTTClient_message pubmsg = MQTTClient_message_initializer;
+    MQTTClient_deliveryToken token;
+    struct pollfd pfd;
+    pfd.fd     = publisher.wakefd;
+    pfd.events = POLLIN;
+    while (publisher.run) {
+        poll(&pfd, 1, 500); // timeout, to look after unconfirmed ones once in a while
+        read(publisher.wakefd, &wakeups, sizeof(wakeups));
+        publisherExpire();
+        while (publisher.run && publisherInflight() < PUBLISH_MAX_INFLIGHT && msgPreparedMqtt(&topic, &payload, &len, &slot)) {
+            if (topicIsBinary(topic)) {
+                char hex[3*sizeof(slot->payload)+1];
+                bytes2hexstr((uint8_t*)payload, len, hex, sizeof(hex));
+                printf("Publishing  %s\n", hex);
+            } else {
+                printf("Publishing  %.*s\n", len, payload);
+            }
+            pubmsg.payload = payload;
+            pubmsg.payloadlen = len;
+            pubmsg.qos = QOS;
+            pubmsg.retained = 0;
+            tStart = monoNow();
+            trace(&tracePublisher, TRACE_PUBLISH_BEGIN, slot->bus, slot->traceId, publishQueue.head.load(std::memory_order_relaxed) - publishQueue.tail.load(std::memory_order_relaxed), tStart);
+            rc = MQTTClient_publishMessage(client, topic, &pubmsg, &token);
+            tDone = monoNow();
+            trace(&tracePublisher, TRACE_PUBLISH_END, slot->bus, slot->traceId, rc, tDone);
+            if (rc != MQTTCLIENT_SUCCESS)
+            {
+                // Failed to publish message, return code -1   already seen. 
+                printf("Failed to publish message, return code %d\n", rc);
+                publisher.failed++;
+                continue;
+            }
+            publisher.published++;
+            {
+                std::lock_guard<std::mutex> lock(publisher.statsLock);
+                histRecord(&publisher.publishDuration, (tDone-tStart)/1000);
+                if (slot->tRx) {
+                    histRecord(&publisher.rxToPublish, (tDone-slot->tRx)/1000);
+                }
+            }
+            if (QOS > 0) {
+                publisherTrack(token);
+            }
+        }
+    }
+}
+
+void publisherStart(MQTTClient client) {
+    memset(publisher.inflight, 0, sizeof(publisher.inflight));
+    publisher.inflightCount = 0;
+    publisher.run = true;
+    publisher.thread = std::thread(publisherLoop, client);
+}
+
+void publisherStop() {
+    if (publisher.thread.joinable()) {
+        publisher.run = false;
+        publisherWake();
+        publisher.thread.join();
+    }
+}
+
+
+
+// delta suppression: most telegrams are repeated every few seconds with the same content.
+// per register (= master request QQ ZZ PB SB NN data) remember what was published last, and
+// publish again only if it changed or the heartbeat is due. applies to rx and to decoded values,
+// decoded values may also move within a deadband. our own requests always pass, someone waits for them.
+#define SUPPRESS_UNCHANGED    true
+#define SUPPRESS_HEARTBEAT_S  60    // [s] unchanged values are republished at least this often
+#define SUPPRESS_DEADBAND     0.0   // decoded values closer than this to the published ones count as unchanged
+#define SUPPRESS_CACHE_LEN    128   // registers, must be a power of 2
+#define SUPPRESS_KEY_LEN      24    // longer requests are not cached
+#define SUPPRESS_PROBES       4
+struct SuppressEntry {
+    uint8_t  key[SUPPRESS_KEY_LEN];
+    int      keyLen;                // 0: unused
+    uint64_t rxHash;                // whole telegram as published last
+    mono_t   rxPublished;
+    uint64_t decodedHash;           // json as published last
+    B5Values decodedValues;
+    mono_t   decodedPublished;
+    mono_t   lastSeen;
+};
+struct SuppressCache {
+    SuppressEntry entries[SUPPRESS_CACHE_LEN];
+    int           countForwarded, countSuppressed, countEvicted;
+};
+
+uint64_t hashBytes(const uint8_t* data, int len) { // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i=0; i<len; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// returns the entry for the register of the telegram, a new one if it was not seen before.
+// NULL if not cacheable (too short or too long).
+SuppressEntry* suppressLookup(SuppressCache* cache, Telegram* telegram, mono_t now) {
+    if (telegram->len < 5) {
+        return 0;
+    }
+    int keyLen = 5 + telegram->data[4];
+    if (telegram->len < keyLen || keyLen > SUPPRESS_KEY_LEN) {
+        return 0;
+    }
+    uint64_t h = hashBytes(telegram->data, keyLen);
+    SuppressEntry* victim = 0;
+    for (int i=0; i<SUPPRESS_PROBES; i++) {
+        SuppressEntry* e = &cache->entries[(h+i) & (SUPPRESS_CACHE_LEN-1)];
+        if (e->keyLen == keyLen && memcmp(e->key, telegram->data, keyLen) == 0) {
+            e->lastSeen = now;
+            return e;
+        }
+        if (!victim || e->keyLen == 0 || (victim->keyLen != 0 && e->lastSeen < victim->lastSeen)) {
+            victim = e;
+        }
+    }
+    if (victim->keyLen) {
+        cache->countEvicted++;
+    }
+    memset(victim, 0, sizeof(*victim));
+    memcpy(victim->key, telegram->data, keyLen);
+    victim->keyLen   = keyLen;
+    victim->lastSeen = now;
+    return victim;
+}
+
+bool suppressHeartbeatDue(mono_t published, mono_t now) {
+    return published == 0 || now - published >= MSEC(SUPPRESS_HEARTBEAT_S*1000LL);
+}
+
+// true if the telegram has to be published. remembers it as published then.
+bool suppressRxChanged(SuppressEntry* e, Telegram* telegram, mono_t now) {
+    uint64_t h = hashBytes(telegram->data, telegram->len);
+    if (h == e->rxHash && !suppressHeartbeatDue(e->rxPublished, now)) {
+        return false;
+    }
+    e->rxHash      = h;
+    e->rxPublished = now;
+    return true;
+}
+
+// same for decoded values. numbers may move within the deadband, strings have to be identical.
+bool suppressDecodedChanged(SuppressEntry* e, const char* json, int len, B5Values* values, mono_t now) {
+    uint64_t h = hashBytes((const uint8_t*)json, len);
+    bool changed = (h != e->decodedHash);
+    if (changed && SUPPRESS_DEADBAND > 0 && values->strings == 0 && values->count > 0 && values->count == e->decodedValues.count) {
+        changed = false;
+        for (int i=0; i<values->count; i++) {
+            if (fabs(values->value[i] - e->decodedValues.value[i]) > SUPPRESS_DEADBAND) {
+                changed = true;
+            }
+        }
+    }
+    if (!changed && !suppressHeartbeatDue(e->decodedPublished, now)) {
+        return false;
+    }
+    e->decodedHash      = h;
+    e->decodedValues    = *values;
+    e->decodedPublished = now;
+    return true;
+}
+
+//////////////////////////
+// Response cache
+
+// several consumers ask for the same register within seconds, each time a whole round trip on the bus.
+// the answers of slaves are kept, keyed by the request without QQ (ZZ PB SB NN data): from our own transactions
+// (SENDACK) and from what other masters ask for (processBusTelegramChecked). a request on ebus/ll/tx with a fresh
+// enough answer is not sent, the answer is published right away as if it came from the bus, marked "cached":true.
+// fresh enough: per register, see respCacheTtls. registers not listed there (writes, unknown ones) are neither kept
+// nor answered, they always go to the bus. any such request, ours or seen on the bus, drops what is cached for its
+// ZZ PB SB, e.g. a schedule write. "maxage":s in the request can only shorten the table, 0 forces a bus round trip.
+#define RESP_CACHE           true
+#define RESP_CACHE_LEN       128   // registers, must be a power of 2
+#define RESP_CACHE_KEY_LEN   24    // ZZ PB SB NN data. longer requests are not cached
+#define RESP_CACHE_RESP_LEN  18    // NN data CRC, NN <= 16
+#define RESP_CACHE_PROBES    4
+struct RespCacheTtl {
+    uint8_t pb, sb;
+    int     first;  // first data byte, -1: any
+    int     ttl;    // [s]
+};
+static const RespCacheTtl respCacheTtls[] = {
+    { 0xB5, 0x11,   -1,  10 },  // status blocks, temperatures etc.
+    { 0xB5, 0x1A,   -1,  10 },  // values by parameter
+    { 0xB5, 0x14,   -1,  10 },  // test menu values
+    { 0xB5, 0x55, 0xA4, 300 },  // schedule slot counts
+    { 0xB5, 0x55, 0xA5, 300 },  // schedule slots
+};
+struct RespEntry {
+    uint8_t key[RESP_CACHE_KEY_LEN];
+    int     keyLen;                  // 0: unused
+    uint8_t resp[RESP_CACHE_RESP_LEN];
+    int     respLen;
+    mono_t  stored;
+};
+struct RespCache {
+    RespEntry entries[RESP_CACHE_LEN];
+    uint64_t  countHits, countMisses;
+    int       countStored, countDropped;
+};
+
+// [s] from the table, 0 if not listed. key: ZZ PB SB NN data
+int respCacheTtl(const uint8_t* key, int keyLen) {
+    for (const RespCacheTtl& t : respCacheTtls) {
+        if (key[1] == t.pb && key[2] == t.sb && (t.first < 0 || (keyLen > 4 && key[4] == t.first))) {
+            return t.ttl;
+        }
+    }
+    return 0;
+}
+
+// the entry of the key if there is one, or else where to put it (create).
+RespEntry* respCacheFind(RespCache* cache, const uint8_t* key, int keyLen, bool create) {
+    uint64_t h = hashBytes(key, keyLen);
+    RespEntry* victim = 0;
+    for (int i=0; i<RESP_CACHE_PROBES; i++) {
+        RespEntry* e = &cache->entries[(h+i) & (RESP_CACHE_LEN-1)];
+        if (e->keyLen == keyLen && memcmp(e->key, key, keyLen) == 0) {
+            return e;
+        }
+        if (!victim || e->keyLen == 0 || (victim->keyLen != 0 && e->stored < victim->stored)) {
+            victim = e;
+        }
+    }
+    return create ? victim : 0;
+}
+
+// request: ZZ PB SB NN data, response: NN data CRC, both crc-checked already.
+void respCachePut(RespCache* cache, const uint8_t* key, int keyLen, const uint8_t* resp, int respLen, mono_t now) {
+    if (keyLen > RESP_CACHE_KEY_LEN || respLen > RESP_CACHE_RESP_LEN || isMasterAddr(key[0]) || respCacheTtl(key, keyLen) == 0) {
+        return;
+    }
+    RespEntry* e = respCacheFind(cache, key, keyLen, true);
+    memcpy(e->key, key, keyLen);
+    e->keyLen  = keyLen;
+    memcpy(e->resp, resp, respLen);
+    e->respLen = respLen;
+    e->stored  = now;
+    cache->countStored++;
+}
+
+// a request (ZZ PB SB NN data) for a register not in respCacheTtls, maybe a write. what was read from the register
+// before may be outdated by it.
+void respCacheWritten(RespCache* cache, const uint8_t* key, int keyLen) {
+    if (respCacheTtl(key, keyLen) > 0) {
+        return;
+    }
+    for (int i=0; i<RESP_CACHE_LEN; i++) {
+        RespEntry* d = &cache->entries[i];
+        if (d->keyLen && memcmp(d->key, key, 3) == 0) {
+            d->keyLen = 0;
+            cache->countDropped++;
+        }
+    }
+}
+
+// the answer to a request (QQ ZZ PB SB NN data CRC) if it is at most as old as respCacheTtls allows, and at most
+// maxAge [s] (-1: no further limit).
+// answer: the request, ACK, the cached response, ACK and SYN, as it would come from the bus.
+bool respCacheAnswer(RespCache* cache, Telegram* request, int maxAge, Telegram* answer, mono_t now) {
+    const uint8_t* key = &request->data[1];
+    int keyLen = request->len - 2;
+    if (keyLen < 4 || isMasterAddr(key[0]) || key[0] == 0xFE) {
+        return false; // no slave, no answer to keep
+    }
+    int ttl = respCacheTtl(key, keyLen);
+    if (maxAge >= 0) {
+        ttl = MIN(ttl, maxAge);
+    }
+    RespEntry* e = ttl > 0 && keyLen <= RESP_CACHE_KEY_LEN ? respCacheFind(cache, key, keyLen, false) : 0;
+    if (!e || now - e->stored > MSEC(ttl*1000LL)) {
+        cache->countMisses++;
+        respCacheWritten(cache, key, keyLen);
+        return false;
+    }
+    cache->countHits++;
+    *answer = *request;
+    answer->data[answer->len++] = 0x00; // ACK
+    memcpy(&answer->data[answer->len], e->resp, e->respLen);
+    answer->len += e->respLen;
+    answer->data[answer->len++] = 0x00; // ACK of the master
+    answer->data[answer->len++] = 0xAA; // SYN
+    return true;
+}
+
+//////////////////////////
+// Raw capture and replay
+
+// optional (-c): every chunk read from the adapter is appended to a memory-mapped log, as it came from the socket.
+// so incidents can be replayed offline (-r) through the same processing, without adapter and broker.
+// the pages belong to the kernel, so the log survives a crash of ebusd-light (not of the machine).
+// when a file is full, it is renamed to <file>.1 (replacing the previous one) and a new one is started.
+// format, host byte order:
+//  header  u32 magic, u32 version, i64 realtime [ns] at creation, i64 monotonic [ns] at creation
+//  records i64 monotonic [ns], u32 length n, n bytes. a length of 0 ends the file.
+#define CAPTURE_MAGIC      0x43424531  // "1EBC"
+#define CAPTURE_VERSION    1
+#define CAPTURE_FILE_SIZE  (64<<20)    // [bytes], about a day of bus traffic
+#define CAPTURE_HEADER_LEN 24
+#define CAPTURE_RECORD_LEN 12          // without the bytes
+struct Capture {
+    char        path[256];  // "": off
+    int         fd;
+    uint8_t*    map;
+    size_t      pos;
+    int         rotations;
+};
+
+bool captureOpen(Capture* capture) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint32_t magic = CAPTURE_MAGIC, version = CAPTURE_VERSION;
+    int64_t created = (int64_t)ts.tv_sec*1000000000LL + ts.tv_nsec, createdMono = monoNow();
+    capture->fd = open(capture->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (capture->fd < 0 || ftruncate(capture->fd, CAPTURE_FILE_SIZE) != 0) {
+        printf("could not create capture file %s, capture off\n", capture->path);
+        if (capture->fd >= 0) close(capture->fd);
+        capture->path[0] = 0;
+        return false;
+    }
+    capture->map = (uint8_t*)mmap(0, CAPTURE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+    if (capture->map == MAP_FAILED) {
+        printf("could not map capture file %s, capture off\n", capture->path);
+        close(capture->fd);
+        capture->path[0] = 0;
+        return false;
+    }
+    memcpy(capture->map,    &magic, 4);
+    memcpy(capture->map+4,  &version, 4);
+    memcpy(capture->map+8,  &created, 8);
+    memcpy(capture->map+16, &createdMono, 8);
+    capture->pos = CAPTURE_HEADER_LEN;
+    return true;
+}
+
+// cuts off the unused (zero) rest, so closed files take only what they contain.
+void captureClose(Capture* capture) {
+    if (capture->map) {
+        munmap(capture->map, CAPTURE_FILE_SIZE);
+        capture->map = 0;
+        ftruncate(capture->fd, capture->pos + CAPTURE_RECORD_LEN); // keeping a zero record as end mark
+        close(capture->fd);
+        capture->fd = -1;
+    }
+}
+
+// one record per read from the socket. the chunk may be split in two parts (iov), as in the ring.
+void captureChunk(Capture* capture, const struct iovec* iov, int iovcnt, int len) {
+    if (!capture->path[0]) {
+        return;
+    }
+    if (capture->pos + 2*CAPTURE_RECORD_LEN + len > CAPTURE_FILE_SIZE) {
+        char old[sizeof(capture->path)+2];
+        captureClose(capture);
+        snprintf(old, sizeof(old), "%s.1", capture->path);
+        rename(capture->path, old);
+        capture->rotations++;
+        if (!captureOpen(capture)) {
+            return;
+        }
+    }
+    int64_t t = monoNow();
+    uint32_t n = len;
+    uint8_t* p = capture->map + capture->pos;
+    memcpy(p, &t, 8);
+    memcpy(p+8, &n, 4);
+    p += CAPTURE_RECORD_LEN;
+    for (int i=0; i<iovcnt && len>0; i++) {
+        int part = MIN((int)iov[i].iov_len, len);
+        memcpy(p, iov[i].iov_base, part);
+        p += part;
+        len -= part;
+    }
+    capture->pos = p - capture->map;
+}
+
+// bytes received from the adapter but not yet processed.
+// filled with one readv() per loop (instead of one read() per byte), drained by processEnhBusChars.
+#define RX_RING_SIZE 4096 // must be a power of 2
+struct ByteRing {
+    uint8_t      data[RX_RING_SIZE];
+    unsigned int head; // write index, free running
+    unsigned int tail; // read index, free running
+    int          reads; // statistics
+    mono_t       tRecv; // last read, see PublishSlot.tRx
+};
+
+// reads whatever the kernel has buffered, as long as there is room. like read():
+// returns >0 nr of bytes, 0 on closed connection, <0 on error (see errno, EWOULDBLOCK if just nothing there)
+int ringRecv(int sock, ByteRing* ring, Capture* capture) {
+    unsigned int used = ring->head - ring->tail;
+    unsigned int room = RX_RING_SIZE - used;
+    unsigned int w    = ring->head & (RX_RING_SIZE-1);
+    struct iovec iov[2];
+    int res;
+    if (room == 0) {
+        errno = EWOULDBLOCK; // full, let processing catch up first.
+        return -1;
+    }
+    iov[0].iov_base = &ring->data[w];
+    iov[0].iov_len  = MIN(room, RX_RING_SIZE-w);
+    iov[1].iov_base = &ring->data[0];
+    iov[1].iov_len  = room - iov[0].iov_len;
+    res = readv(sock, iov, iov[1].iov_len ? 2 : 1);
+    ring->reads++;
+    if (res > 0) {
+        ring->tRecv = monoNow();
+        captureChunk(capture, iov, 2, res);
+        ring->head += res;
+    }
+    return res;
+}
+
+// feeds buffered bytes to the enhanced protocol decoder, in (at most two) contiguous chunks.
+void ringProcess(ByteRing* ring, EbusLink* link) {
+    unsigned int r, n;
+    while (ring->tail != ring->head) {
+        r = ring->tail & (RX_RING_SIZE-1);
+        n = MIN(ring->head - ring->tail, RX_RING_SIZE-r);
+        processEnhBusChars(link, &ring->data[r], n);
+        ring->tail += n;
+    }
+}
+
+
+//////////////////////////
+// Bus schedule
+
+// much of the traffic is periodic: the controller asks the heat pump (10 08 B5 11, 10 76 B5 11 ...) every few seconds,
+// always with about the same period. arbitrating right when one of those masters is due means losing against it
+// (or worse, delaying it). so the periods are learned, per register, from the telegrams seen, and an arbitration
+// is held back until a gap long enough for our request and its answer (see schedIdleIn, ARBITRATION_INIT).
+// a register is predicted once SCHED_CONFIDENT periods in a row matched. missed ones (e.g. switched off) are forgotten
+// after SCHED_MISSED periods. times are estimated from the byte count, the adapter reports no timestamps.
+#define SCHED_ARBITRATION   true   // false: arbitrate right away, as before
+#define SCHED_LEN           32     // registers tracked per bus
+#define SCHED_MIN_PERIOD_MS 200    // shorter repetitions are bursts, not a schedule
+#define SCHED_TOLERANCE_MS  30     // a period matches if this close, or within 5% of it
+#define SCHED_CONFIDENT     3
+#define SCHED_MISSED        3
+#define SCHED_GUARD_MS      15     // margin before and after a predicted telegram
+#define SCHED_MAX_DEFER_MS  1000   // an arbitration is held back at most this long, retries included
+#define SCHED_RESPONSE_GUESS 12    // [bytes] ACK, slave response and SYN, added to the request for the gap needed
+#define BUS_BYTES_PER_S     240    // 2400 Bd, start + 8 data + stop bits
+#define BUS_BYTE_NS         (1000000000LL/BUS_BYTES_PER_S)
+struct SchedEntry {
+    uint32_t key;       // QQ ZZ PB SB
+    mono_t   last;      // start of the last one
+    mono_t   period;    // 0 until seen twice
+    mono_t   duration;  // on the bus
+    int      hits;      // matching periods in a row
+    bool     used;
+};
+struct BusSchedule {
+    SchedEntry entry[SCHED_LEN];
+    mono_t     lastEnd; // of the last telegram, for the gaps
+    // statistics
+    int        countReplaced;
+};
+
+// a telegram of len bytes (escapes resolved, slave part included) ended at end.
+void schedSeen(BusSchedule* s, const uint8_t* data, int len, mono_t end, Histogram* gaps) {
+    mono_t duration = len * BUS_BYTE_NS;
+    mono_t start = end - duration;
+    if (s->lastEnd && start > s->lastEnd) {
+        histRecord(gaps, (start - s->lastEnd)/1000);
+    }
+    s->lastEnd = end;
+    if (len < 5) {
+        return;
+    }
+    uint32_t key = (uint32_t)data[0]<<24 | data[1]<<16 | data[2]<<8 | data[3];
+    SchedEntry* e = 0;
+    SchedEntry* victim = &s->entry[0];
+    for (int i=0; i<SCHED_LEN && !e; i++) {
+        SchedEntry* c = &s->entry[i];
+        if (c->used && c->key == key) {
+            e = c;
+        } else if (!c->used || (victim->used && (c->hits < victim->hits || (c->hits == victim->hits && c->last < victim->last)))) {
+            victim = c;
+        }
+    }
+    if (!e) {
+        // unknown: take a free one, or the least regular (and then the longest unseen) one.
+        s->countReplaced += victim->used;
+        memset(victim, 0, sizeof(*victim));
+        victim->key  = key;
+        victim->used = true;
+        victim->last = start;
+        victim->duration = duration;
+        return;
+    }
+    mono_t p = start - e->last;
+    mono_t tolerance = MAX(MSEC(SCHED_TOLERANCE_MS), e->period/20);
+    if (p < MSEC(SCHED_MIN_PERIOD_MS)) {
+        e->hits = 0;
+        e->period = 0;
+    } else if (e->period && p > e->period - tolerance && p < e->period + tolerance) {
+        e->hits++;
+        e->period += (p - e->period)/4;
+    } else {
+        e->hits = 0;
+        e->period = p;
+    }
+    e->duration += (duration - e->duration)/4;
+    e->last = start;
+}
+
+// how long to wait from now for a gap of need without a predicted telegram. 0: go ahead.
+mono_t schedIdleIn(BusSchedule* s, mono_t now, mono_t need) {
+    mono_t t = now;
+    mono_t guard = MSEC(SCHED_GUARD_MS);
+    bool moved = true;
+    // every predicted telegram that overlaps [t, t+need] pushes t behind it. until none does.
+    for (int round=0; moved && round<SCHED_LEN; round++) {
+        moved = false;
+        for (int i=0; i<SCHED_LEN; i++) {
+            SchedEntry* e = &s->entry[i];
+            if (!e->used || e->hits < SCHED_CONFIDENT || now - e->last > SCHED_MISSED*e->period) {
+                continue;
+            }
+            // the next one not over before t
+            mono_t next = e->last + e->period * MAX(1, (t - guard - e->duration - e->last)/e->period + 1);
+            if (next - guard < t + need && next + e->duration + guard > t) {
+                t = next + e->duration + guard;
+                moved = true;
             }
-            if(byte2==0x00) {
-                byte = 0xA9;
+        }
+    }
+    return t - now;
+}
+
+// registers currently predicted, for the stats
+int schedPredicted(BusSchedule* s, mono_t now) {
+    int n = 0;
+    for (int i=0; i<SCHED_LEN; i++) {
+        SchedEntry* e = &s->entry[i];
+        n += e->used && e->hits >= SCHED_CONFIDENT && now - e->last <= SCHED_MISSED*e->period;
+    }
+    return n;
+}
+
+
+//////////////////////////
+// Buses
+
+// one process serves several adapters, each one bus, all in the one event loop and over one broker connection.
+// every bus has its own link layer state, send state machine, tx queue, suppression cache and capture, and its own
+// topics: the bus name is inserted after the first level, ebus/<name>/ll/rx. a single bus may go without name and
+// keeps the topics as defined above.
+#define MAX_BUSES     32
+#define BUS_NAME_LEN  24
+#define TOPIC_LEN     64
+
+// requests ebusd-light sends by itself, see Polling.
+#define POLL_MAX_ENTRIES 32  // per bus
+struct PollEntry {
+    Telegram telegram;      // with crc
+    int      intervalMs, jitterMs;
+    mono_t   due;
+};
+struct Poller {
+    PollEntry entry[POLL_MAX_ENTRIES];
+    int       count;
+    int       inFlight;     // entry queued or on the bus, -1 if none
+    uint64_t  txFailed;     // metrics.txFailed when it was queued
+    Timer     timer;        // next entry due, or the pause after the last one
+    Timer     window;       // see pollAdapt
+    int       backoff;      // intervals and pauses are stretched by this, 1..POLL_BACKOFF_MAX
+    int       wireBytes;    // bytes on the bus in the current window, SYN not counted
+    uint64_t  arbWon, arbLost;  // at the start of the window
+    int       failures;         // during it
+    double    load;         // share of the bus in use, last window
+    // statistics
+    uint64_t  countSent, countFailed;
+    int       countBackoffs;
+};
+
+// counted by the state machines, all time. together with the link's and the tx queue's counters they are reported
+// every STATS_INTERVAL_S on TOPIC_STATS and to prometheus, see busCounters.
+struct BusMetrics {
+    uint64_t  crcErrors;          // telegrams with bad master or slave crc
+    uint64_t  arbitrationWon, arbitrationLost, arbitrationRetries;
+    uint64_t  arbitrationTimeouts, echoTimeouts, ackTimeouts, responseTimeouts;
+    uint64_t  arbitrationDeferred; // held back for a predicted telegram, see BusSchedule
+    uint64_t  naks;
+    uint64_t  txCompleted, txFailed;
+    uint64_t  reconnects;         // connection to the adapter lost or failed
+    Histogram txLatency;          // tx request queued .. completed, successful ones only
+    Histogram idleGap;            // between two telegrams, only SYN on the bus
+};
+
+struct Bus {
+    char        name[BUS_NAME_LEN];  // "" only if it is the only one
+    const char* ip;
+    int         port;
+    int         sock;
+    State       state;               // adapter part of the state machine, see busStep
+    Timer       stateTimer;
+    uint8_t     initresp_candidate[2];
+    bool        ready;               // epoll reported the socket, see eventWait
+    EbusLink    link;
+    ByteRing    rxRing;
+    Capture     capture;
+    ArchiveWriter archive;           // optional (-d dir), every telegram, see archive.h
+    AdapterInfo adapterInfo;
+    TxQueue     txQueue;
+    SuppressCache suppress;
+    RespCache   respCache;
+    Poller      poll;
+    BusSchedule schedule;
+    // sending, see charsPreparedTCP
+    TelegramSendState sendState;
+    Telegram    telegramToSend;
+    Telegram    telegramOwn;         // our request currently on the bus, to recognize it (and its response) on rx.
+    bool        telegramOwnPending;
+    Telegram    telegramToSendExpanded;
+    Telegram    telegramToSendExpandedEnhanced;
+    int         telegramToSendExpandedEnhancedIndex;
+    Telegram    telegramTxRxdExpanded; // echo of master request + slave response.
+    Telegram    telegramTxRxd;
+    int         arbitration_retries;
+    mono_t      arbitrationStart;    // first attempt for the current request, see SCHED_MAX_DEFER_MS
+    Timer       sendTimeout;         // state timeout, gives up
+    Timer       sendDelay;           // minimum time in state, before some transitions are allowed
+    int         sendEchoChecked;     // SENDDATA: bytes of the echo already compared with what we sent
+    bool        sendSynSeen;         // SENDWAITSYN: the bus is free again
+    int         sendCountPipelined;  // statistics
+    uint64_t    sendCountEchoMismatch;
+    mono_t      telegramToSendQueued;
+    bool        sendOk;              // the request went through, see FINISHED
+    BusMetrics  metrics;
+    uint8_t     chars_to_send_bus[256];
+    int         chars_to_send_len;
+    char        topicTx[TOPIC_LEN];
+    char        topicRxd[TOPIC_LEN];
+    char        topicRxb[TOPIC_LEN];
+    char        topicRxf[TOPIC_LEN];
+    char        topicDecoded[TOPIC_LEN];
+    char        topicStats[TOPIC_LEN];
+    char        topicLatency[TOPIC_LEN];
+};
+Bus buses[MAX_BUSES];
+int busCount = 0;
+
+// base with the bus name inserted after the first level: ebus/ll/rx => ebus/<name>/ll/rx
+void busTopic(Bus* bus, char* topic, const char* base) {
+    const char* rest = strchr(base, '/');
+    if (!bus->name[0] || !rest) {
+        snprintf(topic, TOPIC_LEN, "%s", base);
+    } else {
+        snprintf(topic, TOPIC_LEN, "%.*s/%s%s", (int)(rest-base), base, bus->name, rest);
+    }
+}
+
+// for messages
+const char* busLabel(Bus* bus) {
+    return bus->name[0] ? bus->name : bus->ip;
+}
+
+void sendStateTimersStart(Bus* bus) {
+    timerStop(&bus->sendTimeout);
+    timerStop(&bus->sendDelay);
+    switch(bus->sendState) {
+        case ARBITRATION_AWAIT:
+            timerStart(&bus->sendTimeout, MSEC(SEND_ARBITRATION_TIMEOUT_MS));
+            timerStart(&bus->sendDelay,   MSEC(SEND_ARBITRATION_RETRY_MS));
+            break;
+        case SENDDATA:
+            timerStart(&bus->sendTimeout, MSEC(SEND_DATA_TIMEOUT_MS));
+            break;
+        case AWAITACK:
+            timerStart(&bus->sendTimeout, MSEC(SEND_ACK_TIMEOUT_MS));
+            timerStart(&bus->sendDelay,   MSEC(SEND_BROADCAST_SETTLE_MS));
+            break;
+        case AWAITRESPONSE:
+            timerStart(&bus->sendTimeout, MSEC(SEND_RESPONSE_TIMEOUT_MS));
+            break;
+        case SENDWAITSYN:
+            timerStart(&bus->sendTimeout, MSEC(SEND_WAITSYN_TIMEOUT_MS));
+            bus->sendSynSeen = false;
+            break;
+        default:
+            break;
+    }
+}
+
+void adapterInfoReset(AdapterInfo* info) {
+    memset(info, 0, sizeof(*info));
+    info->expected = -1;
+}
+
+// see EbusLink.onInfo. we only ever ask for the version, so that is what the answer is.
+void processAdapterInfo(EbusLink* link, uint8_t value) {
+    Bus* bus = (Bus*)link->ctx;
+    AdapterInfo* info = &bus->adapterInfo;
+    if (info->expected < 0) {
+        info->expected = value;
+        info->got = 0;
+    } else if (info->got < info->expected) {
+        if (info->got < (int)sizeof(info->data)) {
+            info->data[info->got] = value;
+        }
+        info->got++;
+    }
+    if (info->expected >= 0 && info->got == info->expected) {
+        uint8_t version  = info->got >= 1 ? info->data[0] : 0;
+        uint8_t features = info->got >= 2 ? info->data[1] : 0;
+        info->expected = -1;
+        printf("%s: adapter version %d, features 0x%02x, %s send\n", busLabel(bus), version, features, sendPipelined ? "pipelined" : "byte by byte");
+    }
+}
+
+
+PublishSlot* publishSlotAlloc(Bus* bus, const char* topic, mono_t tRx, uint32_t traceId) {
+    PublishSlot* slot = publishQueueAlloc();
+    if (!slot) {
+        mono_t now = monoNow();
+        publishQueue.dropped++;
+        if (publishQueue.droppedNoticed == 0 || now - publishQueue.droppedNoticeAt >= MSEC(PUBLISH_DROP_NOTICE_S*1000LL)) {
+            printf("publish queue full, dropping telegrams, %llu since the last notice.\n",
+                (unsigned long long)(publishQueue.dropped - publishQueue.droppedNoticed));
+            publishQueue.droppedNoticed = publishQueue.dropped;
+            publishQueue.droppedNoticeAt = now;
+        }
+        return 0;
+    }
+    strcpy(slot->topic, topic);
+    slot->tRx     = tRx;
+    slot->traceId = traceId;
+    slot->bus     = bus - buses;
+    return slot;
+}
+
+void publishSlotPush(PublishSlot* slot) {
+    publishQueuePush();
+    trace(&traceMain, TRACE_ENQUEUE, slot->bus, slot->traceId, publishQueue.head.load(std::memory_order_relaxed) - publishQueue.tail.load(std::memory_order_relaxed), monoNow());
+    publisherWake();
+}
+
+//////////////////////////
+// Time series
+
+// optional (-s dir): every decoded number is kept in a compressed store, see timeseries.h. one series per value and bus,
+// e.g. "ForwTemp[C]" or with several buses "hp1/ForwTemp[C]", timestamps in ms since epoch. a sample takes about a byte
+// or less, so weeks of data fit into a few MB. queries on TOPIC_TS_QUERY are answered on TOPIC_TS_RESULT, in as many
+// messages as it takes (up to TS_QUERY_MAX_MSGS, and only from publish slots beyond TS_QUERY_KEEP_SLOTS, so that
+// telegrams are not dropped for it), numbered by seq. the last one always goes out, or {"id":"a","error":"busy"}:
+//  {"name":"ForwTemp[C]","from":-86400000,"to":0,"step":900000,"id":"a"}  from/to <= 0: relative to now (to defaults to
+//                                                                          now, from to the start), step: buckets [ms]
+//  {"id":"a","seq":0,"name":"ForwTemp[C]","points":[[t,v],...],"last":true}                          without step
+//  {"id":"a","seq":0,"name":"ForwTemp[C]","step":900000,"points":[[t,n,min,max,avg],...],"last":true}  with step
+//  {"id":"a","seq":0,"names":["ForwTemp[C]",...],"last":true}                                         without name
+// the same as csv over the metrics port (-m): GET /ts?name=ForwTemp[C]&from=-86400000&step=900000, up to TS_HTTP_MAX_LEN
+#define TOPIC_TS_QUERY    "ebus/ll/ts/query"
+#define TOPIC_TS_RESULT   "ebus/ll/ts/result"
+#define TS_QUERY_MAX_MSGS 4    // per query over mqtt, the rest is cut off ("truncated":true)
+#define TS_QUERY_KEEP_SLOTS (PUBLISH_QUEUE_LEN/2)  // of the publish queue, left to telegrams
+#define TS_HTTP_MAX_LEN   (64*1024) // per query over http, the rest is cut off (last line "# truncated")
+#define TS_ID_LEN         32
+TsStore timeseries;
+bool    timeseriesOpen = false;
+
+int64_t realtimeMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+// the numbers of a decoded telegram. strings (schedules, clock) are not kept.
+void tsRecord(Bus* bus, B5Values* values) {
+    char name[TS_NAME_LEN];
+    int64_t t = realtimeMs();
+    for (int i=0; i<values->count; i++) {
+        if (snprintf(name, sizeof(name), "%s%s%s", bus->name, bus->name[0] ? "/" : "", values->name[i]) >= (int)sizeof(name)) {
+            continue;
+        }
+        int series = tsSeries(&timeseries, name);
+        if (series >= 0) {
+            tsAppend(&timeseries, series, t, values->value[i]);
+        }
+    }
+}
+
+struct TsQuery {
+    char    name[TS_NAME_LEN];  // "": list the names
+    char    id[TS_ID_LEN];      // passed back, to match the answer
+    int64_t from, to, step;     // step 0: raw samples
+};
+
+void tsQueryInit(TsQuery* q) {
+    memset(q, 0, sizeof(*q));
+    q->from = INT64_MIN;
+}
+
+// relative times (<= 0) to absolute ones.
+void tsQueryResolve(TsQuery* q) {
+    int64_t now = realtimeMs();
+    if (q->from != INT64_MIN && q->from <= 0) q->from += now;
+    if (q->to <= 0) q->to += now;
+}
+
+// {"name":"ForwTemp[C]","from":-3600000,"step":60000,"id":"a"}, all optional.
+bool tsQueryParseJson(char* json, TsQuery* q) {
+    char* val; int len;
+    tsQueryInit(q);
+    if (json_lookup(json, "name", &val, &len)) {
+        if (len >= TS_NAME_LEN) return false;
+        memcpy(q->name, val, len);
+    }
+    if (json_lookup(json, "id", &val, &len)) {
+        if (len >= TS_ID_LEN || memchr(val, '\\', len)) return false;
+        memcpy(q->id, val, len);
+    }
+    if (json_lookup(json, "from", &val, &len)) q->from = strtoll(val, 0, 10);
+    if (json_lookup(json, "to",   &val, &len)) q->to   = strtoll(val, 0, 10);
+    if (json_lookup(json, "step", &val, &len)) q->step = strtoll(val, 0, 10);
+    return q->step >= 0;
+}
+
+// name=ForwTemp%5BC%5D&from=-3600000&step=60000, up to the end of the request line.
+bool tsQueryParseUrl(const char* s, TsQuery* q) {
+    tsQueryInit(q);
+    while (*s && *s != ' ' && *s != '\r' && *s != '\n') {
+        const char* key = s;
+        const char* eq  = strchr(s, '=');
+        if (!eq) return false;
+        char value[TS_NAME_LEN];
+        int n = 0;
+        for (s = eq+1; *s && *s != '&' && *s != ' ' && *s != '\r' && *s != '\n'; s++) {
+            int c = (uint8_t)*s;
+            if (c == '%' && isxdigit(s[1]) && isxdigit(s[2])) {
+                char hex[3] = { s[1], s[2], 0 };
+                c = strtol(hex, 0, 16);
+                s += 2;
             }
-            i++;
+            if (n+1 >= (int)sizeof(value)) return false;
+            value[n++] = c;
+        }
+        value[n] = 0;
+        if      (strncmp(key, "name=", 5) == 0) strcpy(q->name, value);
+        else if (strncmp(key, "from=", 5) == 0) q->from = strtoll(value, 0, 10);
+        else if (strncmp(key, "to=",   3) == 0) q->to   = strtoll(value, 0, 10);
+        else if (strncmp(key, "step=", 5) == 0) q->step = strtoll(value, 0, 10);
+        if (*s == '&') s++;
+    }
+    return q->step >= 0;
+}
+
+// answer over mqtt: items are collected into publish slots, a slot that is full goes out and the next one is started.
+#define TS_RESULT_TRAILER 40  // room for ],"last":false,"truncated":true}
+struct TsResult {
+    TsQuery*     q;
+    PublishSlot* slot;
+    int          seq, items;
+    int          maxMsgs;  // counted before, so that every slot up to it can be had
+    bool         truncated;
+};
+
+bool tsResultOpen(TsResult* r) {
+    if (!(r->slot = publishSlotAlloc(&buses[0], TOPIC_TS_RESULT, 0, 0))) {
+        r->truncated = true;
+        return false;
+    }
+    PublishSlot* slot = r->slot;
+    slot->len = 0;
+    bufPrintf(slot->payload, sizeof(slot->payload), &slot->len, "{\"id\":\"%s\",\"seq\":%d,", r->q->id, r->seq);
+    if (!r->q->name[0]) {
+        bufPrintf(slot->payload, sizeof(slot->payload), &slot->len, "\"names\":[");
+    } else if (r->q->step > 0) {
+        bufPrintf(slot->payload, sizeof(slot->payload), &slot->len, "\"name\":\"%s\",\"step\":%lld,\"points\":[", r->q->name, (long long)r->q->step);
+    } else {
+        bufPrintf(slot->payload, sizeof(slot->payload), &slot->len, "\"name\":\"%s\",\"points\":[", r->q->name);
+    }
+    r->items = 0;
+    return true;
+}
+
+void tsResultClose(TsResult* r, bool last) {
+    PublishSlot* slot = r->slot;
+    bufPrintf(slot->payload, sizeof(slot->payload), &slot->len, "],\"last\":%s%s}", last ? "true" : "false", r->truncated ? ",\"truncated\":true" : "");
+    publishSlotPush(slot);
+    r->slot = 0;
+    r->seq++;
+}
+
+void tsResultAdd(TsResult* r, const char* item) {
+    if (r->truncated) {
+        return;
+    }
+    if (r->slot->len + 1 + (int)strlen(item) + TS_RESULT_TRAILER > (int)sizeof(r->slot->payload)) {
+        if (r->seq+1 >= r->maxMsgs) {
+            r->truncated = true; // the current one goes out as the last one
+            return;
+        }
+        tsResultClose(r, false);
+        if (!tsResultOpen(r)) {
+            return;
         }
-        pOut->data[pOut->len++] = byte;
+    }
+    bufPrintf(r->slot->payload, sizeof(r->slot->payload), &r->slot->len, "%s%s", r->items++ ? "," : "", item);
+}
+
+void tsResultPoint(void* ctx, int64_t t, double v) {
+    char item[64];
+    snprintf(item, sizeof(item), "[%lld,%.15g]", (long long)t, v);
+    tsResultAdd((TsResult*)ctx, item);
+}
+
+void tsResultBucket(void* ctx, int64_t t, int n, double min, double max, double avg) {
+    char item[128];
+    snprintf(item, sizeof(item), "[%lld,%d,%.15g,%.15g,%.6g]", (long long)t, n, min, max, avg);
+    tsResultAdd((TsResult*)ctx, item);
+}
+
+void tsResultName(void* ctx, const char* name) {
+    char item[TS_NAME_LEN+2];
+    snprintf(item, sizeof(item), "\"%s\"", name);
+    tsResultAdd((TsResult*)ctx, item);
+}
+
+void tsQueryRun(TsQuery* q, TsPointFn* point, TsBucketFn* bucket, TsNameFn* name, void* ctx) {
+    tsQueryResolve(q);
+    if (!q->name[0]) {
+        tsNames(&timeseries, name, ctx);
+    } else if (q->step > 0) {
+        tsReadDownsampled(&timeseries, q->name, q->from, q->to, q->step, bucket, ctx);
+    } else {
+        tsRead(&timeseries, q->name, q->from, q->to, point, ctx);
     }
 }
-void telegramExpandEnhanced(Telegram* pIn, Telegram *pOut) {
-    int i=0;
-    uint8_t byte;
-    pOut->len = 0;
-    for(i=0;i<pIn->len;i++) {
-        byte = pIn->data[i];
-        if (pOut->len+2 >= sizeof(pOut->data)) {
-            return; //avoid overflow, just in case, not expected to happen.
+
+// a message on TOPIC_TS_QUERY, from the inbox.
+void tsQueryMqtt(char* payload, int len) {
+    char json[256];
+    TsQuery q;
+    TsResult r;
+    if (!timeseriesOpen || len >= (int)sizeof(json)) {
+        return;
+    }
+    memcpy(json, payload, len);
+    json[len] = 0;
+    if (!tsQueryParseJson(json, &q)) {
+        printf("could not parse time series query: %s\n", json);
+        return;
+    }
+    memset(&r, 0, sizeof(r));
+    r.q = &q;
+    r.maxMsgs = MIN(TS_QUERY_MAX_MSGS, publishQueueFree() - TS_QUERY_KEEP_SLOTS);
+    if (r.maxMsgs < 1) {
+        PublishSlot* slot = publishQueueFree() > 0 ? publishSlotAlloc(&buses[0], TOPIC_TS_RESULT, 0, 0) : 0;
+        if (!slot) {
+            printf("time series query %s not answered, publish queue full\n", q.id);
+            return;
         }
-        // KISS. allows for easy separation for byte by byte sending. 1 char => 2 char.
-        //if (byte & 0x80) {
-            pOut->data[pOut->len++]  = 0xC0 | (0x01<<2) | ((byte&0xC0)>>6);
-            pOut->data[pOut->len++]  = 0x80 | (byte&0x3F);
-        // }
-        // else {
-        //     pOut->data[pOut->len++] = byte;
-        // }
+        slot->len = 0;
+        bufPrintf(slot->payload, sizeof(slot->payload), &slot->len, "{\"id\":\"%s\",\"error\":\"busy\",\"last\":true}", q.id);
+        publishSlotPush(slot);
+        return;
+    }
+    tsResultOpen(&r); // can not fail, see maxMsgs
+    tsQueryRun(&q, tsResultPoint, tsResultBucket, tsResultName, &r);
+    if (r.slot) {
+        tsResultClose(&r, true);
     }
 }
 
-bool json2struct(char* jsonstr, struct Telegram* pTelegram);
+// answer over the metrics port, as csv. built in a buffer of bounded size first, then written in one go under the
+// timeouts of the metrics port, like the metrics themselves: a slow client can not hold up the buses.
+#define TS_HTTP_TRAILER 32  // room for "# truncated"
+struct TsCsv {
+    char* buf;
+    int   len;
+    bool  truncated;
+};
+
+void tsCsvAdd(TsCsv* c, const char* fmt, ...) {
+    va_list ap;
+    if (c->truncated) {
+        return;
+    }
+    va_start(ap, fmt);
+    int n = vsnprintf(c->buf + c->len, TS_HTTP_MAX_LEN - TS_HTTP_TRAILER - c->len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || c->len + n >= TS_HTTP_MAX_LEN - TS_HTTP_TRAILER) {
+        c->truncated = true;
+        return;
+    }
+    c->len += n;
+}
+
+void tsCsvPoint(void* ctx, int64_t t, double v) {
+    tsCsvAdd((TsCsv*)ctx, "%lld,%.15g\n", (long long)t, v);
+}
+
+void tsCsvBucket(void* ctx, int64_t t, int n, double min, double max, double avg) {
+    tsCsvAdd((TsCsv*)ctx, "%lld,%d,%.15g,%.15g,%.6g\n", (long long)t, n, min, max, avg);
+}
+
+void tsCsvName(void* ctx, const char* name) {
+    tsCsvAdd((TsCsv*)ctx, "%s\n", name);
+}
+
+// url: what follows "GET /ts" in the request line. fd has the send timeout of the metrics port.
+void tsServeHttp(int fd, const char* url) {
+    static char csv[TS_HTTP_MAX_LEN];
+    char header[128];
+    struct iovec iov[2];
+    TsQuery q;
+    TsCsv c = { csv, 0, false };
+    const char* status = "200 OK";
+    const char* type = "text/csv";
+    if (!timeseriesOpen) {
+        status = "404 Not Found";
+        type = "text/plain";
+        tsCsvAdd(&c, "time series store off, see -s\n");
+    } else if ((*url != '?' && *url != ' ') || !tsQueryParseUrl(*url == '?' ? url+1 : url, &q)) {
+        status = "400 Bad Request";
+        type = "text/plain";
+        tsCsvAdd(&c, "usage: /ts?name=...&from=ms&to=ms&step=ms\n");
+    } else {
+        tsCsvAdd(&c, !q.name[0] ? "name\n" : q.step > 0 ? "t,n,min,max,avg\n" : "t,value\n");
+        tsQueryRun(&q, tsCsvPoint, tsCsvBucket, tsCsvName, &c);
+        if (c.truncated) {
+            c.len += snprintf(csv + c.len, TS_HTTP_TRAILER, "# truncated\n");
+        }
+    }
+    iov[1].iov_base = csv;
+    iov[1].iov_len  = c.len;
+    iov[0].iov_base = header;
+    iov[0].iov_len  = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n\r\n", status, type, c.len);
+    writev(fd, iov, 2);
+}
+
+static_assert(TELEGRAM_MASTER_CRC_OK == FRAME_MASTER_CRC_OK && TELEGRAM_SLAVE_CRC_OK == FRAME_SLAVE_CRC_OK, "frameSplit takes the flags as they are");
+
+// a telegram from the bus (or the response cache, TELEGRAM_CACHED) on rx, rxb, rxf and decoded. frame: see frameSplit.
+// cached: see Suppression, 0 to publish it anyway. tRx: when it was received, for the latencies.
+void publishTelegram(Bus* bus, Telegram* telegram, uint8_t flags, EbusFrame* frame, SuppressEntry* cached, mono_t tRx, uint32_t traceId, mono_t now) {
+    PublishSlot* slot;
+    if (cached && !suppressRxChanged(cached, telegram, now)) {
+        bus->suppress.countSuppressed++;
+    } else {
+        bus->suppress.countForwarded++;
+        if (PUBLISH_RX_JSON && (slot = publishSlotAlloc(bus, bus->topicRxd, tRx, traceId))) {
+            if (struct2json(telegram,flags,slot->payload,sizeof(slot->payload),&slot->len)) {
+                publishSlotPush(slot);
+            }
+        }
+        if (PUBLISH_RX_BINARY && (slot = publishSlotAlloc(bus, bus->topicRxb, tRx, traceId))) {
+            if (struct2bin(telegram,flags,slot->payload,sizeof(slot->payload),&slot->len)) {
+                publishSlotPush(slot);
+            }
+        }
+        if (PUBLISH_RX_FRAMES && (slot = publishSlotAlloc(bus, bus->topicRxf, tRx, traceId))) {
+            if (frame2json(telegram,frame,slot->payload,sizeof(slot->payload),&slot->len)) {
+                publishSlotPush(slot);
+            }
+        }
+    }
+    // same telegram, decoded. most telegrams are unknown, so only take the slot if there is sth to report.
+    // the time series store gets every value, suppressed or not, but not those from the cache again.
+    bool record = timeseriesOpen && !(flags & TELEGRAM_CACHED);
+    B5Values values;
+    if (DECODE_B5 && (slot = publishSlotAlloc(bus, bus->topicDecoded, tRx, traceId))) {
+        if (decodeTelegramB5(telegram->data,telegram->len,slot->payload,sizeof(slot->payload),&slot->len,&values,frame)) {
+            if (record) {
+                tsRecord(bus, &values);
+            }
+            if (!cached || suppressDecodedChanged(cached, slot->payload, slot->len, &values, now)) {
+                publishSlotPush(slot);
+            }
+        }
+    } else if (DECODE_B5 && record) {
+        char json[sizeof(slot->payload)];
+        if (decodeTelegramB5(telegram->data,telegram->len,json,sizeof(json),0,&values,frame)) {
+            tsRecord(bus, &values);
+        }
+    }
+}
 
 // received from MQTT = to send on bus
-void handle_rxd(char* payload, int len) {
+// format: {"telegram":"AB CD ..."} optional: "prio":n (higher first, default 0) "ttl":s (max wait before sending)
+//         "maxage":s (a cached answer this old will do, see Response cache)
+void handle_rxd(Bus* bus, char* payload, int len) {
     char temp[256]; //ensure zero-termination.
+    Telegram telegram, answer;
+    int prio=0, ttl=TX_QUEUE_DEFAULT_TTL, maxAge=-1;
     if (len>=sizeof(temp)) {
         printf("mqtt payload longer than expected. ignoring.");
         return;
     }
     memcpy(temp,payload,len);
     temp[len]=0;
-    if (sendState != SENDIDLE) { // KISS. one telegram at a time only
-        printf("telegram sending busy. ignored.");
-    }
-    else {
-        if (json2struct(temp,&telegramToSend)) {
-            sendState = SENDSTART;
-        } else {
-            printf("could not parse message to telegram: %s\n",temp);
+    if (json2struct(temp,&telegram)) {
+        json_lookup_int(temp, "prio", &prio);
+        json_lookup_int(temp, "ttl",  &ttl);
+        json_lookup_int(temp, "maxage", &maxAge);
+        if (RESP_CACHE && telegramIsPlausibleTx(&telegram) && respCacheAnswer(&bus->respCache, &telegram, maxAge, &answer, monoNow())) {
+            uint8_t flags = TELEGRAM_MASTER_CRC_OK | TELEGRAM_SLAVE_PRESENT | TELEGRAM_SLAVE_CRC_OK | TELEGRAM_OWN | TELEGRAM_CACHED;
+            EbusFrame frame;
+            frameSplit(answer.data, answer.len, flags, &frame);
+            publishTelegram(bus, &answer, flags, &frame, 0, monoNow(), ++traceTelegramId, monoNow());
+            return;
+        }
+        if (!txQueuePut(&bus->txQueue, &telegram, prio, ttl)) {
+            printf("tx queue full. ignored.\n");
         }
+    } else {
+        printf("could not parse message to telegram: %s\n",temp);
     }
     return;
 }
 
 
-// called when received a message via mqtt
+// "If your application calls MQTTClient_setCallbacks(), this puts the client into asynchronous mode"
+// "In asynchronous mode, the client application runs on several threads. "
+// so msgarrvd runs on paho's thread and must not touch our state. it hands the payload over
+// through a pipe instead, which at the same time wakes up the main loop (see eventWait).
+// record format: 1 byte length, 1 byte bus index, payload. zero length = just wake up.
+// bus index INBOX_TRACE: a message on TOPIC_TRACE, INBOX_TS_QUERY: on TOPIC_TS_QUERY.
+#define INBOX_TRACE    0xFF
+#define INBOX_TS_QUERY 0xFE
+int mqttInbox[2] = {-1,-1};
+volatile bool mqttConnectionLost = false;
+
+void inboxPut(int bus, const char* payload, int len) {
+    uint8_t rec[2+255];
+    if (len >= 256) {
+        printf("mqtt payload longer than expected. ignoring.\n");
+        return;
+    }
+    rec[0] = len;
+    rec[1] = bus;
+    if (len > 0) {
+        memcpy(&rec[2], payload, len);
+    }
+    // writes up to PIPE_BUF are atomic, so a record is never torn apart.
+    if (write(mqttInbox[1], rec, 2+len) != 2+len) {
+        printf("mqtt inbox full. ignored.\n");
+    }
+}
+
+// called from the main loop, handles everything that arrived meanwhile.
+void inboxProcess() {
+    uint8_t rec[2+255];
+    while (read(mqttInbox[0], rec, 2) == 2) {
+        if (rec[1] == INBOX_TRACE) {
+            traceDumpRequested = 1;
+        }
+        if (rec[0] > 0 && read(mqttInbox[0], &rec[2], rec[0]) == rec[0]) {
+            if (rec[1] < busCount) {
+                handle_rxd(&buses[rec[1]], (char*)&rec[2], rec[0]);
+            } else if (rec[1] == INBOX_TS_QUERY) {
+                tsQueryMqtt((char*)&rec[2], rec[0]);
+            }
+        }
+    }
+}
+
+// called when received a message via mqtt (on paho's thread)
 int msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_message *message)
 {
     //printf("Message arrived\n");
     //printf("     topic: %s\n", topicName);
     //printf("   message: %.*s\n", message->payloadlen, (char*)message->payload);
 
-    if (strcmp(TOPIC_TX, topicName)==0) {
-        handle_rxd((char*)message->payload, message->payloadlen);
+    // buses does not change once mqtt is up, so it can be read from here.
+    for (int i=0; i<busCount; i++) {
+        if (strcmp(buses[i].topicTx, topicName)==0) {
+            inboxPut(i, (char*)message->payload, message->payloadlen);
+        }
+    }
+    if (strcmp(TOPIC_TRACE, topicName)==0) {
+        inboxPut(INBOX_TRACE, 0, 0);
+    }
+    if (strcmp(TOPIC_TS_QUERY, topicName)==0) {
+        inboxPut(INBOX_TS_QUERY, (char*)message->payload, message->payloadlen);
     }
 
     MQTTClient_freeMessage(&message);
@@ -237,372 +1870,616 @@ int msgarrvd(void *context, char *topicName, int topicLen, MQTTClient_message *m
     return 1;
 }
 
-// called when ready to publish a message via mqtt
-// buffers [must] retain valid until next call (must not be freed by caller as with msgarrvd).
-// buffers [must] contain valid [=zero-terminated] strings (if return true)
-// returns true if the returned message should be sent, false if not
-bool msgPreparedMqtt(char** topic, char** payload) {
-    if (message_to_publish_valid) {
-        strcpy(topic_to_publish, TOPIC_RXD);
-        *topic = topic_to_publish;
-        *payload = message_to_publish;
-        message_to_publish_valid = false;
+// called when the connection to the broker is gone (on paho's thread)
+void connlost(void *context, char *cause)
+{
+    mqttConnectionLost = true;
+    inboxPut(0, 0, 0); // wake up
+}
+
+// true if the telegram is (the echo of) our own request, maybe with response.
+bool telegramIsOwn(Bus* bus, Telegram* telegram) {
+    if (bus->telegramOwnPending && telegram->len >= bus->telegramOwn.len && memcmp(telegram->data, bus->telegramOwn.data, bus->telegramOwn.len) == 0) {
+        bus->telegramOwnPending = false;
         return true;
     }
     return false;
 }
 
+// received sth that looks like a valid telegram > report it. see EbusLink.onTelegram.
+// received on bus -> to sent via mqtt
+void processBusTelegramChecked(EbusLink* link, Telegram* telegram, uint8_t rxFlags) {
+    Bus* bus = (Bus*)link->ctx;
+    mono_t now = monoNow();
+    SuppressEntry* cached = 0;
+    bool own = telegramIsOwn(bus, telegram);
+    uint8_t flags = rxFlags | (own ? TELEGRAM_OWN : 0);
+    uint32_t traceId = ++traceTelegramId;
+    trace(&traceMain, TRACE_SYN, bus - buses, traceId, telegram->len, now);
+    if (!(rxFlags & TELEGRAM_MASTER_CRC_OK) || ((rxFlags & TELEGRAM_SLAVE_PRESENT) && !(rxFlags & TELEGRAM_SLAVE_CRC_OK))) {
+        bus->metrics.crcErrors++;
+    }
+    if (!own) {
+        schedSeen(&bus->schedule, telegram->data, telegram->len, now, &bus->metrics.idleGap);
+    }
+    if (SUPPRESS_UNCHANGED && !own) {
+        cached = suppressLookup(&bus->suppress, telegram, now);
+    }
+    // split once here, for subscribers of TOPIC_RXF and the decoder. crcs are known already.
+    EbusFrame frame;
+    frameSplit(telegram->data, telegram->len, rxFlags, &frame);
+    if (RESP_CACHE && frame.master >= 0) {
+        // writes of other masters, and ours once they are through
+        respCacheWritten(&bus->respCache, &telegram->data[frame.master+1], 4 + telegram->data[frame.master+4]);
+    }
+    if (RESP_CACHE && !own && frame.valid && frame.slave >= 0) {
+        // ours go in at SENDACK already. also the last attempt after a NAK
+        respCachePut(&bus->respCache, &telegram->data[frame.master+1], 4 + telegram->data[frame.master+4],
+            &telegram->data[frame.slave], 2 + telegram->data[frame.slave], now);
+    }
+    if (bus->archive.dir[0]) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        archiveAppend(&bus->archive, (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000, flags, telegram->data, telegram->len);
+    }
+    publishTelegram(bus, telegram, flags, &frame, cached, bus->rxRing.tRecv, traceId, now);
+}
 
-
-const uint8_t master_addresses[25] = {
-     0x00, 0x10, 0x30, 0x70, 0xF0,
-     0x01, 0x11, 0x31, 0x71, 0xF1,
-     0x03, 0x13, 0x33, 0x73, 0xF3,
-     0x07, 0x17, 0x37, 0x77, 0xF7,
-     0x0F, 0x1F, 0x3F, 0x7F, 0xFF
- };
-bool isMasterAddr(uint8_t addr) {
-    for(int i=0;i<25;i++) {
-        if (addr==master_addresses[i])
-            return true;
+// compares the echo received so far with the request we sent. false at the first difference: someone else
+// was sending at the same time (collision), the bus is not ours anymore.
+bool sendEchoMatches(Bus* bus) {
+    int n = MIN(bus->telegramTxRxdExpanded.len, bus->telegramToSendExpanded.len);
+    for (; bus->sendEchoChecked < n; bus->sendEchoChecked++) {
+        if (bus->telegramTxRxdExpanded.data[bus->sendEchoChecked] != bus->telegramToSendExpanded.data[bus->sendEchoChecked]) {
+            return false;
+        }
     }
-    return false;
+    return true;
 }
 
+// if, store slave response to our master request (TX). see EbusLink.onWire.
+void processBusCharTx(EbusLink* link, uint8_t value) {
+    Bus* bus = (Bus*)link->ctx;
+    Telegram* echo = &bus->telegramTxRxdExpanded;
+    if (value != 0xAA) {
+        bus->poll.wireBytes++;
+    } else if (bus->sendState == SENDWAITSYN) {
+        bus->sendSynSeen = true;
+    }
+    if (bus->sendState >= SENDDATA) {
+        if (echo->len+1 < sizeof(echo->data)) {
+            echo->data[echo->len++] = value;
+        }
+    }
+}
 
-Telegram telegramRxd;
-
-/**
- * CRC8 lookup table for the polynom 0x9b = x^8 + x^7 + x^4 + x^3 + x^1 + 1.
- */
-static const uint8_t CRC_LOOKUP_TABLE[] = {
-  0x00, 0x9b, 0xad, 0x36, 0xc1, 0x5a, 0x6c, 0xf7, 0x19, 0x82, 0xb4, 0x2f, 0xd8, 0x43, 0x75, 0xee,
-  0x32, 0xa9, 0x9f, 0x04, 0xf3, 0x68, 0x5e, 0xc5, 0x2b, 0xb0, 0x86, 0x1d, 0xea, 0x71, 0x47, 0xdc,
-  0x64, 0xff, 0xc9, 0x52, 0xa5, 0x3e, 0x08, 0x93, 0x7d, 0xe6, 0xd0, 0x4b, 0xbc, 0x27, 0x11, 0x8a,
-  0x56, 0xcd, 0xfb, 0x60, 0x97, 0x0c, 0x3a, 0xa1, 0x4f, 0xd4, 0xe2, 0x79, 0x8e, 0x15, 0x23, 0xb8,
-  0xc8, 0x53, 0x65, 0xfe, 0x09, 0x92, 0xa4, 0x3f, 0xd1, 0x4a, 0x7c, 0xe7, 0x10, 0x8b, 0xbd, 0x26,
-  0xfa, 0x61, 0x57, 0xcc, 0x3b, 0xa0, 0x96, 0x0d, 0xe3, 0x78, 0x4e, 0xd5, 0x22, 0xb9, 0x8f, 0x14,
-  0xac, 0x37, 0x01, 0x9a, 0x6d, 0xf6, 0xc0, 0x5b, 0xb5, 0x2e, 0x18, 0x83, 0x74, 0xef, 0xd9, 0x42,
-  0x9e, 0x05, 0x33, 0xa8, 0x5f, 0xc4, 0xf2, 0x69, 0x87, 0x1c, 0x2a, 0xb1, 0x46, 0xdd, 0xeb, 0x70,
-  0x0b, 0x90, 0xa6, 0x3d, 0xca, 0x51, 0x67, 0xfc, 0x12, 0x89, 0xbf, 0x24, 0xd3, 0x48, 0x7e, 0xe5,
-  0x39, 0xa2, 0x94, 0x0f, 0xf8, 0x63, 0x55, 0xce, 0x20, 0xbb, 0x8d, 0x16, 0xe1, 0x7a, 0x4c, 0xd7,
-  0x6f, 0xf4, 0xc2, 0x59, 0xae, 0x35, 0x03, 0x98, 0x76, 0xed, 0xdb, 0x40, 0xb7, 0x2c, 0x1a, 0x81,
-  0x5d, 0xc6, 0xf0, 0x6b, 0x9c, 0x07, 0x31, 0xaa, 0x44, 0xdf, 0xe9, 0x72, 0x85, 0x1e, 0x28, 0xb3,
-  0xc3, 0x58, 0x6e, 0xf5, 0x02, 0x99, 0xaf, 0x34, 0xda, 0x41, 0x77, 0xec, 0x1b, 0x80, 0xb6, 0x2d,
-  0xf1, 0x6a, 0x5c, 0xc7, 0x30, 0xab, 0x9d, 0x06, 0xe8, 0x73, 0x45, 0xde, 0x29, 0xb2, 0x84, 0x1f,
-  0xa7, 0x3c, 0x0a, 0x91, 0x66, 0xfd, 0xcb, 0x50, 0xbe, 0x25, 0x13, 0x88, 0x7f, 0xe4, 0xd2, 0x49,
-  0x95, 0x0e, 0x38, 0xa3, 0x54, 0xcf, 0xf9, 0x62, 0x8c, 0x17, 0x21, 0xba, 0x4d, 0xd6, 0xe0, 0x7b,
-};
 
-uint8_t calcEbusCrc(uint8_t* pStart, int len) {
-    uint8_t crc = 0x00;
-    uint8_t byte=0;
-    uint8_t inject=0xFF;
-    for (int i=0;i<len||inject!=0xFF;i++) {
-        byte = pStart[i];
-        // "the CRC is calculated over the EXPANDED byte transmission sequence"
-        if (inject!=0xFF) {
-            byte = inject;
-            inject = 0xFF;
-            i--;
+// from the command line: [name=]ip[:port]. returns 0 if there is no room or the name does not fit into a topic.
+Bus* busAdd(char* spec) {
+    char* eq = strchr(spec, '=');
+    char* colon;
+    if (busCount >= MAX_BUSES) {
+        printf("at most %d adapters\n", MAX_BUSES);
+        return 0;
+    }
+    Bus* bus = &buses[busCount];
+    memset(bus, 0, sizeof(*bus));
+    if (eq) {
+        *eq = 0;
+        if (eq == spec || eq-spec >= BUS_NAME_LEN || strpbrk(spec, "/+#")) {
+            printf("bus name %s: 1..%d characters, no / + #\n", spec, BUS_NAME_LEN-1);
+            return 0;
         }
-        if (byte == 0xAA) {
-            byte = 0xA9; 
-            inject = 0x01;
+        strcpy(bus->name, spec);
+        spec = eq+1;
+    }
+    bus->ip   = spec;
+    bus->port = ADAPTER_PORT;
+    if ((colon = strchr(spec, ':'))) {
+        bus->port = atoi(colon+1);
+        *colon = 0;
+    }
+    bus->sock  = -1;
+    bus->state = START;
+    bus->capture.fd = -1;
+    bus->poll.inFlight = -1;
+    bus->poll.backoff  = 1;
+    ebusLinkInit(&bus->link);
+    bus->link.onTelegram = processBusTelegramChecked;
+    bus->link.onWire     = processBusCharTx;
+    bus->link.onInfo     = processAdapterInfo;
+    bus->link.ctx        = bus;
+    busTopic(bus, bus->topicTx,      TOPIC_TX);
+    busTopic(bus, bus->topicRxd,     TOPIC_RXD);
+    busTopic(bus, bus->topicRxb,     TOPIC_RXB);
+    busTopic(bus, bus->topicRxf,     TOPIC_RXF);
+    busTopic(bus, bus->topicDecoded, TOPIC_DECODED);
+    busTopic(bus, bus->topicStats,   TOPIC_STATS);
+    busTopic(bus, bus->topicLatency, TOPIC_LATENCY);
+    busCount++;
+    return bus;
+}
+
+// several buses have to be told apart by their topics.
+bool busesValid() {
+    for (int i=0; i<busCount; i++) {
+        if (busCount > 1 && !buses[i].name[0]) {
+            printf("with several adapters, each one needs a name: -a name=ip[:port]\n");
+            return false;
         }
-        if (byte == 0xA9) {
-            byte = 0xA9; 
-            inject = 0x00;
+        for (int j=0; j<i; j++) {
+            if (strcmp(buses[i].name, buses[j].name) == 0) {
+                printf("bus name %s used twice\n", buses[i].name);
+                return false;
+            }
         }
-        crc = CRC_LOOKUP_TABLE[crc]^byte;
     }
-    return crc;
+    return true;
 }
 
-bool struct2json(struct Telegram* pTelegram,char* jsonstr, int maxLen, int* pLen);
 
-// received sth that looks like a valid telegram > report it.
-// received on bus -> to sent via mqtt
-void processBusTelegramChecked() {
-    if (struct2json(&telegramRxd,message_to_publish,sizeof(message_to_publish),0)) {
-        message_to_publish_valid = 1;
-    }
-}
-
-int telegramCountBad=0;
-int telegramCountOk=0;
-void bytes2hexstr(uint8_t* arr, int n, char* pStr, int maxlen);
-
-
-bool telegramCRCcheck(Telegram* telegram, bool slaveResponseNotMaster) {
-    int minlen,offset,crcoffset;
-    uint8_t NN,CRC,calcdCRC;
-    bool result=false;
-    // QQ ZZ XX XX NN    CRC
-    offset = 0;
-    minlen = 6;
-    crcoffset = 5;
-    NN = telegram->data[4]; 
-    if (telegram->len >= minlen) {
-        if (NN <= 16) {
-            CRC      = telegram->data[crcoffset+NN];
-            calcdCRC = calcEbusCrc(telegram->data+offset,crcoffset+NN-offset);
-            if (CRC == calcdCRC) {
-                result = true;
+// feeds capture files through processEnhBusChars, as if they came from the adapter.
+// at original pace (the gaps matter e.g. for timeouts) or, fast, as fast as possible to measure the framer.
+// published telegrams are not sent anywhere: verbose prints them (binary ones as hex), otherwise they are just counted.
+// note that suppression of unchanged telegrams uses the replay clock, so with fast it suppresses more than live.
+// a capture holds one bus, it is replayed as the given one (its topics, its caches).
+int replay(Bus* bus, char** files, int nfiles, bool fast, bool verbose) {
+    int64_t bytes=0, chunks=0, published=0;
+    mono_t start = monoNow();
+    for (int f=0; f<nfiles && run; f++) {
+        int fd = open(files[f], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < CAPTURE_HEADER_LEN) {
+            printf("could not open capture file %s\n", files[f]);
+            if (fd >= 0) close(fd);
+            return EXIT_FAILURE;
+        }
+        uint8_t* map = (uint8_t*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        uint32_t magic, version;
+        if (map == MAP_FAILED || (memcpy(&magic, map, 4), memcpy(&version, map+4, 4), magic != CAPTURE_MAGIC || version != CAPTURE_VERSION)) {
+            printf("%s is not a capture file (version %d)\n", files[f], CAPTURE_VERSION);
+            if (map != MAP_FAILED) munmap(map, st.st_size);
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        mono_t base = -1, replayBase = monoNow();
+        size_t pos = CAPTURE_HEADER_LEN;
+        while (run && pos + CAPTURE_RECORD_LEN <= (size_t)st.st_size) {
+            int64_t t;
+            uint32_t n;
+            memcpy(&t, map+pos, 8);
+            memcpy(&n, map+pos+8, 4);
+            if (n == 0 || pos + CAPTURE_RECORD_LEN + n > (size_t)st.st_size) {
+                break;
+            }
+            if (!fast) {
+                if (base < 0) base = t;
+                struct timespec due;
+                mono_t d = replayBase + (t - base);
+                due.tv_sec  = d / 1000000000LL;
+                due.tv_nsec = d % 1000000000LL;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, 0);
+                timerWheelAdvance(monoNow());
+            }
+            processEnhBusChars(&bus->link, map+pos+CAPTURE_RECORD_LEN, n);
+            bytes += n;
+            chunks++;
+            pos += CAPTURE_RECORD_LEN + n;
+            PublishSlot* slot;
+            while ((slot = publishQueueFront())) {
+                if (verbose) {
+                    if (strcmp(slot->topic, bus->topicRxb) == 0) {
+                        char hex[3*sizeof(slot->payload)+1];
+                        bytes2hexstr((uint8_t*)slot->payload, slot->len, hex, sizeof(hex));
+                        printf("%s %s\n", slot->topic, hex);
+                    } else {
+                        printf("%s %.*s\n", slot->topic, slot->len, slot->payload);
+                    }
+                }
+                published++;
+                publishQueuePop();
             }
         }
+        munmap(map, st.st_size);
+        close(fd);
+    }
+    double s = (monoNow()-start) / 1e9;
+    int64_t telegrams = bus->link.telegramCountOk+bus->link.telegramCountBad;
+    printf("replayed %lld bytes in %lld chunks, %lld telegrams, %lld published, in %.3f s\n", (long long)bytes, (long long)chunks, (long long)telegrams, (long long)published, s);
+    if (fast) {
+        printf("%.1f MB/s, %.0f telegrams/s, %.0f ns/telegram\n", bytes/s/1e6, telegrams/s, s*1e9/MAX(1,telegrams));
     }
-    // ACK NN   CRC    - only if slave response
-    if (result && slaveResponseNotMaster) {   
-        result = false;
-        offset = minlen+NN;
-        minlen = 3;
-        crcoffset = 2;
-        NN = telegram->data[offset+1];
-        if (NN <= 16) {
-            CRC      = telegram->data[offset+crcoffset+NN];
-            calcdCRC = calcEbusCrc(telegram->data+offset,crcoffset+NN);
-            if (CRC == calcdCRC) {
-                result = true;
+    return EXIT_SUCCESS;
+}
+
+
+
+int  metricsFd = -1;       // see metricsServe
+bool metricsReady = false;
+
+// the main loop sleeps here until the adapter or mqtt has something for us, or the next timer is due.
+// busy: there is work left over (e.g. a state change), so just have a look and return immediately.
+void eventWait(int epfd, int timerfd, bool busy) {
+    static mono_t armedDeadline = -1;
+    mono_t deadline = timerWheelNext();
+    struct epoll_event events[MAX_BUSES+3];
+    struct itimerspec its;
+    uint64_t expirations;
+    int n;
+    if (deadline != armedDeadline) {
+        memset(&its, 0, sizeof(its)); // all zero disarms
+        if (deadline >= 0) {
+            its.it_value.tv_sec  = deadline / 1000000000LL;
+            its.it_value.tv_nsec = deadline % 1000000000LL;
+            if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+        }
+        timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, 0);
+        armedDeadline = deadline;
+    }
+    n = epoll_wait(epfd, events, MAX_BUSES+3, busy ? 0 : -1);
+    for (int i=0; i<n; i++) {
+        if (events[i].data.fd == timerfd) {
+            read(timerfd, &expirations, sizeof(expirations)); //level triggered, so consume it.
+            armedDeadline = -1;
+        }
+        if (events[i].data.fd == metricsFd) {
+            metricsReady = true;
+        }
+        // only the adapters that have sth for us are read in this round
+        for (int b=0; b<busCount; b++) {
+            if (buses[b].sock >= 0 && events[i].data.fd == buses[b].sock) {
+                buses[b].ready = true;
             }
         }
     }
-    return result;
 }
 
-bool telegramIsPlausibleTx(Telegram* telegram) {
-    uint8_t QQ,NN;
-    QQ = telegram->data[0];
-    NN = telegram->data[4]; 
-    if (isMasterAddr(QQ)) {
-        if (telegramCRCcheck(telegram, false)) {
-            return (telegram->len == 6+NN);
+void epollAdd(int epfd, int fd, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = events;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void epollMod(int epfd, int fd, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = events;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+//////////////////////////
+// Polling
+
+// optional (-p file): registers that have to be asked for, polled from here instead of by a script publishing
+// on ebus/ll/tx, which can neither see how busy the bus is nor whether its last request is through. one per line:
+//   [bus] interval[ms] jitter[ms] QQ ZZ PB SB NN data...      e.g. 60000 5000 31 08 B5 14 05 05 40 03 FF FF
+// without crc, it is added here. the bus name only with several buses. # starts a comment.
+// the polls take the tx queue with the lowest priority and only when it is empty and the bus is idle, one at a time,
+// so they never hold up requests from mqtt. after each one there is a pause of POLL_GAP_MS. entry due again after
+// interval plus a random part of jitter, so that polls of the same interval drift apart.
+// every POLL_WINDOW_MS the bus utilisation (bytes on the bus at 2400 Bd, SYN not counted) and the arbitrations lost
+// are looked at: if one of them is high, or a poll failed, intervals and pauses are doubled (up to POLL_BACKOFF_MAX).
+// once things are calm again they go back step by step. the heat pump's own masters come first.
+#define POLL_PRIO            -1
+#define POLL_TTL_S           10
+#define POLL_GAP_MS         100   // between two polls, times backoff
+#define POLL_WINDOW_MS     5000
+#define POLL_BACKOFF_MAX     16
+#define POLL_LOAD_HIGH     0.50   // back off above
+#define POLL_LOAD_LOW      0.35   // speed up again below
+#define POLL_ARB_LOSS_HIGH 0.25   // share of the arbitrations lost in a window, back off above
+
+Bus* busByName(const char* name) {
+    for (int i=0; i<busCount; i++) {
+        if (strcmp(buses[i].name, name) == 0) {
+            return &buses[i];
         }
     }
-    return false;
+    return 0;
 }
 
-bool telegramIsPlausibleRx(Telegram* telegram) {
-    // this is a very minimalistic implementation, intentionally.
-    // we do NO checks here to be able to deal with bugs at next layer.
-    // exception: [auto-]SYNs with no content at all.
-    return (telegram->len > 1);
+bool isNumber(const char* s) {
+    char* end;
+    strtol(s, &end, 10);
+    return *s && !*end;
 }
 
-// received on bus between two SYNs
-void processBusTelegram() {
-    if (telegramIsPlausibleRx(&telegramRxd)) {    
-        processBusTelegramChecked();
-        telegramCountOk++;
-        return;
+// reads the poll file. false on any error, with the line.
+bool pollLoad(const char* path) {
+    char line[512];
+    int nr = 0;
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        printf("poll file %s: could not open\n", path);
+        return false;
     }
-    else if (telegramRxd.len>1) { 
-        char tmp[256];
-        bytes2hexstr(telegramRxd.data,telegramRxd.len, tmp,sizeof(tmp));
-        printf("ingoring bad telegram %s \n",tmp);
-        telegramCountBad++;
+    while (fgets(line, sizeof(line), f)) {
+        char* tok[3];
+        char* rest;
+        char* hash = strchr(line, '#');
+        int fields = busCount > 1 ? 3 : 2, n;
+        nr++;
+        if (hash) *hash = 0;
+        // the leading fields, the rest of the line is the telegram
+        for (n=0; n<fields && (tok[n] = strtok_r(n ? 0 : line, " \t\r\n", &rest)); n++);
+        if (n == 0) {
+            continue;
+        }
+        Bus* bus = n < fields ? 0 : busCount > 1 ? busByName(tok[0]) : &buses[0];
+        PollEntry* e = bus ? &bus->poll.entry[bus->poll.count] : 0;
+        bool ok = bus && bus->poll.count < POLL_MAX_ENTRIES && isNumber(tok[fields-2]) && isNumber(tok[fields-1]);
+        if (ok) {
+            memset(e, 0, sizeof(*e));
+            e->intervalMs = atoi(tok[fields-2]);
+            e->jitterMs   = atoi(tok[fields-1]);
+            int len = strlen(rest);
+            while (len > 0 && strchr(" \t\r\n", rest[len-1])) len--;
+            e->telegram.len = hexstr2bytes(rest, len, e->telegram.data, sizeof(e->telegram.data)-1);
+            ok = e->intervalMs > 0 && e->jitterMs >= 0 && e->telegram.len >= 5;
+        }
+        if (ok) {
+            e->telegram.data[e->telegram.len] = calcEbusCrc(e->telegram.data, e->telegram.len);
+            e->telegram.len++;
+            ok = telegramIsPlausibleTx(&e->telegram);
+        }
+        if (!ok) {
+            printf("poll file %s line %d: %sinterval[ms] jitter[ms] QQ ZZ PB SB NN data..., at most %d per bus\n", path, nr,
+                busCount > 1 ? "bus " : "", POLL_MAX_ENTRIES);
+            fclose(f);
+            return false;
+        }
+        bus->poll.count++;
     }
+    fclose(f);
+    return true;
 }
 
-
-Telegram telegramTxRxdExpanded; // echo of master request + slave response.
-Telegram telegramTxRxd;
-int arbitration_success;
-int arbitration_retries;
-
-// received on bus - like real uart
-void processBusChar(uint8_t value) {
-    static bool escaped=false;
-    bool isSYN;
-    // if, store slave response to our master request (TX). before escape handling.
-    if (sendState >= SENDDATA) {
-        if (telegramTxRxdExpanded.len+1 < sizeof(telegramTxRxdExpanded.data)) {
-            telegramTxRxdExpanded.data[telegramTxRxdExpanded.len++] = value;
+// end of a window: how busy was the bus, how did arbitration go. stretches or shrinks the poll intervals.
+void pollAdapt(Bus* bus) {
+    Poller* p = &bus->poll;
+    int won  = bus->metrics.arbitrationWon  - p->arbWon;
+    int lost = bus->metrics.arbitrationLost - p->arbLost;
+    p->load = (double)p->wireBytes / (BUS_BYTES_PER_S * POLL_WINDOW_MS / 1000.0);
+    if (p->load > POLL_LOAD_HIGH || (won+lost > 0 && (double)lost/(won+lost) > POLL_ARB_LOSS_HIGH) || p->failures > 0) {
+        if (p->backoff < POLL_BACKOFF_MAX) {
+            p->backoff = MIN(p->backoff*2, POLL_BACKOFF_MAX);
+            p->countBackoffs++;
+            printf("polling %s: bus load %.0f%%, %d of %d arbitrations lost, %d polls failed. backing off to x%d\n",
+                busLabel(bus), p->load*100, lost, won+lost, p->failures, p->backoff);
         }
+    } else if (p->load < POLL_LOAD_LOW && lost == 0 && p->backoff > 1) {
+        p->backoff--;
     }
-    isSYN = (value == 0xAA); //must be evaluated before escape char handling to distinguish real SYN from data AA.
-    // handle escape character
-    if (value==0xA9) {
-        escaped = true;
-        return;
-    }
-    else if (escaped) {
-        if(value == 0x00)       value = 0xA9;
-        else if (value==0x01)   value = 0xAA;
-        escaped = false;
-    }
+    p->wireBytes = 0;
+    p->failures  = 0;
+    p->arbWon    = bus->metrics.arbitrationWon;
+    p->arbLost   = bus->metrics.arbitrationLost;
+}
 
-    // store until SYN char, for receiving (RX)
-    if(telegramRxd.len >= sizeof(telegramRxd.data)) {
-        telegramRxd.len=0;
+// next poll into the tx queue, if one is due and the way is free. called on every round of the bus, in WORK.
+void pollStep(Bus* bus) {
+    Poller* p = &bus->poll;
+    mono_t now = monoNow();
+    if (p->count == 0) {
+        return;
     }
-    telegramRxd.data[telegramRxd.len++] = value;
-    if (isSYN) {
-        processBusTelegram();
-        telegramRxd.len = 0;
+    if (!p->window.armed) {
+        if (timerExpired(&p->window)) {
+            pollAdapt(bus);
+        }
+        timerStart(&p->window, MSEC(POLL_WINDOW_MS));
     }
-}
-
-// received on bus-enhanced-tcp.
-void processEnhBusChar(uint8_t value) {
-    static uint8_t enh1=0;
-    uint8_t enh2; uint8_t cccc;
-
-    if (value & 0x80) {   
-        if ((value&0xC0) == 0xC0) {  // first byte of a two-byte-char
-            enh1 = value;
+    bool idle = bus->sendState == SENDIDLE && txQueueDepth(&bus->txQueue) == 0;
+    if (p->inFlight >= 0) {
+        if (!idle) {
             return;
         }
-        if ((value&0xC0) == 0x80) {  // 2nc byte of a two-byte-char
-            enh2 = value;
-            value = ((enh1 & 0x3) << 6) | (enh2&0x3F);
-            cccc  = (enh1 & 0x3C)>>2;
-            //printf("%02x %02x %d\n", enh1, enh2, cccc);
-            if (cccc == 2) {        // 2 = Arbitration Success 
-                arbitration_success = 1;
-            }
-            if (cccc == 10) {        // 10 = Fail
-                arbitration_success = 0;
-            }
-            if (cccc != 0x1 && cccc != 0x2 && cccc != 10) {       // 1 = Received, ... ignore others.
-                printf("ignoring cccc %d\n",cccc);
-                return;
-            }
+        // through, one way or the other
+        if (bus->metrics.txFailed != p->txFailed) {
+            p->countFailed++;
+            p->failures++;
         }
+        p->inFlight = -1;
+        timerStart(&p->timer, MSEC(POLL_GAP_MS*p->backoff));
+        return;
+    }
+    if (p->timer.armed || !idle) {
+        return;
+    }
+    int next = 0;
+    for (int i=1; i<p->count; i++) {
+        if (p->entry[i].due < p->entry[next].due) {
+            next = i;
+        }
+    }
+    PollEntry* e = &p->entry[next];
+    if (e->due > now) {
+        timerStart(&p->timer, e->due - now);
+        return;
+    }
+    if (txQueuePut(&bus->txQueue, &e->telegram, POLL_PRIO, POLL_TTL_S)) {
+        p->inFlight = next;
+        p->txFailed = bus->metrics.txFailed;
+        p->countSent++;
     }
-    processBusChar(value);
+    e->due = now + MSEC((int64_t)e->intervalMs*p->backoff + (e->jitterMs ? rand() % (e->jitterMs+1) : 0));
 }
 
+
 // returns true if some bytes are prepared for tcp send
-bool charsPreparedTCP(char** payload, int* len) {
+bool charsPreparedTCP(Bus* bus, char** payload, int* len) {
     bool chars_to_send_valid = false;
     uint8_t QQ,ZZ,NN,AK;
-    static time_t tLastStateChange;
-    time_t tnow;
-    tnow = time(0);
     bool slaveCRCok=false;
 
-    TelegramSendState nextState=sendState;
-    switch(sendState) {
+    TelegramSendState nextState=bus->sendState;
+    switch(bus->sendState) {
         case SENDIDLE:
+            if (txQueueGet(&bus->txQueue, &bus->telegramToSend, &bus->telegramToSendQueued)) {
+                bus->sendOk = false;
+                nextState = SENDSTART;
+            }
             break;
         case SENDSTART: 
             //do some sanity checks, like for receiving.
-            if(telegramIsPlausibleTx(&telegramToSend)) {
-                telegramExpand(&telegramToSend,&telegramToSendExpanded);
-                telegramExpandEnhanced(&telegramToSendExpanded,&telegramToSendExpandedEnhanced);
-                telegramToSendExpandedEnhancedIndex=0;
-                arbitration_retries = 0;
+            if(telegramIsPlausibleTx(&bus->telegramToSend)) {
+                telegramExpand(&bus->telegramToSend,&bus->telegramToSendExpanded);
+                telegramExpandEnhanced(&bus->telegramToSendExpanded,&bus->telegramToSendExpandedEnhanced);
+                bus->telegramToSendExpandedEnhancedIndex=0;
+                bus->arbitration_retries = 0;
+                bus->arbitrationStart = monoNow();
                 nextState = ARBITRATION_INIT;
             }
             else {
                 printf("ignored, not a valid request telegram.\n");
                 nextState = FINISHED;
             }
-            break;
-        case ARBITRATION_INIT:
-            QQ = telegramToSend.data[0]; 
-            chars_to_send_bus[0] = 0xC0 | (0x02<<2) | ((QQ&0xC0)>>6);
-            chars_to_send_bus[1] = 0x80 | (QQ&0x3F);
-            chars_to_send_len = 2;  // wireshark: c8b1 ok.
+            break;
+        case ARBITRATION_INIT:
+            if (bus->sendDelay.armed) {
+                break; // held back, see below
+            }
+            if (SCHED_ARBITRATION) {
+                mono_t now = monoNow();
+                mono_t wait = schedIdleIn(&bus->schedule, now, (bus->telegramToSendExpanded.len + SCHED_RESPONSE_GUESS) * BUS_BYTE_NS);
+                if (wait > 0 && now + wait - bus->arbitrationStart <= MSEC(SCHED_MAX_DEFER_MS)) {
+                    bus->metrics.arbitrationDeferred++;
+                    timerStart(&bus->sendDelay, wait);
+                    break;
+                }
+            }
+            QQ = bus->telegramToSend.data[0]; 
+            bus->chars_to_send_bus[0] = 0xC0 | (0x02<<2) | ((QQ&0xC0)>>6);
+            bus->chars_to_send_bus[1] = 0x80 | (QQ&0x3F);
+            bus->chars_to_send_len = 2;  // wireshark: c8b1 ok.
             chars_to_send_valid = true;
-            arbitration_success = -1;
-            memset(&telegramTxRxdExpanded,0,sizeof(telegramTxRxdExpanded));
-            telegramTxRxdExpanded.data[telegramTxRxdExpanded.len++] = telegramToSendExpanded.data[0];
+            bus->link.arbitration_success = -1;
+            memset(&bus->telegramTxRxdExpanded,0,sizeof(bus->telegramTxRxdExpanded));
+            bus->telegramTxRxdExpanded.data[bus->telegramTxRxdExpanded.len++] = bus->telegramToSendExpanded.data[0];
             nextState = ARBITRATION_AWAIT;
             break;
         case ARBITRATION_AWAIT:
-            if (arbitration_success == 1) {
-                    telegramTxRxdExpanded.len = 1;
+            if (bus->link.arbitration_success == 1) {
+                    bus->metrics.arbitrationWon++;
+                    bus->telegramTxRxdExpanded.len = 1;
+                    bus->sendEchoChecked = 1;
+                    bus->telegramOwn = bus->telegramToSend;
+                    bus->telegramOwnPending = true;
                     nextState = SENDDATA;
             }
-            else if (arbitration_success == 0 && difftime(tnow,tLastStateChange)>0.1) {
-                printf("arbitration failed %d.\n",arbitration_retries); // and let >100ms pass before retry.
-                if (arbitration_retries < 3) {   // allow max 3 attempts (2 retries)
-                    arbitration_retries++;
+            else if (bus->link.arbitration_success == 0 && timerExpired(&bus->sendDelay)) {
+                printf("arbitration failed %d.\n",bus->arbitration_retries); // and let some time pass before retry.
+                bus->metrics.arbitrationLost++;
+                if (bus->arbitration_retries < 3) {   // allow max 3 attempts (2 retries)
+                    bus->arbitration_retries++;
+                    bus->metrics.arbitrationRetries++;
                     nextState = ARBITRATION_INIT;
                 } else {
                     nextState = FINISHED;
                 }
-            }else if (difftime(tnow,tLastStateChange)>1.0) {
+            }else if (timerExpired(&bus->sendTimeout)) {
                 printf("arbitration adapter timeout?\n");
+                bus->metrics.arbitrationTimeouts++;
                 nextState = FINISHED;
             }
             break;
         case SENDDATA:
-            if (difftime(tnow,tLastStateChange)>1.0) {
+            if (!sendEchoMatches(bus)) {
+                // what the adapter has buffered already can not be recalled. we do not send ACK or SYN at least,
+                // and with pipelined send no new arbitration before it is out and the bus is free again.
+                printf("send data echo mismatch at byte %d, collision?\n", bus->sendEchoChecked);
+                bus->sendCountEchoMismatch++;
+                nextState = sendPipelined && bus->telegramToSendExpandedEnhancedIndex ? SENDWAITSYN : FINISHED;
+            } else if (timerExpired(&bus->sendTimeout)) {
                 printf("send data loopback timeout?\n");
+                bus->metrics.echoTimeouts++;
                 nextState = FINISHED;
-            } else 
-            // ebus adapter (at least with Build 20250615) does only accept one character at a time.
-            // we need to wait for receiving every single byte back before sending the next one. 
-            // you would not call this efficient, at least not if tunneled over TCP, but it is ok for occasional usage.
-            // memcpy(chars_to_send_bus, &telegramToSendExpandedEnhanced.data[1], telegramToSendExpandedEnhanced.len-1);
-            // chars_to_send_len = telegramToSendExpandedEnhanced.len-1;
-            if (telegramToSendExpandedEnhancedIndex == 0) {
-                telegramToSendExpandedEnhancedIndex = 2;
-            }else if(telegramToSendExpandedEnhancedIndex < telegramToSendExpandedEnhanced.len) {
-                // only send once received the last one.
-                if (telegramTxRxdExpanded.len*2 >= telegramToSendExpandedEnhancedIndex) {
-                    chars_to_send_bus[0] = telegramToSendExpandedEnhanced.data[telegramToSendExpandedEnhancedIndex++];
-                    chars_to_send_bus[1] = telegramToSendExpandedEnhanced.data[telegramToSendExpandedEnhancedIndex++];
-                    chars_to_send_len = 2;
+            } else if (bus->telegramToSendExpandedEnhancedIndex == 0 && sendPipelined) {
+                // the adapter buffers: everything but QQ (already out, with the arbitration) in one go.
+                // the echo is checked as it comes in.
+                bus->chars_to_send_len = bus->telegramToSendExpandedEnhanced.len - 2;
+                memcpy(bus->chars_to_send_bus, &bus->telegramToSendExpandedEnhanced.data[2], bus->chars_to_send_len);
+                chars_to_send_valid = true;
+                bus->telegramToSendExpandedEnhancedIndex = bus->telegramToSendExpandedEnhanced.len;
+                bus->sendCountPipelined++;
+            } else if (bus->telegramToSendExpandedEnhancedIndex < bus->telegramToSendExpandedEnhanced.len) {
+                if (bus->telegramToSendExpandedEnhancedIndex == 0) {
+                    bus->telegramToSendExpandedEnhancedIndex = 2; // QQ is already out, with the arbitration.
+                }
+                // one symbol at a time (see AdapterInfo): only send once received the last one.
+                if (bus->telegramTxRxdExpanded.len*2 >= bus->telegramToSendExpandedEnhancedIndex) {
+                    bus->chars_to_send_bus[0] = bus->telegramToSendExpandedEnhanced.data[bus->telegramToSendExpandedEnhancedIndex++];
+                    bus->chars_to_send_bus[1] = bus->telegramToSendExpandedEnhanced.data[bus->telegramToSendExpandedEnhancedIndex++];
+                    bus->chars_to_send_len = 2;
                     chars_to_send_valid = true;
                 }
-            }
-            else {
-                nextState = AWAITACK;
+            } else if (bus->telegramTxRxdExpanded.len >= bus->telegramToSendExpanded.len) {
+                nextState = AWAITACK; // whole request echoed, and it was ours
             }
             break;
         case AWAITACK:
-            ZZ = telegramToSend.data[1];
+            ZZ = bus->telegramToSend.data[1];
             if (ZZ == 0xFE) { // no ack or repsonse on broadcasts
-                if (difftime(tnow,tLastStateChange)>0.01) {
+                if (timerExpired(&bus->sendDelay)) {
+                    bus->sendOk = true;
                     nextState = SENDSYN;
                 }
             }
-            else if (telegramTxRxdExpanded.len >= telegramToSendExpanded.len + 1) {
-                AK = telegramTxRxdExpanded.data[telegramToSendExpanded.len];
+            else if (bus->telegramTxRxdExpanded.len >= bus->telegramToSendExpanded.len + 1) {
+                AK = bus->telegramTxRxdExpanded.data[bus->telegramToSendExpanded.len];
                 if (AK == 0x00) { //ACK
                     nextState = AWAITRESPONSE;
                 } else if (AK == 0xFF) { //NAK
                     //retry not implemented.
+                    bus->metrics.naks++;
                     nextState = SENDSYN;
                 } else {
                     nextState = SENDSYN;
                 }
             }
-            else if (difftime(tnow,tLastStateChange)>1.0) {
+            else if (timerExpired(&bus->sendTimeout)) {
                 printf("ack timeout.\n");
+                bus->metrics.ackTimeouts++;
                 nextState = FINISHED;
             }
             break;
         case AWAITRESPONSE:
-            ZZ = telegramToSend.data[1];
-            NN = telegramTxRxdExpanded.data[telegramToSendExpanded.len+1];
+            ZZ = bus->telegramToSend.data[1];
+            NN = bus->telegramTxRxdExpanded.data[bus->telegramToSendExpanded.len+1];
             if (isMasterAddr(ZZ)) { // no content expected
+                bus->sendOk = true;
                 nextState = SENDSYN;
-            } else if (telegramTxRxdExpanded.len >= telegramToSendExpanded.len+3 && NN <= 16 && telegramTxRxdExpanded.len >= telegramToSendExpanded.len+3+NN) {
+            } else if (bus->telegramTxRxdExpanded.len >= bus->telegramToSendExpanded.len+3 && NN <= 16 && bus->telegramTxRxdExpanded.len >= bus->telegramToSendExpanded.len+3+NN) {
                 nextState = SENDACK;
-            } else if (difftime(tnow,tLastStateChange)>1.0) {
+            } else if (timerExpired(&bus->sendTimeout)) {
                 printf("response timeout.\n");
+                bus->metrics.responseTimeouts++;
                 nextState = FINISHED;
             }
             break;
         case SENDACK:
-            telegramDeflate(&telegramTxRxdExpanded,&telegramTxRxd);
-            slaveCRCok = telegramCRCcheck(&telegramTxRxd,true);
+            telegramDeflate(&bus->telegramTxRxdExpanded,&bus->telegramTxRxd);
+            slaveCRCok = telegramCRCcheck(&bus->telegramTxRxd,true);
             if (slaveCRCok) {//00
-                chars_to_send_bus[0] = 0xC4; 
-                chars_to_send_bus[1] = 0x80;
-                chars_to_send_len = 2;
+                bus->chars_to_send_bus[0] = 0xC4; 
+                bus->chars_to_send_bus[1] = 0x80;
+                bus->chars_to_send_len = 2;
             }else { //FF
-                chars_to_send_bus[0] = 0xC7; 
-                chars_to_send_bus[1] = 0xBF;
-                chars_to_send_len = 2;
+                bus->chars_to_send_bus[0] = 0xC7; 
+                bus->chars_to_send_bus[1] = 0xBF;
+                bus->chars_to_send_len = 2;
             }
             chars_to_send_valid = true;
             if (slaveCRCok) {
+                if (RESP_CACHE) {
+                    int reqLen = bus->telegramToSend.len;
+                    respCachePut(&bus->respCache, &bus->telegramToSend.data[1], reqLen-2, &bus->telegramTxRxd.data[reqLen+1],
+                        2 + bus->telegramTxRxd.data[reqLen+1], monoNow());
+                }
+                bus->sendOk = true;
                 nextState = SENDSYN;
             } else {
                 // retry not implemented
@@ -611,72 +2488,681 @@ bool charsPreparedTCP(char** payload, int* len) {
             break;
         case SENDSYN:
             //AA
-            chars_to_send_bus[0] = 0xC6; 
-            chars_to_send_bus[1] = 0xAA;
-            chars_to_send_len = 2;
+            bus->chars_to_send_bus[0] = 0xC6; 
+            bus->chars_to_send_bus[1] = 0xAA;
+            bus->chars_to_send_len = 2;
             chars_to_send_valid = true;
             nextState = FINISHED;
             break;
+        case SENDWAITSYN:
+            if (bus->sendSynSeen) {
+                nextState = FINISHED;
+            } else if (timerExpired(&bus->sendTimeout)) {
+                printf("no SYN after echo mismatch.\n");
+                nextState = FINISHED;
+            }
+            break;
         case FINISHED:
-            printf("sending telegram finished, successful or not.\n");
+            printf("sending telegram finished, %s.\n", bus->sendOk ? "successful" : "failed");
+            if (bus->sendOk) {
+                bus->metrics.txCompleted++;
+                histRecord(&bus->metrics.txLatency, (monoNow() - bus->telegramToSendQueued)/1000);
+            } else {
+                bus->metrics.txFailed++;
+            }
             nextState = SENDIDLE;
             break;
         default:
         break;
     }
 
-    if (nextState != sendState) {
-        sendState = nextState;
-        tLastStateChange = tnow;
+    if (nextState != bus->sendState) {
+        bus->sendState = nextState;
+        sendStateTimersStart(bus);
     }
 
     if (chars_to_send_valid) {
-        *payload = (char*)chars_to_send_bus;
-        *len     = chars_to_send_len;
+        *payload = (char*)bus->chars_to_send_bus;
+        *len     = bus->chars_to_send_len;
     }
     return chars_to_send_valid;
 }
 
 
 
-int main(int argc, char *argv[]) {
-    State state = START, nextState=START;
-    time_t tLastStateChange, tnow;
-    tLastStateChange = tnow = time(0);
+// the connection to the adapter is gone: a request on its way fails (see FINISHED), nothing of it may go out on the
+// next connection, and a telegram received in part is dropped.
+void busSessionReset(Bus* bus) {
+    if (bus->sendState != SENDIDLE) {
+        printf("sending telegram %s, connection to the adapter lost.\n", bus->sendOk ? "finished" : "aborted");
+        if (bus->sendOk) {
+            bus->metrics.txCompleted++;
+            histRecord(&bus->metrics.txLatency, (monoNow() - bus->telegramToSendQueued)/1000);
+        } else {
+            bus->metrics.txFailed++;
+        }
+        bus->sendState = SENDIDLE;
+    }
+    bus->telegramOwnPending = false;
+    timerStop(&bus->sendTimeout);
+    timerStop(&bus->sendDelay);
+    bus->rxRing.head = bus->rxRing.tail = 0; // stale bytes of the old connection.
+    ebusLinkReset(&bus->link);
+}
+
+void busStatistics(Bus* bus) {
+    EbusLink* link = &bus->link;
+    printf("statistics of %s%s%s:%d\n", bus->name, bus->name[0] ? " " : "", bus->ip, bus->port);
+    printf("statistics: received %llu half-plausible and %llu erronous telegrams\n",(unsigned long long)link->telegramCountOk, (unsigned long long)link->telegramCountBad);
+    printf("statistics: %d adapter reads, %.2f per telegram\n",bus->rxRing.reads, (double)bus->rxRing.reads/MAX(1,link->telegramCountOk+link->telegramCountBad));
+    printf("statistics: tx requests %llu rejected (queue full), %llu expired, %d duplicates\n",(unsigned long long)bus->txQueue.countFull, (unsigned long long)bus->txQueue.countStale, bus->txQueue.countDuplicate);
+    printf("statistics: %d requests sent pipelined, %llu aborted on echo mismatch\n",bus->sendCountPipelined, (unsigned long long)bus->sendCountEchoMismatch);
+    printf("statistics: tx %llu completed, %llu failed, arbitration %llu won, %llu lost, %llu retries, %llu deferred\n",(unsigned long long)bus->metrics.txCompleted, (unsigned long long)bus->metrics.txFailed,
+        (unsigned long long)bus->metrics.arbitrationWon, (unsigned long long)bus->metrics.arbitrationLost, (unsigned long long)bus->metrics.arbitrationRetries, (unsigned long long)bus->metrics.arbitrationDeferred);
+    printf("statistics: %d periodic registers predicted, %d replaced in the schedule\n", schedPredicted(&bus->schedule, monoNow()), bus->schedule.countReplaced);
+    printf("statistics: %d telegrams forwarded, %d suppressed as unchanged, %d registers evicted from cache\n",bus->suppress.countForwarded, bus->suppress.countSuppressed, bus->suppress.countEvicted);
+    if (bus->capture.path[0]) {
+        printf("statistics: capture at %zu of %d bytes, %d rotations\n", bus->capture.pos, CAPTURE_FILE_SIZE, bus->capture.rotations);
+    }
+    printf("statistics: response cache %llu hits, %llu misses, %d answers stored, %d dropped after writes\n", (unsigned long long)bus->respCache.countHits,
+        (unsigned long long)bus->respCache.countMisses, bus->respCache.countStored, bus->respCache.countDropped);
+    if (bus->poll.count) {
+        printf("statistics: %llu polls sent, %llu failed, %d back-offs, now x%d at %.0f%% bus load\n", (unsigned long long)bus->poll.countSent, (unsigned long long)bus->poll.countFailed,
+            bus->poll.countBackoffs, bus->poll.backoff, bus->poll.load*100);
+    }
+    if (bus->archive.dir[0]) {
+        printf("statistics: archive %s, %d days started, %d telegrams dropped\n", bus->archive.path, bus->archive.countDays, bus->archive.countDropped);
+    }
+}
+
+// the counters of a bus, for TOPIC_STATS (json) and prometheus (prom, with ebusll_ and _total).
+struct BusCounter {
+    const char* json;
+    const char* prom;
+    const char* help;
+};
+static const BusCounter busCounterNames[] = {
+    { "telegrams",        "telegrams",            "telegrams received" },
+    { "bad",              "bad_frames",           "bytes between two SYNs too short for a telegram" },
+    { "crcErrors",        "crc_errors",           "telegrams with bad master or slave crc" },
+    { "arbWon",           "arbitration_won",      "arbitrations won" },
+    { "arbLost",          "arbitration_lost",     "arbitrations lost" },
+    { "arbRetries",       "arbitration_retries",  "arbitrations repeated after a loss" },
+    { "arbTimeouts",      "arbitration_timeouts", "arbitrations not answered by the adapter" },
+    { "arbDeferred",      "arbitration_deferred", "arbitrations held back for a predicted telegram" },
+    { "echoTimeouts",     "echo_timeouts",        "requests not echoed in time" },
+    { "echoMismatches",   "echo_mismatches",      "requests aborted on echo mismatch" },
+    { "ackTimeouts",      "ack_timeouts",         "requests without ACK from the slave" },
+    { "responseTimeouts", "response_timeouts",    "requests without complete slave response" },
+    { "naks",             "naks",                 "requests answered with NAK" },
+    { "txCompleted",      "tx_completed",         "requests sent successfully" },
+    { "txFailed",         "tx_failed",            "requests sent without success" },
+    { "txRejected",       "tx_rejected",          "requests rejected, tx queue full" },
+    { "txExpired",        "tx_expired",           "requests expired in the tx queue" },
+    { "adapterReconnects", "adapter_reconnects",  "connections to the adapter lost or failed" },
+    { "cacheHits",        "cache_hits",           "requests answered from the response cache" },
+    { "cacheMisses",      "cache_misses",         "requests that had to go to the bus" },
+    { "polls",            "polls",                "requests sent by the poll scheduler" },
+    { "pollsFailed",      "polls_failed",         "polls sent without success" },
+};
+#define BUS_COUNTERS ((int)(sizeof(busCounterNames)/sizeof(busCounterNames[0])))
+
+void busCounters(Bus* bus, uint64_t* v) {
+    int i = 0;
+    v[i++] = bus->link.telegramCountOk;
+    v[i++] = bus->link.telegramCountBad;
+    v[i++] = bus->metrics.crcErrors;
+    v[i++] = bus->metrics.arbitrationWon;
+    v[i++] = bus->metrics.arbitrationLost;
+    v[i++] = bus->metrics.arbitrationRetries;
+    v[i++] = bus->metrics.arbitrationTimeouts;
+    v[i++] = bus->metrics.arbitrationDeferred;
+    v[i++] = bus->metrics.echoTimeouts;
+    v[i++] = bus->sendCountEchoMismatch;
+    v[i++] = bus->metrics.ackTimeouts;
+    v[i++] = bus->metrics.responseTimeouts;
+    v[i++] = bus->metrics.naks;
+    v[i++] = bus->metrics.txCompleted;
+    v[i++] = bus->metrics.txFailed;
+    v[i++] = bus->txQueue.countFull;
+    v[i++] = bus->txQueue.countStale;
+    v[i++] = bus->metrics.reconnects;
+    v[i++] = bus->respCache.countHits;
+    v[i++] = bus->respCache.countMisses;
+    v[i++] = bus->poll.countSent;
+    v[i++] = bus->poll.countFailed;
+}
+
+// share of the arbitrations won, all time. 1 before the first one.
+double arbitrationSuccess(Bus* bus) {
+    uint64_t n = bus->metrics.arbitrationWon + bus->metrics.arbitrationLost;
+    return n ? (double)bus->metrics.arbitrationWon / n : 1.0;
+}
+
+// TOPIC_STATS, e.g. {"telegrams":1234,...,"txQueue":0,"busLoad":0.212,...}. counters all time, gauges as of now.
+// fits into a publish slot with every counter at its maximum (20 digits), see statsPublish.
+bool busStatsJson(Bus* bus, char* buf, int size, int* len) {
+    uint64_t v[BUS_COUNTERS];
+    bool ok = true;
+    busCounters(bus, v);
+    *len = 0;
+    for (int i=0; i<BUS_COUNTERS; i++) {
+        ok &= bufPrintf(buf, size, len, "%s\"%s\":%llu", i ? "," : "{", busCounterNames[i].json, (unsigned long long)v[i]);
+    }
+    ok &= bufPrintf(buf, size, len, ",\"txQueue\":%d,\"busLoad\":%.3f,\"pollBackoff\":%d,\"arbSuccess\":%.3f,\"predicted\":%d}",
+        txQueueDepth(&bus->txQueue), bus->poll.load, bus->poll.backoff, arbitrationSuccess(bus), schedPredicted(&bus->schedule, monoNow()));
+    return ok;
+}
+
+// TOPIC_LATENCY, e.g. {"txMs":{"n":3,"p50":98.5,...},"idleGapMs":{...},"mqtt":{"published":...,"rxToPublishMs":{...}}}
+// latencies of the last interval. mqtt is the same for all buses, there is one broker connection.
+bool busLatencyJson(Bus* bus, char* buf, int size, int* len) {
+    bool ok = true;
+    *len = 0;
+    ok &= bufPrintf(buf, size, len, "{\"txMs\":");
+    ok &= histJson(&bus->metrics.txLatency, buf, size, len);
+    ok &= bufPrintf(buf, size, len, ",\"idleGapMs\":");
+    ok &= histJson(&bus->metrics.idleGap, buf, size, len);
+    ok &= bufPrintf(buf, size, len, ",\"mqtt\":{\"published\":%llu,\"failed\":%llu,\"unconfirmed\":%llu,\"dropped\":%llu,\"reconnects\":%llu,\"rxToPublishMs\":",
+        (unsigned long long)publisher.published.load(), (unsigned long long)publisher.failed.load(), (unsigned long long)publisher.timedout.load(),
+        (unsigned long long)publishQueue.dropped, (unsigned long long)publisher.reconnects);
+    std::lock_guard<std::mutex> lock(publisher.statsLock);
+    ok &= histJson(&publisher.rxToPublish, buf, size, len);
+    ok &= bufPrintf(buf, size, len, ",\"publishMs\":");
+    ok &= histJson(&publisher.publishDuration, buf, size, len);
+    ok &= bufPrintf(buf, size, len, "}}");
+    return ok;
+}
+
+// every STATS_INTERVAL_S, two messages per bus. then the latencies start over.
+void statsPublish() {
+    PublishSlot* slot;
+    for (int i=0; i<busCount; i++) {
+        if ((slot = publishSlotAlloc(&buses[i], buses[i].topicStats, 0, 0))) {
+            if (busStatsJson(&buses[i], slot->payload, sizeof(slot->payload), &slot->len)) {
+                publishSlotPush(slot);
+            } else {
+                printf("%s: stats do not fit into a message, not published\n", busLabel(&buses[i]));
+            }
+        }
+        if ((slot = publishSlotAlloc(&buses[i], buses[i].topicLatency, 0, 0))) {
+            if (busLatencyJson(&buses[i], slot->payload, sizeof(slot->payload), &slot->len)) {
+                publishSlotPush(slot);
+            } else {
+                printf("%s: latencies do not fit into a message, not published\n", busLabel(&buses[i]));
+            }
+        }
+        histReset(&buses[i].metrics.txLatency);
+        histReset(&buses[i].metrics.idleGap);
+    }
+    std::lock_guard<std::mutex> lock(publisher.statsLock);
+    histReset(&publisher.rxToPublish);
+    histReset(&publisher.publishDuration);
+}
+
+// the same in prometheus text format. quantiles (as summaries) of the current interval.
+#define METRICS_TEXT_LEN        (64*1024)
+#define METRICS_IO_TIMEOUT_MS   100  // a client that does not send its request or read the answer
+int metricsText(char* buf, int size) {
+    int len = 0;
+    uint64_t v[MAX_BUSES][BUS_COUNTERS];
+    char labels[MAX_BUSES][BUS_NAME_LEN+32];
+    for (int b=0; b<busCount; b++) {
+        busCounters(&buses[b], v[b]);
+        snprintf(labels[b], sizeof(labels[b]), "bus=\"%.*s\"", BUS_NAME_LEN, busLabel(&buses[b]));
+    }
+    for (int i=0; i<BUS_COUNTERS; i++) {
+        bufPrintf(buf, size, &len, "# HELP ebusll_%s_total %s\n# TYPE ebusll_%s_total counter\n", busCounterNames[i].prom, busCounterNames[i].help, busCounterNames[i].prom);
+        for (int b=0; b<busCount; b++) {
+            bufPrintf(buf, size, &len, "ebusll_%s_total{%s} %llu\n", busCounterNames[i].prom, labels[b], (unsigned long long)v[b][i]);
+        }
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_tx_queue_depth requests waiting to be sent\n# TYPE ebusll_tx_queue_depth gauge\n");
+    for (int b=0; b<busCount; b++) {
+        bufPrintf(buf, size, &len, "ebusll_tx_queue_depth{%s} %d\n", labels[b], txQueueDepth(&buses[b].txQueue));
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_bus_load share of the bus in use, last poll window\n# TYPE ebusll_bus_load gauge\n");
+    for (int b=0; b<busCount; b++) {
+        bufPrintf(buf, size, &len, "ebusll_bus_load{%s} %.3f\n", labels[b], buses[b].poll.load);
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_poll_backoff factor the poll intervals are stretched by\n# TYPE ebusll_poll_backoff gauge\n");
+    for (int b=0; b<busCount; b++) {
+        bufPrintf(buf, size, &len, "ebusll_poll_backoff{%s} %d\n", labels[b], buses[b].poll.backoff);
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_tx_seconds tx request queued until completed\n# TYPE ebusll_tx_seconds summary\n");
+    for (int b=0; b<busCount; b++) {
+        histPrometheus(&buses[b].metrics.txLatency, "ebusll_tx_seconds", labels[b], buf, size, &len);
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_idle_gap_seconds time between two telegrams, only SYN on the bus\n# TYPE ebusll_idle_gap_seconds summary\n");
+    for (int b=0; b<busCount; b++) {
+        histPrometheus(&buses[b].metrics.idleGap, "ebusll_idle_gap_seconds", labels[b], buf, size, &len);
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_arbitration_success_ratio share of the arbitrations won\n# TYPE ebusll_arbitration_success_ratio gauge\n");
+    for (int b=0; b<busCount; b++) {
+        bufPrintf(buf, size, &len, "ebusll_arbitration_success_ratio{%s} %.3f\n", labels[b], arbitrationSuccess(&buses[b]));
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_predicted_registers periodic registers arbitration keeps clear of\n# TYPE ebusll_predicted_registers gauge\n");
+    for (int b=0; b<busCount; b++) {
+        bufPrintf(buf, size, &len, "ebusll_predicted_registers{%s} %d\n", labels[b], schedPredicted(&buses[b].schedule, monoNow()));
+    }
+    bufPrintf(buf, size, &len, "# HELP ebusll_published_total mqtt messages published\n# TYPE ebusll_published_total counter\nebusll_published_total %llu\n", (unsigned long long)publisher.published.load());
+    bufPrintf(buf, size, &len, "# HELP ebusll_publish_failures_total mqtt messages failed, unconfirmed or dropped (queue full)\n# TYPE ebusll_publish_failures_total counter\n");
+    bufPrintf(buf, size, &len, "ebusll_publish_failures_total{reason=\"failed\"} %llu\nebusll_publish_failures_total{reason=\"unconfirmed\"} %llu\nebusll_publish_failures_total{reason=\"dropped\"} %llu\n",
+        (unsigned long long)publisher.failed.load(), (unsigned long long)publisher.timedout.load(), (unsigned long long)publishQueue.dropped);
+    bufPrintf(buf, size, &len, "# HELP ebusll_mqtt_reconnects_total connections to the broker lost or failed\n# TYPE ebusll_mqtt_reconnects_total counter\nebusll_mqtt_reconnects_total %llu\n", (unsigned long long)publisher.reconnects);
+    std::lock_guard<std::mutex> lock(publisher.statsLock);
+    bufPrintf(buf, size, &len, "# HELP ebusll_rx_to_publish_seconds bytes read from the adapter until published\n# TYPE ebusll_rx_to_publish_seconds summary\n");
+    histPrometheus(&publisher.rxToPublish, "ebusll_rx_to_publish_seconds", "", buf, size, &len);
+    bufPrintf(buf, size, &len, "# HELP ebusll_publish_seconds duration of a publish call\n# TYPE ebusll_publish_seconds summary\n");
+    histPrometheus(&publisher.publishDuration, "ebusll_publish_seconds", "", buf, size, &len);
+    return len;
+}
+
+// -m: a tiny http server for the prometheus scraper, on the main loop. whatever the request, the answer is metricsText,
+// except for GET /ts?..., a time series query (see tsServeHttp).
+// local only (127.0.0.1) and one connection at a time, short timeouts so that a client can not hold up the buses.
+int metricsListen(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        printf("could not listen on 127.0.0.1:%d for metrics\n", port);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void metricsServe(int listenfd) {
+    static char text[METRICS_TEXT_LEN];
+    char request[1024], header[128];
+    struct timeval tv = { 0, METRICS_IO_TIMEOUT_MS*1000 };
+    struct iovec iov[2];
+    int fd;
+    while ((fd = accept(listenfd, 0, 0)) >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        int n = read(fd, request, sizeof(request)-1); // read before closing, otherwise the client may get a reset instead of the answer
+        request[MAX(n, 0)] = 0;
+        if (strncmp(request, "GET /ts", 7) == 0) {
+            tsServeHttp(fd, request+7);
+            close(fd);
+            continue;
+        }
+        iov[1].iov_base = text;
+        iov[1].iov_len  = metricsText(text, sizeof(text));
+        iov[0].iov_base = header;
+        iov[0].iov_len  = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", iov[1].iov_len);
+        writev(fd, iov, 2);
+        close(fd);
+    }
+}
+
+// the trace rings as chrome trace json: main and publisher thread, instants for read/SYN/enqueue, slices for the
+// publish calls. oldest first per thread. the publisher goes on meanwhile, an event it overwrites during the dump may
+// come out garbled, good enough for what it is for.
+void traceDumpRing(FILE* f, TraceRing* ring, int tid) {
+    static const char* names[] = { "read", "telegram", "enqueue", "publish", "publish" };
+    unsigned int head = ring->head.load(std::memory_order_acquire);
+    unsigned int i = head > TRACE_RING_LEN ? head - TRACE_RING_LEN : 0;
+    for (; i != head; i++) {
+        TraceEvent e = ring->ev[i & (TRACE_RING_LEN-1)];
+        const char* bus = e.bus < busCount ? busLabel(&buses[e.bus]) : "";
+        fprintf(f, ",\n{\"name\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,", e.type < 5 ? names[e.type] : "?", e.t/1e3, tid);
+        switch (e.type) {
+            case TRACE_READ:          fprintf(f, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"bus\":\"%s\",\"bytes\":%u}}", bus, e.id); break;
+            case TRACE_SYN:           fprintf(f, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"bus\":\"%s\",\"id\":%u,\"len\":%d}}", bus, e.id, e.arg); break;
+            case TRACE_ENQUEUE:       fprintf(f, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"bus\":\"%s\",\"id\":%u,\"queued\":%d}}", bus, e.id, e.arg); break;
+            case TRACE_PUBLISH_BEGIN: fprintf(f, "\"ph\":\"B\",\"args\":{\"bus\":\"%s\",\"id\":%u,\"queued\":%d}}", bus, e.id, e.arg); break;
+            default:                  fprintf(f, "\"ph\":\"E\",\"args\":{\"rc\":%d}}", e.arg); break;
+        }
+    }
+}
 
-    char* rcvdTopicName;
-    int   rcvdTopicLen;
-    MQTTClient_message* rcvdMessage;
+bool traceDump(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        printf("could not write trace to %s\n", path);
+        return false;
+    }
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}},\n");
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"publisher\"}}");
+    traceDumpRing(f, &traceMain, 1);
+    traceDumpRing(f, &tracePublisher, 2);
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    bool ok = (fclose(f) == 0);
+    printf("trace written to %s\n", path);
+    return ok;
+}
 
-    char* totxTopicName;
+// the adapter part of the state machine, one step for one bus. a bus that fails is retried on its own,
+// the others and mqtt go on. returns true if sth changed, so there may be more to do right away.
+bool busStep(Bus* bus, int epfd) {
+    static const uint8_t initdata[] = { 0xC0, 0x81 };
+    static const uint8_t adapterInfoRequest[] = { 0xC0 | (0x03<<2), 0x80 | ADAPTER_INFO_VERSION };
+    State nextState = bus->state;
+    TelegramSendState sendStatePrev = bus->sendState;
+    bool ready = bus->ready;
     char* totxPayload;
     int   totxLen;
-    
+    uint8_t recv_byte = 0; int res; int flags;
+    socklen_t errlen;
+    sockaddr_in server_addr;
+
+    bus->ready = false;
+    switch(bus->state) {
+        case START:
+            nextState = INIT2_ATCP;
+            break;
+
+        case INIT2_ATCP:
+            if (bus->sock >= 0) {
+                // connect in progress. writable means it is done, successful or not.
+                if (ready) {
+                    errlen = sizeof(res);
+                    if (getsockopt(bus->sock, SOL_SOCKET, SO_ERROR, &res, &errlen) != 0 || res != 0) {
+                        printf("TCP-Verbindung zum Adapter %s fehlgeschlagen\n", busLabel(bus));
+                        nextState=DEIN2_ATCP;
+                        break;
+                    }
+                    epollMod(epfd, bus->sock, EPOLLIN);
+                    // Initialisierung triggern
+                    if (write(bus->sock, initdata, 2) != 2) {
+                        printf("Fehler beim Senden\n");
+                        nextState=DEIN2_ATCP;
+                        break;
+                    }
+                    nextState = INIT3_AINI;
+                } else if (timerExpired(&bus->stateTimer)) {
+                    printf("Timeout beim Verbinden mit dem Adapter %s\n", busLabel(bus));
+                    nextState=DEIN2_ATCP;
+                }
+                break;
+            }
+
+            printf("ETCP Start %s %s:%d\n", busLabel(bus), bus->ip, bus->port);
+            bus->sock = socket(AF_INET, SOCK_STREAM, 0);
+            if (bus->sock < 0) {
+                printf("Fehler beim Erstellen des Sockets\n");
+                nextState=DEIN2_ATCP;
+                break;
+            }
+
+            // non-blocking from the start, an adapter that does not answer must not hold up the others.
+            flags = fcntl(bus->sock, F_GETFL, 0);
+            fcntl(bus->sock, F_SETFL, flags | O_NONBLOCK);
+
+            // disable nagle algo
+            flags = 1;
+            setsockopt(bus->sock, IPPROTO_TCP, TCP_NODELAY, &flags, sizeof(flags));
+
+            // Serveradresse konfigurieren
+            memset(&server_addr,0,sizeof(sockaddr_in));
+            server_addr.sin_family = AF_INET;
+            server_addr.sin_port = htons(bus->port);
+            server_addr.sin_addr.s_addr = inet_addr(bus->ip);
+
+            // Verbindung herstellen, see above for the rest
+            res = connect(bus->sock, (sockaddr*)&server_addr, sizeof(server_addr));
+            if (res < 0 && errno != EINPROGRESS) {
+                printf("TCP-Verbindung zum Adapter %s fehlgeschlagen\n", busLabel(bus));
+                nextState=DEIN2_ATCP;
+                break;
+            }
+            epollAdd(epfd, bus->sock, EPOLLOUT); // removed automatically by close()
+            break;
+
+        case INIT3_AINI:
+            res = read(bus->sock, &recv_byte, 1);
+            if (res < 0) {
+                if (errno == EWOULDBLOCK) { //temporary
+                    break;
+                }
+                printf("Fehler beim Empfangen\n");
+                nextState=DEIN3_AINI;
+                break;
+            }
+            if (res == 1) {
+                bus->initresp_candidate[0] = bus->initresp_candidate[1];
+                bus->initresp_candidate[1] = recv_byte;
+
+                uint8_t initresp_expected[] = { 0xC0, 0x81 };
+                if (bus->initresp_candidate[0] == initresp_expected[0] &&
+                    bus->initresp_candidate[1] == initresp_expected[1]) {
+                    nextState=INIT4_BUS;
+                    break;
+                }
+            }
+            // check for timeout.
+            if (timerExpired(&bus->stateTimer)) {
+                printf("Timeout beim Empfangen der Initsequenz.\n");
+                nextState=DEIN3_AINI;
+            }
+            break;
+        case INIT4_BUS:
+            // here is a good place to anounce our master, scan the bus, or other bus management
+            // e.g. 07 FE - inquiry of existence
+            // not implemented
+
+            // ask for the capabilities. the answer comes in WORK, until then we send byte by byte.
+            adapterInfoReset(&bus->adapterInfo);
+            if (write(bus->sock, adapterInfoRequest, 2) != 2) {
+                printf("Fehler beim Senden\n");
+                nextState=DEIN4_BUS;
+                break;
+            }
+
+            printf("Init completed %s.\n", busLabel(bus));
+            nextState = WORK;
+            break;
+        case WORK:
+            // handling of tcp conn. drain the socket into the ring, then process as much as we can.
+            if (ready) {
+                res = ringRecv(bus->sock, &bus->rxRing, &bus->capture);
+                if (res > 0) {
+                    trace(&traceMain, TRACE_READ, bus - buses, res, 0, bus->rxRing.tRecv);
+                }
+                if (res == 0) {
+                    printf("TCP closed by adapter %s\n", busLabel(bus));
+                    nextState=RESTART;
+                    break;
+                }
+                if (res < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+                    printf("TCP read error\n");
+                    nextState=RESTART;
+                    break;
+                }
+            }
+            ringProcess(&bus->rxRing, &bus->link);
+
+            pollStep(bus);
+            if (charsPreparedTCP(bus, &totxPayload, &totxLen)) {
+                if (write(bus->sock, totxPayload, totxLen) != totxLen) {
+                    printf("TCP write error\n");
+                    nextState=RESTART;
+                    break;
+                }
+            }
+            break;
+
+        case RESTART:
+            busStatistics(bus);
+            busSessionReset(bus);
+            nextState = DEIN4_BUS;
+            break;
+        case DEIN4_BUS:
+            nextState = DEIN3_AINI;
+            break;
+        case DEIN3_AINI:
+            nextState = DEIN2_ATCP;
+            break;
+        case DEIN2_ATCP:
+            // close TCP
+            if (bus->sock >= 0) {
+                close(bus->sock);
+                bus->sock = -1;
+            }
+            nextState = DEIN0_PAUS;
+            break;
+        case DEIN0_PAUS:
+            // delay.
+            if (timerExpired(&bus->stateTimer)) {
+                nextState=START;
+            }
+            break;
+        default:
+        break;
+    }
+
+    bool changed = (bus->state != nextState) || (bus->sendState != sendStatePrev);
+    if (bus->state != nextState) {
+        bus->state = nextState;
+        timerStop(&bus->stateTimer);
+        if (bus->state == INIT2_ATCP) timerStart(&bus->stateTimer, MSEC(ADAPTER_CONNECT_TIMEOUT_MS));
+        if (bus->state == INIT3_AINI) timerStart(&bus->stateTimer, MSEC(ADAPTER_INIT_TIMEOUT_MS));
+        if (bus->state == DEIN0_PAUS) timerStart(&bus->stateTimer, MSEC(RETRY_PAUSE_MS));
+        if (bus->state == INIT3_AINI) memset(bus->initresp_candidate, 0, sizeof(bus->initresp_candidate));
+        if (bus->state == DEIN2_ATCP) bus->metrics.reconnects++;
+    }
+    return changed;
+}
+
+// mqtt is going down: every bus drops its adapter too, and starts over with it once mqtt is back.
+void busClose(Bus* bus) {
+    if (bus->sock >= 0) {
+        busStatistics(bus);
+        close(bus->sock);
+        bus->sock = -1;
+    }
+    busSessionReset(bus);
+    bus->ready = false;
+    bus->state = START;
+    timerStop(&bus->stateTimer);
+}
+
+
+int main(int argc, char *argv[]) {
+    State state = START, nextState=START;
+    Timer stateTimer, statsTimer;
+    memset(&stateTimer, 0, sizeof(stateTimer));
+    memset(&statsTimer, 0, sizeof(statsTimer));
+
     MQTTClient client;
     MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-    MQTTClient_message pubmsg = MQTTClient_message_initializer;
-    MQTTClient_deliveryToken token;
     int rc;
-    bool totx;
-
-    const char* server_ip = ADAPTER_ADDRESS;
-    const int server_port = ADAPTER_PORT;  
-    int sock=-1;
-    uint8_t initresp_candidate[2] = {0,0};
 
-    uint8_t initdata[] = { 0xC0, 0x81 };
-
-    uint8_t recv_byte = 0; int res; int flags;
+    char defaultAdapter[] = ADAPTER_ADDRESS;
+    const char* broker = ADDRESS;
+    const char* capturePath = 0;
+    const char* archiveDir = 0;
+    const char* pollPath = 0;
+    const char* storeDir = 0;
+    int metricsPort = METRICS_PORT;
+    const char* tracePath = TRACE_FILE;
+
+    bool busy;
+    bool replayMode=false, replayFast=false, replayVerbose=false;
+    int opt;
     
     if (signal(SIGINT, sig_handler) == SIG_ERR)
         printf("\ncan't catch SIGINT\n");
     if (signal(SIGQUIT, sig_handler) == SIG_ERR)
         printf("\ncan't catch SIGQUIT\n");
+    if (TRACE && signal(SIGUSR1, traceSignal) == SIG_ERR)
+        printf("\ncan't catch SIGUSR1\n");
+
+    while ((opt = getopt(argc, argv, "a:b:c:d:m:p:s:t:Prfv")) != -1) {
+        switch (opt) {
+            case 'a':
+                if (!busAdd(optarg)) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b': broker        = optarg; break;
+            case 'c': capturePath   = optarg; break;
+            case 'd': archiveDir    = optarg; break;
+            case 'm': metricsPort   = atoi(optarg); break;
+            case 'p': pollPath      = optarg; break;
+            case 's': storeDir      = optarg; break;
+            case 't': tracePath     = optarg; break;
+            case 'P': sendPipelined = true;   break;
+            case 'r': replayMode    = true;   break;
+            case 'f': replayFast    = true;   break;
+            case 'v': replayVerbose = true;   break;
+            default:
+                printf("usage: %s [-a [name=]ip[:port]]... [-b broker] [-c capturefile] [-d archivedir] [-m metricsport] [-p pollfile] [-s storedir] [-t tracefile] [-P]\n       %s [-a name=ip] -r [-f] [-v] capturefile...\n", argv[0], argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (busCount == 0) {
+        busAdd(defaultAdapter);
+    }
+    if (!busesValid()) {
+        return EXIT_FAILURE;
+    }
+    if (replayMode) {
+        if (optind >= argc) {
+            printf("replay: no capture file given\n");
+            return EXIT_FAILURE;
+        }
+        return replay(&buses[0], &argv[optind], argc-optind, replayFast, replayVerbose);
+    }
+    // one capture file per bus, named ones get their name appended.
+    for (int i=0; capturePath && i<busCount; i++) {
+        Capture* capture = &buses[i].capture;
+        if (snprintf(capture->path, sizeof(capture->path), buses[i].name[0] ? "%s.%s" : "%s", capturePath, buses[i].name) >= (int)sizeof(capture->path)) {
+            printf("capture file name too long\n");
+            return EXIT_FAILURE;
+        }
+        if (!captureOpen(capture)) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (pollPath && !pollLoad(pollPath)) {
+        return EXIT_FAILURE;
+    }
+    srand(time(0)); // poll jitter
+    // one archive per bus, all in the same dir, see archive.h
+    for (int i=0; archiveDir && i<busCount; i++) {
+        if (!archiveWriterInit(&buses[i].archive, archiveDir, buses[i].name)) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (storeDir) {
+        if (!tsOpen(&timeseries, storeDir)) {
+            return EXIT_FAILURE;
+        }
+        timeseriesOpen = true;
+    }
+
+    // event sources: adapter sockets (added once connecting), mqtt inbox, next timer deadline.
+    int epfd   = epoll_create1(0);
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    publisher.wakefd = eventfd(0, EFD_NONBLOCK);
+    if (epfd < 0 || timerfd < 0 || publisher.wakefd < 0 || pipe2(mqttInbox, O_NONBLOCK) != 0) {
+        printf("could not set up event loop\n");
+        return EXIT_FAILURE;
+    }
+    epollAdd(epfd, timerfd, EPOLLIN);
+    epollAdd(epfd, mqttInbox[0], EPOLLIN);
+    if (metricsPort > 0) {
+        if ((metricsFd = metricsListen(metricsPort)) < 0) {
+            return EXIT_FAILURE;
+        }
+        epollAdd(epfd, metricsFd, EPOLLIN);
+    }
 
 	//keep listening for data
 	while(1)
 	{
-        tnow = time(0);
+        timerWheelAdvance(monoNow());
+        busy = false;
 
         switch(state) {
             case START:
@@ -684,218 +3170,92 @@ int main(int argc, char *argv[]) {
                 break;
             case INIT1_MQTT: 
                 printf("MQTT Start\n");
-                if ((rc = MQTTClient_create(&client, ADDRESS, CLIENTID,
+                if ((rc = MQTTClient_create(&client, broker, CLIENTID,
                     MQTTCLIENT_PERSISTENCE_NONE, NULL)) != MQTTCLIENT_SUCCESS)
                 {
                     printf("Failed to create client, return code %d\n", rc);
                     nextState=DEIN0_PAUS;
                 }
                 
-                // // "If your application calls MQTTClient_setCallbacks(), this puts the client into asynchronous mode"
-                // // "In asynchronous mode, the client application runs on several threads. "
-                // if ((rc = MQTTClient_setCallbacks(client, NULL, NULL, msgarrvd, NULL)) != MQTTCLIENT_SUCCESS)
-                // {
-                //     printf("Failed to set callbacks, return code %d\n", rc);
-                //     return EXIT_FAILURE;
-                // }
+                // asynchronous mode, see msgarrvd. paho keeps its socket to itself, so this is how we get woken up.
+                mqttConnectionLost = false;
+                if ((rc = MQTTClient_setCallbacks(client, NULL, connlost, msgarrvd, delivered)) != MQTTCLIENT_SUCCESS)
+                {
+                    printf("Failed to set callbacks, return code %d\n", rc);
+                    nextState=DEIN0_PAUS;
+                }
 
                 conn_opts.keepAliveInterval = 20;
                 conn_opts.cleansession = 1;
                 conn_opts.username = USERTOKEN;
+                conn_opts.reliable = 0; // allow more than one message in flight, see publisherLoop
                 if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS)
                 {
                     printf("Failed to connect, return code %d\n", rc);
                     nextState=DEIN0_PAUS;
                 }
 
-                //printf("Subscribing to topic %s\nfor client %s using QoS%d\n", TOPIC_TX, CLIENTID, QOS);
-                if ((rc = MQTTClient_subscribe(client, TOPIC_TX, QOS)) != MQTTCLIENT_SUCCESS)
+                for (int i=0; i<busCount; i++) {
+                    //printf("Subscribing to topic %s\nfor client %s using QoS%d\n", buses[i].topicTx, CLIENTID, QOS);
+                    if ((rc = MQTTClient_subscribe(client, buses[i].topicTx, QOS)) != MQTTCLIENT_SUCCESS)
+                    {
+                        printf("Failed to subscribe, return code %d\n", rc);
+                        nextState=DEIN0_PAUS;
+                    }
+                }
+                if (TRACE && (rc = MQTTClient_subscribe(client, TOPIC_TRACE, QOS)) != MQTTCLIENT_SUCCESS)
                 {
                     printf("Failed to subscribe, return code %d\n", rc);
                     nextState=DEIN0_PAUS;
                 }
-                nextState=INIT2_ATCP;
-                break;
-
-            case INIT2_ATCP:
-
-                printf("ETCP Start\n");
-                sock = socket(AF_INET, SOCK_STREAM, 0);
-                if (sock < 0) {
-                    printf("Fehler beim Erstellen des Sockets\n");
-                    nextState=DEIN2_ATCP;
-                    break;
-                }
-
-                // Serveradresse konfigurieren
-                sockaddr_in server_addr;
-                memset(&server_addr,0,sizeof(sockaddr_in));
-                server_addr.sin_family = AF_INET;
-                server_addr.sin_port = htons(server_port);
-                server_addr.sin_addr.s_addr = inet_addr(server_ip);
-
-                // Verbindung herstellen
-                res = connect(sock, (sockaddr*)&server_addr, sizeof(server_addr));
-                if (res < 0) {
-                    printf("TCP-Verbindung zum Adapter fehlgeschlagen\n");
-                    nextState=DEIN2_ATCP;
-                    break;
-                }
-
-                // Initialisierung triggern
-                if (write(sock, &initdata, 2) != 2) {
-                    printf("Fehler beim Senden\n");
-                    nextState=DEIN2_ATCP;
-                    break;
-                }
-
-                // non-blocking setzen
-                flags = fcntl(sock, F_GETFL, 0);
-                fcntl(sock, F_SETFL, flags | O_NONBLOCK);
-
-                // disable nagle algo
-                flags = 1;
-                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flags, sizeof(flags));
-                
-                nextState = INIT3_AINI;
-                break;
-
-            case INIT3_AINI:
-                res = read(sock, &recv_byte, 1);
-                if (res < 0) {
-                    if (errno == EWOULDBLOCK) { //temporary
-                        break;
-                    }
-                    printf("Fehler beim Empfangen\n");
-                    nextState=DEIN3_AINI;
-                    break;
-                }
-                if (res == 1) {
-                    initresp_candidate[0] = initresp_candidate[1];
-                    initresp_candidate[1] = recv_byte;
-
-                    uint8_t initresp_expected[] = { 0xC0, 0x81 };
-                    if (initresp_candidate[0] == initresp_expected[0] &&
-                        initresp_candidate[1] == initresp_expected[1]) {
-                        nextState=INIT4_BUS;
-                        break;
-                    }
-                }
-                // check for timeout.
-                if (difftime(tnow,tLastStateChange)>2.0) {
-                    printf("Timeout beim Empfangen der Initsequenz.\n");
-                    nextState=DEIN3_AINI;
+                if (timeseriesOpen && (rc = MQTTClient_subscribe(client, TOPIC_TS_QUERY, QOS)) != MQTTCLIENT_SUCCESS)
+                {
+                    printf("Failed to subscribe, return code %d\n", rc);
+                    nextState=DEIN0_PAUS;
                 }
+                publisherStart(client);
+                nextState=WORK; // the adapters connect in busStep
                 break;
-            case INIT4_BUS:
-                // here is a good place to anounce our master, scan the bus, or other bus management
-                // e.g. 07 FE - inquiry of existence
-                // not implemented
 
-                printf("Init completed.\n");
-                nextState = WORK;
-                break;
             case WORK:
                 if (!run) {
                     nextState = RESTART;
                     break;
                 }
 
-                if (sendState == SENDIDLE) { // save time if we could not handle a new request anyhow.
-                    //try to receive some data, this is a blocking call (with timeout)
-                    rcvdMessage = 0;
-                    if ((rc = MQTTClient_receive(client, &rcvdTopicName, &rcvdTopicLen, &rcvdMessage, 10)) != MQTTCLIENT_SUCCESS)
-                    {
-                        if (rc == -1) {
-                            printf("Failed to receive message, return code %d, ignoring\n", rc);
-                        }
-                        else {
-                            printf("Failed to receive message, return code %d\n", rc);
-                            nextState = RESTART;
-                            break;
-                        }
-                    } 
-                    if (rcvdMessage) {
-                        msgarrvd(0, rcvdTopicName, rcvdTopicLen, rcvdMessage);
-                    }
+                if (mqttConnectionLost) {
+                    printf("MQTT connection lost\n");
+                    nextState = RESTART;
+                    break;
                 }
+                inboxProcess();
 
-                //if sth was generated, publish it
-                totx = msgPreparedMqtt(&totxTopicName, &totxPayload);
-                if (totx) {
-                    printf("Publishing  %s\n", totxPayload);
-                    pubmsg.payload = totxPayload;
-                    pubmsg.payloadlen = (int)strlen(totxPayload);//+1; //include 0 termination? not required.
-                    pubmsg.qos = QOS;
-                    pubmsg.retained = 0;
-                    if ((rc = MQTTClient_publishMessage(client, totxTopicName, &pubmsg, &token)) != MQTTCLIENT_SUCCESS)
-                    {
-                        printf("Failed to publish message, return code %d\n", rc);
-                        //exit(EXIT_FAILURE);
-                        // Failed to publish message, return code -1   already seen. 
-                        nextState = RESTART;
-                        break;
-                    } 
-
-                    // printf("Waiting for up to %d seconds for publication of %s\n"
-                    //         "on topic %s for client with ClientID: %s\n",
-                    //         (int)(TIMEOUT/1000), PAYLOAD, TOPIC, CLIENTID);
-                    rc = MQTTClient_waitForCompletion(client, token, TIMEOUT);
-                    if (rc != MQTTCLIENT_SUCCESS) {
-                        printf("Failed to publish message wfc, return code %d\n", rc);
-                        //exit(EXIT_FAILURE);
-                        nextState = RESTART;
-                        break;
-                    }
-                    //printf("Message with delivery token %d delivered\n", token);
+                for (int i=0; i<busCount; i++) {
+                    busy |= busStep(&buses[i], epfd);
                 }
 
-
-                // handling of tcp conn. loop due to dumb byte by byte impl.
-                do {
-                    res = read(sock, &recv_byte, 1);
-                    if (res < 0) {
-                        if (errno == EWOULDBLOCK) {
-                            break;
-                        }
-                        printf("TCP read error\n");
-                        nextState=RESTART;
-                        break;
-                    }
-                    if (res == 1) {
-                        //printf("read %02x\n",recv_byte);
-                        processEnhBusChar(recv_byte);
-                    }
-                } while(res>0 && message_to_publish_valid==0); //stop on SYN, as our queue is implemented as length 1 and we need to mqtt-publish first.
-
-                totx = charsPreparedTCP(&totxPayload,&totxLen);
-                if (totx) {
-                    if (write(sock, totxPayload, totxLen) != totxLen) {
-                        printf("TCP write error\n");
-                        nextState=RESTART;
-                        break;
-                    }
+                if (timerExpired(&statsTimer)) {
+                    statsPublish();
+                    timerStart(&statsTimer, MSEC(STATS_INTERVAL_S*1000LL));
                 }
                 break;
 
             case RESTART:
-                printf("statistics: received %d half-plausible and %d erronous telegrams\n",telegramCountOk, telegramCountBad);
-                nextState = DEIN4_BUS;
-                break;
-            case DEIN4_BUS:
-                nextState = DEIN3_AINI;
-                break;
-            case DEIN3_AINI:
-                nextState = DEIN2_ATCP;
-                break;
-            case DEIN2_ATCP:
-                // close TCP
-                close(sock);
-                sock = -1;
+                for (int i=0; i<busCount; i++) {
+                    busClose(&buses[i]);
+                }
+                printf("statistics: %llu telegrams dropped due to full publish queue\n",(unsigned long long)publishQueue.dropped);
+                printf("statistics: %llu published, %llu failed, %llu unconfirmed, %llu broker reconnects\n",(unsigned long long)publisher.published.load(),
+                    (unsigned long long)publisher.failed.load(), (unsigned long long)publisher.timedout.load(), (unsigned long long)publisher.reconnects);
+                if (timeseriesOpen) {
+                    printf("statistics: time series %lld samples, %.1f bits each, %lld kB in use, %d segments removed\n", (long long)timeseries.countSamples,
+                        (double)timeseries.countBits/MAX(1,timeseries.countSamples), (long long)tsBytes(&timeseries)/1024, timeseries.countRemoved);
+                }
                 nextState = DEIN1_MQTT;
                 break;
             case DEIN1_MQTT:
                 // close MQTT
+                publisherStop();
                 if ((rc = MQTTClient_disconnect(client, 10000)) != MQTTCLIENT_SUCCESS)
                     printf("Failed to disconnect mqtt, return code %d\n", rc);
                 MQTTClient_destroy(&client);
@@ -903,7 +3263,7 @@ int main(int argc, char *argv[]) {
                 break;
             case DEIN0_PAUS:
                 // delay.
-                if (difftime(tnow,tLastStateChange)>10.0) {
+                if (timerExpired(&stateTimer)) {
                     nextState=START;
                 }
                 break;
@@ -911,10 +3271,25 @@ int main(int argc, char *argv[]) {
             break;
         }
 
+        busy |= (state != nextState);
         if (state != nextState) {
             //printf("state change %d > %d\n", state, nextState);
             state = nextState;
-            tLastStateChange = tnow;
+            timerStop(&stateTimer);
+            if (state == DEIN0_PAUS) timerStart(&stateTimer, MSEC(RETRY_PAUSE_MS));
+            if (state == DEIN0_PAUS) publisher.reconnects++;
+            if (state == WORK) timerStart(&statsTimer, MSEC(STATS_INTERVAL_S*1000LL));
+            else               timerStop(&statsTimer);
+        }
+
+        // any state, the counters are most interesting when sth is down.
+        if (metricsReady) {
+            metricsReady = false;
+            metricsServe(metricsFd);
+        }
+        if (traceDumpRequested) {
+            traceDumpRequested = 0;
+            traceDump(tracePath);
         }
 
         if (state == DEIN0_PAUS && !run) {
@@ -922,108 +3297,21 @@ int main(int argc, char *argv[]) {
             break;
         }
 
-        //if (state != WORK) {
-            std::this_thread::yield(); // be cooperative resp scheduling at every state.
-        //}
-    }
-
-    return 0;
-} 
-
-
-
-//////////////////////////
-// JSON, Strings, byte arrays
-
-// there are plenty of libraries but for our purpose we don't need a library at all.
-// as we know our counterpart very well (same project...)
-// and we are only using a very small subset of json (a dictionary (str->[str|int]), only space as whitespace, ...)
-// so we can make things easy, even in c.
-// requires a zeroterminated jsonstr and key as input (however pValue will *not* be zero-terminated)
-bool json_lookup(char* jsonstr, const char* key, char** pValue, int* pLen) {
-    char quotedkey[32];
-    if (!jsonstr || !key || !pValue || !pLen) return false;
-    snprintf(quotedkey, sizeof(quotedkey), "\"%s\"", key); quotedkey[sizeof(quotedkey)-1]=0;
-    char* foundkey = strstr(jsonstr, quotedkey); // assumes that the object is flat and the key exists only once and may not be also part of a value...
-    char* valuestart; char* valueend;
-    if (foundkey) {
-        valuestart = foundkey + strlen(quotedkey);
-        while(*valuestart==':' || *valuestart==' ') valuestart++;
-        valueend = valuestart + 1;
-        if (*valuestart == '"') { //its a string -> end char is also a quote (and we assume there are none inside the string)
-            valuestart++;
-            while (*valueend && *valueend != '"') valueend++;
-        } else {                  //its an integer or similar -> end char is ',' or '}'
-            while (*valueend && *valueend != ',' && *valueend != '}') valueend++;
-        }
-        *pLen = valueend-valuestart;
-        *pValue = valuestart;
-        return true;
-    }
-    return false;
-}
-
-bool json_lookup_int(char* jsonstr, char* key, int* pValue) {
-    char* val; int len;
-    bool ok = json_lookup(jsonstr, key, &val, &len);
-    int value = 0;
-    if(ok && pValue) {
-        //atoi(val)  
-        value = strtol(val, 0, 10);
-        *pValue = value;
-        return true;
+        // be cooperative: sleep instead of spinning, unless there is sth left to do.
+        eventWait(epfd, timerfd, busy);
     }
-    return false;
-}
-
-
-// [0 255] ==> "00 FF"
-void bytes2hexstr(uint8_t* arr, int n, char* pStr, int maxlen) {
-  int len = 0;
-  for (int i=0; i<n && len+2<maxlen; i++) {
-    len += sprintf(&pStr[len], "%02X ", arr[i]);
-  }
-  pStr[--len]=0; // replace last space by termination
-}
-
-// "00 FF" ==> [0 255] , return 2
-int hexstr2bytes(const char* pStr, int len, uint8_t* arr, int maxn) {
-  const char* pBuf=pStr; int i=0;
-  char bytestr[3]; bytestr[2]=0;
-  for (i=0; i<maxn && pBuf+2<=pStr+len && *pBuf!=0; i++) {
-    bytestr[0] = *(pBuf++); bytestr[1] = *(pBuf++); 
-    arr[i]=(uint8_t)strtoul(bytestr, 0, 16);
-    if (!isxdigit(*pBuf)) pBuf++; //skip space
-  }
-  return i;
-}
 
-// {"telegram":"AA BB"} => struct
-//example {"telegram":"10 FE B5 16 03 01 70 10 52 AA","sthelse"=0}
-bool json2struct(char* jsonstr, struct Telegram* pTelegram) {
-    bool ok = true;
-    memset(pTelegram, 0, sizeof(*pTelegram));
-    char*   val_data; int len_data;
-    ok &= json_lookup(jsonstr, "telegram", &val_data, &len_data);
-    if(ok) {
-        pTelegram->len = hexstr2bytes(val_data, len_data, pTelegram->data, sizeof(pTelegram->data));
+    for (int i=0; i<busCount; i++) {
+        captureClose(&buses[i].capture);
+        if (buses[i].archive.dir[0]) {
+            archiveWriterClose(&buses[i].archive);
+        }
     }
-    return ok;
-}
-
-// struct ==> {"telegram":"AA BB"}
-bool struct2json(struct Telegram* pTelegram,char* jsonstr, int maxLen, int* pLen) {
-    memset(jsonstr, 0, sizeof(maxLen));
-    char* s=jsonstr;
-    if (maxLen >= pTelegram->len*3 + strlen("{xtelegramx=xx}")) {
-        strcpy(s, "{\"telegram\":\"");
-        s+=strlen(s);
-        bytes2hexstr(pTelegram->data,pTelegram->len,s,maxLen-strlen(jsonstr));
-        s=jsonstr+strlen(jsonstr);
-        strcpy(s, "\"}");
-        if (pLen) *pLen=strlen(jsonstr);
-        return true;
+    if (timeseriesOpen) {
+        tsClose(&timeseries);
     }
-    return false;
+    if (metricsFd >= 0) close(metricsFd);
+    close(timerfd);
+    close(epfd);
+    return 0;
 }
-
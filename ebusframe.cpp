@@ -0,0 +1,128 @@
+//Copyright (C) 2025 makischu
+
+//ebusframe: splits a telegram as received between two SYNs into its parts.
+// see ebusframe.h
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <string.h>
+#include "ebusframe.h"
+#include "ebusll.h"   // calcEbusCrc, isMasterAddr
+
+#define ACK 0x00
+#define NAK 0xFF
+#define SYN 0xAA
+
+// part of crcLen bytes followed by its CRC. the flag is only valid for the first attempt.
+static bool partCrcOk(const uint8_t* tel, int start, int crcLen, bool first, int crcFlags, int flag) {
+    if (first && crcFlags >= 0) {
+        return crcFlags & flag;
+    }
+    return tel[start+crcLen] == calcEbusCrc((uint8_t*)tel+start, crcLen);
+}
+
+static bool frameDone(EbusFrame* frame, EbusFrameClass cls, bool valid) {
+    frame->cls   = (frame->retries && cls >= FRAME_BROADCAST) ? FRAME_NAK : cls;
+    frame->valid = valid;
+    return valid;
+}
+
+bool frameSplit(const uint8_t* tel, int len, int crcFlags, EbusFrame* frame) {
+    frame->master = frame->ack = frame->slave = frame->mack = -1;
+    frame->retries = 0;
+    if (len > 0 && tel[len-1] == SYN) {
+        len--;
+    }
+    int m = 0;
+    for (;;) {  // once per attempt of the master
+        if (len-m < 6) {
+            return frameDone(frame, FRAME_GARBAGE, false);
+        }
+        if (!isMasterAddr(tel[m])) {
+            return frameDone(frame, FRAME_COLLISION, false);
+        }
+        uint8_t ZZ = tel[m+1];
+        int NN = tel[m+4];
+        if (len-m < 6+NN) {
+            return frameDone(frame, FRAME_GARBAGE, false);
+        }
+        if (!partCrcOk(tel, m, 5+NN, m == 0, crcFlags, FRAME_MASTER_CRC_OK)) {
+            // the usual reason for a NAK: the receiver got a bad crc too, and the master repeats the request.
+            int a = m+6+NN;
+            if (ZZ != 0xFE && frame->retries == 0 && a < len && tel[a] == NAK) {
+                frame->retries++;
+                m = a+1;
+                continue;
+            }
+            return frameDone(frame, FRAME_GARBAGE, false);
+        }
+        frame->master = m;
+        if (ZZ == 0xFE) {
+            return frameDone(frame, FRAME_BROADCAST, true);
+        }
+        int a = m+6+NN;
+        if (a >= len) {
+            return frameDone(frame, FRAME_GARBAGE, false); // no ACK
+        }
+        frame->ack = a;
+        if (tel[a] == NAK && frame->retries == 0) {
+            frame->retries++;   // the master repeats the request once
+            m = a+1;
+            continue;
+        }
+        if (tel[a] != ACK) {
+            return frameDone(frame, tel[a] == NAK ? FRAME_NAK : FRAME_GARBAGE, false);
+        }
+        if (isMasterAddr(ZZ)) {
+            return frameDone(frame, FRAME_MASTER_MASTER, true);
+        }
+        break;
+    }
+    // slave response. after a NAK of the master, the slave repeats it once.
+    int s = frame->ack+1;
+    for (bool first=true;; first=false) {
+        if (len-s < 2) {
+            return frameDone(frame, FRAME_GARBAGE, false);
+        }
+        int NN = tel[s];
+        if (len-s < 2+NN) {
+            return frameDone(frame, FRAME_GARBAGE, false);
+        }
+        bool ok = partCrcOk(tel, s, 1+NN, first && frame->retries == 0, crcFlags, FRAME_SLAVE_CRC_OK);
+        frame->slave = s;
+        int ma = s+2+NN;
+        if (ma >= len) {
+            return frameDone(frame, ok ? FRAME_MASTER_SLAVE : FRAME_GARBAGE, ok); // master ACK missing, the data is fine anyway
+        }
+        frame->mack = ma;
+        if (tel[ma] == NAK && first) {
+            frame->retries++;   // usually because of a bad crc
+            s = ma+1;
+            continue;
+        }
+        return frameDone(frame, ok ? FRAME_MASTER_SLAVE : FRAME_GARBAGE, ok && tel[ma] == ACK);
+    }
+}
+
+const char* frameClassName(EbusFrameClass cls) {
+    switch (cls) {
+        case FRAME_GARBAGE:       return "garbage";
+        case FRAME_COLLISION:     return "collision";
+        case FRAME_BROADCAST:     return "broadcast";
+        case FRAME_MASTER_MASTER: return "master-master";
+        case FRAME_MASTER_SLAVE:  return "master-slave";
+        case FRAME_NAK:           return "nak";
+    }
+    return "?";
+}
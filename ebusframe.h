@@ -0,0 +1,50 @@
+//Copyright (C) 2025 makischu
+
+//ebusframe: splits a telegram as received between two SYNs into its parts.
+// done once in ebusd-light, so that subscribers (and the decoder) don't have to parse it again.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+
+enum EbusFrameClass {
+    FRAME_GARBAGE,       // too short, truncated, bad crc, unexpected ACK byte
+    FRAME_COLLISION,     // does not start with a master address (two masters at once, or we joined late)
+    FRAME_BROADCAST,     // QQ FE PB SB NN data CRC
+    FRAME_MASTER_MASTER, // QQ ZZ PB SB NN data CRC ACK
+    FRAME_MASTER_SLAVE,  // QQ ZZ PB SB NN data CRC ACK NN data CRC ACK
+    FRAME_NAK,           // one of the above with a NAK and a repetition, see retries. offsets are of the last attempt
+};
+
+// offsets into the telegram, -1 if not present.
+struct EbusFrame {
+    EbusFrameClass cls;
+    int  master;   // QQ. ZZ PB SB NN follow, then NN data bytes and the CRC
+    int  ack;      // ACK/NAK of the receiver (none on broadcasts)
+    int  slave;    // NN of the slave response. NN data bytes and the CRC follow
+    int  mack;     // ACK/NAK of the master for the slave response
+    int  retries;  // repetitions after a NAK
+    bool valid;    // the last attempt is complete and its crcs are ok, so its data can be used
+};
+
+// crcFlags: crc results of the first attempt if known, same bits as on ebus/ll/rxb. -1: check here.
+#define FRAME_MASTER_CRC_OK 0x01
+#define FRAME_SLAVE_CRC_OK  0x04
+
+// returns frame->valid.
+bool frameSplit(const uint8_t* tel, int len, int crcFlags, EbusFrame* frame);
+
+// e.g. "master-slave"
+const char* frameClassName(EbusFrameClass cls);
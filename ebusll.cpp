@@ -0,0 +1,521 @@
+//Copyright (C) 2025 makischu
+
+//ebusll: the link layer of ebusd-light, without adapter connection and mqtt.
+// see ebusll.h
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ebusll.h"
+#include "hexcodec.h"
+
+
+/**
+ * CRC8 lookup table for the polynom 0x9b = x^8 + x^7 + x^4 + x^3 + x^1 + 1.
+ */
+static const uint8_t CRC_LOOKUP_TABLE[] = {
+  0x00, 0x9b, 0xad, 0x36, 0xc1, 0x5a, 0x6c, 0xf7, 0x19, 0x82, 0xb4, 0x2f, 0xd8, 0x43, 0x75, 0xee,
+  0x32, 0xa9, 0x9f, 0x04, 0xf3, 0x68, 0x5e, 0xc5, 0x2b, 0xb0, 0x86, 0x1d, 0xea, 0x71, 0x47, 0xdc,
+  0x64, 0xff, 0xc9, 0x52, 0xa5, 0x3e, 0x08, 0x93, 0x7d, 0xe6, 0xd0, 0x4b, 0xbc, 0x27, 0x11, 0x8a,
+  0x56, 0xcd, 0xfb, 0x60, 0x97, 0x0c, 0x3a, 0xa1, 0x4f, 0xd4, 0xe2, 0x79, 0x8e, 0x15, 0x23, 0xb8,
+  0xc8, 0x53, 0x65, 0xfe, 0x09, 0x92, 0xa4, 0x3f, 0xd1, 0x4a, 0x7c, 0xe7, 0x10, 0x8b, 0xbd, 0x26,
+  0xfa, 0x61, 0x57, 0xcc, 0x3b, 0xa0, 0x96, 0x0d, 0xe3, 0x78, 0x4e, 0xd5, 0x22, 0xb9, 0x8f, 0x14,
+  0xac, 0x37, 0x01, 0x9a, 0x6d, 0xf6, 0xc0, 0x5b, 0xb5, 0x2e, 0x18, 0x83, 0x74, 0xef, 0xd9, 0x42,
+  0x9e, 0x05, 0x33, 0xa8, 0x5f, 0xc4, 0xf2, 0x69, 0x87, 0x1c, 0x2a, 0xb1, 0x46, 0xdd, 0xeb, 0x70,
+  0x0b, 0x90, 0xa6, 0x3d, 0xca, 0x51, 0x67, 0xfc, 0x12, 0x89, 0xbf, 0x24, 0xd3, 0x48, 0x7e, 0xe5,
+  0x39, 0xa2, 0x94, 0x0f, 0xf8, 0x63, 0x55, 0xce, 0x20, 0xbb, 0x8d, 0x16, 0xe1, 0x7a, 0x4c, 0xd7,
+  0x6f, 0xf4, 0xc2, 0x59, 0xae, 0x35, 0x03, 0x98, 0x76, 0xed, 0xdb, 0x40, 0xb7, 0x2c, 0x1a, 0x81,
+  0x5d, 0xc6, 0xf0, 0x6b, 0x9c, 0x07, 0x31, 0xaa, 0x44, 0xdf, 0xe9, 0x72, 0x85, 0x1e, 0x28, 0xb3,
+  0xc3, 0x58, 0x6e, 0xf5, 0x02, 0x99, 0xaf, 0x34, 0xda, 0x41, 0x77, 0xec, 0x1b, 0x80, 0xb6, 0x2d,
+  0xf1, 0x6a, 0x5c, 0xc7, 0x30, 0xab, 0x9d, 0x06, 0xe8, 0x73, 0x45, 0xde, 0x29, 0xb2, 0x84, 0x1f,
+  0xa7, 0x3c, 0x0a, 0x91, 0x66, 0xfd, 0xcb, 0x50, 0xbe, 0x25, 0x13, 0x88, 0x7f, 0xe4, 0xd2, 0x49,
+  0x95, 0x0e, 0x38, 0xa3, 0x54, 0xcf, 0xf9, 0x62, 0x8c, 0x17, 0x21, 0xba, 0x4d, 0xd6, 0xe0, 0x7b,
+};
+
+uint8_t calcEbusCrc(uint8_t* pStart, int len) {
+    uint8_t crc = 0x00;
+    for (int i=0;i<len;i++) {
+        // "the CRC is calculated over the EXPANDED byte transmission sequence"
+        if (pStart[i] == 0xAA) {
+            crc = CRC_LOOKUP_TABLE[crc]^0xA9;
+            crc = CRC_LOOKUP_TABLE[crc]^0x01;
+        } else if (pStart[i] == 0xA9) {
+            crc = CRC_LOOKUP_TABLE[crc]^0xA9;
+            crc = CRC_LOOKUP_TABLE[crc]^0x00;
+        } else {
+            crc = CRC_LOOKUP_TABLE[crc]^pStart[i];
+        }
+    }
+    return crc;
+}
+
+const uint8_t master_addresses[25] = {
+     0x00, 0x10, 0x30, 0x70, 0xF0,
+     0x01, 0x11, 0x31, 0x71, 0xF1,
+     0x03, 0x13, 0x33, 0x73, 0xF3,
+     0x07, 0x17, 0x37, 0x77, 0xF7,
+     0x0F, 0x1F, 0x3F, 0x7F, 0xFF
+ };
+bool isMasterAddr(uint8_t addr) {
+    for(int i=0;i<25;i++) {
+        if (addr==master_addresses[i])
+            return true;
+    }
+    return false;
+}
+
+
+
+//escape special chars
+void telegramExpand(Telegram* pIn, Telegram *pOut) {
+    int i=0;
+    uint8_t byte;
+    pOut->len = 0;
+    for(i=0;i<pIn->len;i++) {
+        byte = pIn->data[i];
+        if (pOut->len+2 >= sizeof(pOut->data)) {
+            return; //avoid overflow, just in case, not expected to happen.
+        }
+        if (byte==0xAA) {
+            pOut->data[pOut->len++] = 0xA9;
+            pOut->data[pOut->len++] = 0x01;
+        }
+        else if (byte==0xA9) {
+            pOut->data[pOut->len++] = 0xA9;
+            pOut->data[pOut->len++] = 0x00;
+        }
+        else {
+            pOut->data[pOut->len++] = byte;
+        }
+    }
+}
+// opposite of expand. decode escaped chars.
+void telegramDeflate(Telegram* pIn, Telegram *pOut) {
+    int i=0;
+    uint8_t byte,byte2;
+    pOut->len = 0;
+    for(i=0;i<pIn->len && i+1<sizeof(pIn->data);i++) {
+        byte  = pIn->data[i];
+        byte2 = pIn->data[i+1];
+        if (byte==0xA9) {
+            if(byte2==0x01) {
+                byte = 0xAA;
+            }
+            if(byte2==0x00) {
+                byte = 0xA9;
+            }
+            i++;
+        }
+        pOut->data[pOut->len++] = byte;
+    }
+}
+void telegramExpandEnhanced(Telegram* pIn, Telegram *pOut) {
+    int i=0;
+    uint8_t byte;
+    pOut->len = 0;
+    for(i=0;i<pIn->len;i++) {
+        byte = pIn->data[i];
+        if (pOut->len+2 >= sizeof(pOut->data)) {
+            return; //avoid overflow, just in case, not expected to happen.
+        }
+        // KISS. allows for easy separation for byte by byte sending. 1 char => 2 char.
+        //if (byte & 0x80) {
+            pOut->data[pOut->len++]  = 0xC0 | (0x01<<2) | ((byte&0xC0)>>6);
+            pOut->data[pOut->len++]  = 0x80 | (byte&0x3F);
+        // }
+        // else {
+        //     pOut->data[pOut->len++] = byte;
+        // }
+    }
+}
+
+
+
+bool telegramCRCcheck(Telegram* telegram, bool slaveResponseNotMaster) {
+    int minlen,offset,crcoffset;
+    uint8_t NN,CRC,calcdCRC;
+    bool result=false;
+    // QQ ZZ XX XX NN    CRC
+    offset = 0;
+    minlen = 6;
+    crcoffset = 5;
+    NN = telegram->data[4]; 
+    if (telegram->len >= minlen) {
+        if (NN <= 16) {
+            CRC      = telegram->data[crcoffset+NN];
+            calcdCRC = calcEbusCrc(telegram->data+offset,crcoffset+NN-offset);
+            if (CRC == calcdCRC) {
+                result = true;
+            }
+        }
+    }
+    // ACK NN   CRC    - only if slave response
+    if (result && slaveResponseNotMaster) {   
+        result = false;
+        offset = minlen+NN;
+        minlen = 3;
+        crcoffset = 2;
+        NN = telegram->data[offset+1];
+        if (NN <= 16) {
+            CRC      = telegram->data[offset+crcoffset+NN];
+            calcdCRC = calcEbusCrc(telegram->data+offset,crcoffset+NN);
+            if (CRC == calcdCRC) {
+                result = true;
+            }
+        }
+    }
+    return result;
+}
+
+bool telegramIsPlausibleTx(Telegram* telegram) {
+    uint8_t QQ,NN;
+    QQ = telegram->data[0];
+    NN = telegram->data[4]; 
+    if (isMasterAddr(QQ)) {
+        if (telegramCRCcheck(telegram, false)) {
+            return (telegram->len == 6+NN);
+        }
+    }
+    return false;
+}
+
+bool telegramIsPlausibleRx(Telegram* telegram) {
+    // this is a very minimalistic implementation, intentionally.
+    // we do NO checks here to be able to deal with bugs at next layer.
+    // exception: [auto-]SYNs with no content at all.
+    return (telegram->len > 1);
+}
+
+void ebusLinkInit(EbusLink* link) {
+    memset(link, 0, sizeof(*link));
+    link->rxCrc.end = -1;
+}
+
+// received on bus between two SYNs
+void processBusTelegram(EbusLink* link) {
+    Telegram* telegramRxd = &link->telegramRxd;
+    if (telegramIsPlausibleRx(telegramRxd)) {    
+        if (link->onTelegram) {
+            link->onTelegram(link, telegramRxd, link->telegramRxdFlags);
+        }
+        link->telegramCountOk++;
+        return;
+    }
+    else if (telegramRxd->len>1) { 
+        char tmp[256];
+        bytes2hexstr(telegramRxd->data,telegramRxd->len, tmp,sizeof(tmp));
+        printf("ingoring bad telegram %s \n",tmp);
+        link->telegramCountBad++;
+    }
+}
+
+
+// crc of the master request and the slave response, calculated while receiving. the crc is defined
+// over the bytes as on the wire (expanded), which is what processBusChar sees anyway. so when the SYN
+// arrives, telegramRxdFlags is known without another pass over the telegram.
+void rxCrcReset(EbusLink* link) {
+    link->rxCrc.part  = RXCRC_MASTER;
+    link->rxCrc.start = 0;
+    link->rxCrc.end   = -1;
+    link->rxCrc.crc   = 0;
+    link->telegramRxdFlags = 0;
+}
+
+// every byte as on the wire, before escape handling. it belongs to telegramRxd.data[telegramRxd.len].
+void rxCrcWire(EbusLink* link, uint8_t value) {
+    RxCrc* rxCrc = &link->rxCrc;
+    int i = link->telegramRxd.len;
+    if ((rxCrc->part == RXCRC_MASTER || rxCrc->part == RXCRC_SLAVE) && i >= rxCrc->start && (rxCrc->end < 0 || i < rxCrc->end)) {
+        rxCrc->crc = CRC_LOOKUP_TABLE[rxCrc->crc] ^ value;
+    }
+}
+
+// every byte after escape handling, just stored at telegramRxd.data[i].
+void rxCrcByte(EbusLink* link, int i, uint8_t value) {
+    RxCrc* rxCrc = &link->rxCrc;
+    switch (rxCrc->part) {
+        case RXCRC_MASTER:
+            if (i == 4) {
+                rxCrc->end = 5 + value;
+            } else if (i == rxCrc->end) {
+                if (value == rxCrc->crc) {
+                    link->telegramRxdFlags |= TELEGRAM_MASTER_CRC_OK;
+                }
+                uint8_t ZZ = link->telegramRxd.data[1];
+                rxCrc->part = (ZZ == 0xFE || isMasterAddr(ZZ)) ? RXCRC_DONE : RXCRC_ACK;
+            }
+            break;
+        case RXCRC_ACK:
+            if (value == 0x00) {    // after a NAK the request is repeated, not followed here.
+                rxCrc->part  = RXCRC_SLAVE;
+                rxCrc->start = i+1;
+                rxCrc->end   = -1;
+                rxCrc->crc   = 0;
+            } else {
+                rxCrc->part  = RXCRC_DONE;
+            }
+            break;
+        case RXCRC_SLAVE:
+            if (i == rxCrc->start) {
+                rxCrc->end = i + 1 + value;
+            } else if (i == rxCrc->end) {
+                link->telegramRxdFlags |= TELEGRAM_SLAVE_PRESENT;
+                if (value == rxCrc->crc) {
+                    link->telegramRxdFlags |= TELEGRAM_SLAVE_CRC_OK;
+                }
+                rxCrc->part = RXCRC_DONE;
+            }
+            break;
+        case RXCRC_DONE:
+            break;
+    }
+}
+
+// received on bus - like real uart
+void processBusChar(EbusLink* link, uint8_t value) {
+    Telegram* telegramRxd = &link->telegramRxd;
+    bool isSYN;
+    // e.g. to store the slave response to our master request (TX). before escape handling.
+    if (link->onWire) {
+        link->onWire(link, value);
+    }
+    isSYN = (value == 0xAA); //must be evaluated before escape char handling to distinguish real SYN from data AA.
+    if (!isSYN) {
+        rxCrcWire(link, value);
+    }
+    // handle escape character
+    if (value==0xA9) {
+        link->escaped = true;
+        return;
+    }
+    else if (link->escaped) {
+        if(value == 0x00)       value = 0xA9;
+        else if (value==0x01)   value = 0xAA;
+        link->escaped = false;
+    }
+
+    // store until SYN char, for receiving (RX)
+    if(telegramRxd->len >= sizeof(telegramRxd->data)) {
+        telegramRxd->len=0;
+        rxCrcReset(link);
+    }
+    telegramRxd->data[telegramRxd->len++] = value;
+    if (isSYN) {
+        if (!link->resync) {
+            processBusTelegram(link);
+        }
+        link->resync = false;
+        telegramRxd->len = 0;
+        rxCrcReset(link);
+    } else {
+        rxCrcByte(link, telegramRxd->len-1, value);
+    }
+}
+
+// the connection to the adapter is new: what was received since the last SYN is incomplete, and so is what the new
+// one starts with. counters and callbacks stay.
+void ebusLinkReset(EbusLink* link) {
+    link->telegramRxd.len = 0;
+    rxCrcReset(link);
+    link->escaped = false;
+    link->enh1    = 0;
+    link->resync  = true;
+}
+
+// received on bus-enhanced-tcp.
+void processEnhBusChar(EbusLink* link, uint8_t value) {
+    uint8_t enh2; uint8_t cccc;
+
+    if (value & 0x80) {   
+        if ((value&0xC0) == 0xC0) {  // first byte of a two-byte-char
+            link->enh1 = value;
+            return;
+        }
+        if ((value&0xC0) == 0x80) {  // 2nc byte of a two-byte-char
+            enh2 = value;
+            value = ((link->enh1 & 0x3) << 6) | (enh2&0x3F);
+            cccc  = (link->enh1 & 0x3C)>>2;
+            //printf("%02x %02x %d\n", enh1, enh2, cccc);
+            if (cccc == 2) {        // 2 = Arbitration Success 
+                link->arbitration_success = 1;
+            }
+            if (cccc == 10) {        // 10 = Fail
+                link->arbitration_success = 0;
+            }
+            if (cccc == 3) {         // 3 = Info, not a bus byte
+                if (link->onInfo) {
+                    link->onInfo(link, value);
+                }
+                return;
+            }
+            if (cccc != 0x1 && cccc != 0x2 && cccc != 10) {       // 1 = Received, ... ignore others.
+                printf("ignoring cccc %d\n",cccc);
+                return;
+            }
+        }
+    }
+    processBusChar(link, value);
+}
+
+// received on bus-enhanced-tcp, a whole chunk at once.
+void processEnhBusChars(EbusLink* link, uint8_t* pStart, int len) {
+    for (int i=0; i<len; i++) {
+        processEnhBusChar(link, pStart[i]);
+    }
+}
+
+
+//////////////////////////
+// JSON, Strings, byte arrays
+
+// there are plenty of libraries but for our purpose we don't need a library at all.
+// as we know our counterpart very well (same project...)
+// and we are only using a very small subset of json (a dictionary (str->[str|int]), only space as whitespace, ...)
+// so we can make things easy, even in c.
+// requires a zeroterminated jsonstr and key as input (however pValue will *not* be zero-terminated)
+bool json_lookup(char* jsonstr, const char* key, char** pValue, int* pLen) {
+    char quotedkey[32];
+    if (!jsonstr || !key || !pValue || !pLen) return false;
+    snprintf(quotedkey, sizeof(quotedkey), "\"%s\"", key); quotedkey[sizeof(quotedkey)-1]=0;
+    char* foundkey = strstr(jsonstr, quotedkey); // assumes that the object is flat and the key exists only once and may not be also part of a value...
+    char* valuestart; char* valueend;
+    if (foundkey) {
+        valuestart = foundkey + strlen(quotedkey);
+        while(*valuestart==':' || *valuestart==' ') valuestart++;
+        valueend = valuestart + 1;
+        if (*valuestart == '"') { //its a string -> end char is also a quote (and we assume there are none inside the string)
+            valuestart++;
+            while (*valueend && *valueend != '"') valueend++;
+        } else {                  //its an integer or similar -> end char is ',' or '}'
+            while (*valueend && *valueend != ',' && *valueend != '}') valueend++;
+        }
+        *pLen = valueend-valuestart;
+        *pValue = valuestart;
+        return true;
+    }
+    return false;
+}
+
+bool json_lookup_int(char* jsonstr, const char* key, int* pValue) {
+    char* val; int len;
+    bool ok = json_lookup(jsonstr, key, &val, &len);
+    int value = 0;
+    if(ok && pValue) {
+        //atoi(val)  
+        value = strtol(val, 0, 10);
+        *pValue = value;
+        return true;
+    }
+    return false;
+}
+
+
+// {"telegram":"AA BB"} => struct
+//example {"telegram":"10 FE B5 16 03 01 70 10 52 AA","sthelse"=0}
+bool json2struct(char* jsonstr, struct Telegram* pTelegram) {
+    bool ok = true;
+    memset(pTelegram, 0, sizeof(*pTelegram));
+    char*   val_data; int len_data;
+    ok &= json_lookup(jsonstr, "telegram", &val_data, &len_data);
+    if(ok) {
+        pTelegram->len = hexstr2bytes(val_data, len_data, pTelegram->data, sizeof(pTelegram->data));
+        ok = (pTelegram->len >= 0);
+    }
+    return ok;
+}
+
+// struct ==> {"telegram":"AA BB","mcrc":true,"scrc":true}
+// mcrc: crc of the master part ok, scrc: of the slave response (only if there is one), cached: only if TELEGRAM_CACHED
+bool struct2json(struct Telegram* pTelegram, uint8_t flags, char* jsonstr, int maxLen, int* pLen) {
+    memset(jsonstr, 0, sizeof(maxLen));
+    char* s=jsonstr;
+    if (maxLen >= pTelegram->len*3 + strlen("{xtelegramx=xx,xmcrcx=false,xscrcx=false,xcachedx=true}")) {
+        strcpy(s, "{\"telegram\":\"");
+        s+=strlen(s);
+        bytes2hexstr(pTelegram->data,pTelegram->len,s,maxLen-strlen(jsonstr));
+        s=jsonstr+strlen(jsonstr);
+        strcpy(s, (flags & TELEGRAM_MASTER_CRC_OK) ? "\",\"mcrc\":true" : "\",\"mcrc\":false");
+        s+=strlen(s);
+        if (flags & TELEGRAM_SLAVE_PRESENT) {
+            strcpy(s, (flags & TELEGRAM_SLAVE_CRC_OK) ? ",\"scrc\":true" : ",\"scrc\":false");
+            s+=strlen(s);
+        }
+        strcpy(s, (flags & TELEGRAM_CACHED) ? ",\"cached\":true}" : "}");
+        if (pLen) *pLen=strlen(jsonstr);
+        return true;
+    }
+    return false;
+}
+
+// struct ==> {"telegram":"AA BB","class":"master-slave","m":0,"ack":7,"s":8,"mack":19,"retries":0,"valid":true}
+// offsets into the telegram, see EbusFrame. only present ones are listed, e.g. no "s" on broadcasts.
+// m: QQ (ZZ PB SB NN follow, data at m+5), s: NN of the slave response (data at s+1).
+bool frame2json(struct Telegram* pTelegram, const EbusFrame* frame, char* jsonstr, int maxLen, int* pLen) {
+    const char* names[] = { "m", "ack", "s", "mack" };
+    const int offsets[] = { frame->master, frame->ack, frame->slave, frame->mack };
+    if (maxLen < pTelegram->len*3 + (int)strlen("{xtelegramx:xx,xclassx:xmaster-masterx,xmx:255,xackx:255,xsx:255,xmackx:255,xretriesx:9,xvalidx:false}")) {
+        return false;
+    }
+    char* s = jsonstr;
+    strcpy(s, "{\"telegram\":\"");
+    s+=strlen(s);
+    bytes2hexstr(pTelegram->data,pTelegram->len,s,maxLen-(s-jsonstr));
+    s+=strlen(s);
+    s+=sprintf(s, "\",\"class\":\"%s\"", frameClassName(frame->cls));
+    for (int i=0; i<4; i++) {
+        if (offsets[i] >= 0) {
+            s+=sprintf(s, ",\"%s\":%d", names[i], offsets[i]);
+        }
+    }
+    s+=sprintf(s, ",\"retries\":%d,\"valid\":%s}", frame->retries, frame->valid ? "true" : "false");
+    if (pLen) *pLen = s-jsonstr;
+    return true;
+}
+
+// compact alternative to struct2json, for consumers that do not want to parse hex strings.
+// all little endian:
+//  0  u8   version, currently 1
+//  1  u8   flags, see TELEGRAM_*
+//  2  u8   length of the master part QQ..CRC (0 if the telegram is too short for it)
+//  3  u8   length n of the telegram
+//  4  u64  time of reception, microseconds since epoch
+// 12  n    telegram, as on the bus between two SYNs (escapes resolved), like in json
+#define RXB_VERSION       1
+#define RXB_HEADER_LEN    12
+bool struct2bin(struct Telegram* pTelegram, uint8_t flags, char* buf, int maxLen, int* pLen) {
+    uint8_t* p = (uint8_t*)buf;
+    uint8_t masterLen = 0;
+    struct timespec ts;
+    if (maxLen < RXB_HEADER_LEN + pTelegram->len || pTelegram->len > 255) {
+        return false;
+    }
+    if (pTelegram->len >= 6 && pTelegram->len >= 6+pTelegram->data[4]) {
+        masterLen = 6+pTelegram->data[4];
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t usec = (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+    p[0] = RXB_VERSION;
+    p[1] = flags;
+    p[2] = masterLen;
+    p[3] = pTelegram->len;
+    for (int i=0; i<8; i++) {
+        p[4+i] = usec >> (8*i);
+    }
+    memcpy(p+RXB_HEADER_LEN, pTelegram->data, pTelegram->len);
+    if (pLen) *pLen = RXB_HEADER_LEN + pTelegram->len;
+    return true;
+}
@@ -0,0 +1,98 @@
+//Copyright (C) 2025 makischu
+
+//ebusll: the link layer of ebusd-light, without adapter connection and mqtt.
+// bytes from the adapter in, telegrams (and their json/binary representation) out.
+// used by ebusd-light and the benchmarks, see CMakeLists.txt.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+#include "ebusframe.h"
+
+// "the sequence of individual characters that a participant must use, when accessing the bus"
+// may or may not be valid, may contain slave response too, may end with SYN or not, may be expanded or not, simple multi-purpose-struct.
+// for RX: it is assumed that a telegram consists of all bytes between two SYN symbols. at least these are our candidates.
+struct Telegram {
+  uint8_t data[256]; //bytes (the actual data)
+  int     len;       //nr of bytes
+};
+
+// what the framer found out about a received telegram. published as is on ebus/ll/rxb.
+#define TELEGRAM_MASTER_CRC_OK 0x01
+#define TELEGRAM_SLAVE_PRESENT 0x02  // ACK NN data CRC follows the master part
+#define TELEGRAM_SLAVE_CRC_OK  0x04
+#define TELEGRAM_OWN           0x08  // sent by ebusd-light (request from ebus/ll/tx)
+#define TELEGRAM_CACHED        0x10  // answered from the response cache, not from the bus (with TELEGRAM_OWN)
+
+
+//////////////////////////
+// Telegram helpers
+
+uint8_t calcEbusCrc(uint8_t* pStart, int len);
+bool isMasterAddr(uint8_t addr);
+void telegramExpand(Telegram* pIn, Telegram *pOut);          // escape AA and A9, as on the wire
+void telegramDeflate(Telegram* pIn, Telegram *pOut);         // opposite of expand
+void telegramExpandEnhanced(Telegram* pIn, Telegram *pOut);  // enhanced protocol, 2 chars per byte
+bool telegramCRCcheck(Telegram* telegram, bool slaveResponseNotMaster);
+bool telegramIsPlausibleTx(Telegram* telegram);
+bool telegramIsPlausibleRx(Telegram* telegram);
+
+
+//////////////////////////
+// RX: bytes from the adapter => telegrams
+
+// crc of the master request and the slave response, calculated while receiving. see rxCrcByte.
+enum RxCrcPart { RXCRC_MASTER, RXCRC_ACK, RXCRC_SLAVE, RXCRC_DONE };
+struct RxCrc {
+    RxCrcPart part;
+    int       start;  // index in telegramRxd of the first byte of the part (QQ resp. slave NN)
+    int       end;    // index of its CRC byte, -1 while NN is not received yet
+    uint8_t   crc;
+};
+
+// receiving state of one bus, i.e. of one adapter. one process may serve several of them, each with its own.
+// ebusLinkInit, set the hooks (0 if not needed) and ctx, then feed it everything received from the adapter.
+struct EbusLink {
+    Telegram telegramRxd;          // bytes since the last SYN
+    uint8_t  telegramRxdFlags;     // see rxCrcByte
+    RxCrc    rxCrc;
+    bool     escaped;              // last wire byte was A9
+    bool     resync;               // set by ebusLinkReset: drop what comes before the next SYN
+    uint8_t  enh1;                 // first byte of an enhanced two-byte-char, see processEnhBusChar
+    int      arbitration_success;  // last answer of the adapter to an arbitration request: 1 won, 0 lost, untouched otherwise
+    uint64_t telegramCountOk;      // reported by onTelegram
+    uint64_t telegramCountBad;     // too short to be reported
+    void   (*onTelegram)(EbusLink* link, Telegram* telegram, uint8_t flags); // bytes between two SYNs, escapes resolved. flags: TELEGRAM_*
+    void   (*onWire)(EbusLink* link, uint8_t value);                         // every bus byte as on the wire, before escape handling
+    void   (*onInfo)(EbusLink* link, uint8_t value);                         // answer to an INFO request: length, then that many data bytes
+    void*    ctx;                  // for the application
+};
+
+void ebusLinkInit(EbusLink* link);
+void ebusLinkReset(EbusLink* link);
+void processEnhBusChars(EbusLink* link, uint8_t* pStart, int len);
+void processEnhBusChar(EbusLink* link, uint8_t value);
+void processBusChar(EbusLink* link, uint8_t value);   // plain bus byte, without the enhanced protocol
+
+
+//////////////////////////
+// JSON, Strings, byte arrays
+
+bool json_lookup(char* jsonstr, const char* key, char** pValue, int* pLen);
+bool json_lookup_int(char* jsonstr, const char* key, int* pValue);
+bool json2struct(char* jsonstr, struct Telegram* pTelegram);
+bool struct2json(struct Telegram* pTelegram, uint8_t flags, char* jsonstr, int maxLen, int* pLen);
+bool struct2bin(struct Telegram* pTelegram, uint8_t flags, char* buf, int maxLen, int* pLen);
+bool frame2json(struct Telegram* pTelegram, const EbusFrame* frame, char* jsonstr, int maxLen, int* pLen);
@@ -0,0 +1,332 @@
+//Copyright (C) 2025 makischu
+
+//ebusll_bench: throughput of the link layer hot paths, stage by stage, without adapter and mqtt.
+// build: see CMakeLists.txt
+// run:   ebusll_bench [capturefile] [iterations]   (capturefile as written by ebusd-light -c)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "ebusll.h"
+#include "hexcodec.h"
+
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+// allocations per stage: glibc lets us wrap its allocator. the hot paths are meant to allocate nothing.
+extern "C" void* __libc_malloc(size_t n);
+extern "C" void* __libc_calloc(size_t n, size_t m);
+extern "C" void* __libc_realloc(void* p, size_t n);
+extern "C" void  __libc_free(void* p);
+static long allocCount = 0;
+extern "C" void* malloc(size_t n)              { allocCount++; return __libc_malloc(n); }
+extern "C" void* calloc(size_t n, size_t m)    { allocCount++; return __libc_calloc(n, m); }
+extern "C" void* realloc(void* p, size_t n)    { allocCount++; return __libc_realloc(p, n); }
+extern "C" void  free(void* p)                 { __libc_free(p); }
+
+// recorded on the bus (see README), used if no capture file is given.
+static const char* corpusRecorded[] = {
+    "10 08 B5 11 01 01 89 00 09 3D 3E 00 80 FF FF 00 00 FF C2 00 AA",
+    "10 76 B5 11 01 01 16 00 09 FF FF 20 0A FF FF 00 00 FF 15 00 AA",
+    "10 08 B5 10 09 00 00 40 FF FF FF 06 00 00 BC 00 01 01 9A 00 AA",
+    "03 76 B5 12 06 13 00 0C 4B 03 00 B6 00 02 00 FF D3 00 AA",
+    "10 08 B5 11 01 00 88 00 09 EE 01 0C 00 00 08 00 00 00 D1 00 AA",
+    "10 FE B5 16 03 01 70 10 52 AA",
+};
+
+// a corpus is what the adapter sends (enhanced protocol), the rest is derived from it by one pass through the framer.
+struct Corpus {
+    const char*           name;
+    std::vector<uint8_t>  enh;        // enhanced protocol, as from the socket
+    std::vector<uint8_t>  wire;       // bus bytes (escaped, with SYNs), see EbusLink.onWire
+    std::vector<Telegram> telegrams;  // see EbusLink.onTelegram
+    std::vector<uint8_t>  flags;
+};
+static EbusLink link;
+static long telegramsSeen;
+
+static void collectTelegram(EbusLink* link, Telegram* telegram, uint8_t flags) {
+    Corpus* corpus = (Corpus*)link->ctx;
+    corpus->telegrams.push_back(*telegram);
+    corpus->flags.push_back(flags);
+}
+static void collectWire(EbusLink* link, uint8_t value) {
+    ((Corpus*)link->ctx)->wire.push_back(value);
+}
+static void countTelegram(EbusLink* link, Telegram* telegram, uint8_t flags) {
+    telegramsSeen++;
+}
+
+static void corpusFinish(Corpus* corpus) {
+    EbusLink collect;
+    ebusLinkInit(&collect);
+    collect.onTelegram = collectTelegram;
+    collect.onWire     = collectWire;
+    collect.ctx        = corpus;
+    processEnhBusChars(&collect, corpus->enh.data(), corpus->enh.size());
+}
+
+// telegram (escapes resolved, ending with SYN) => enhanced protocol, as the adapter would send it.
+static void appendEnhanced(std::vector<uint8_t>* out, const uint8_t* tel, int len) {
+    Telegram in, expanded;
+    memcpy(in.data, tel, len-1);
+    in.len = len-1;
+    telegramExpand(&in, &expanded);
+    expanded.data[expanded.len++] = 0xAA;
+    for (int i=0; i<expanded.len; i++) {
+        uint8_t b = expanded.data[i];
+        if (b < 0x80) {
+            out->push_back(b);  // short form, as the adapter does
+        } else {
+            out->push_back(0xC0 | (0x01<<2) | (b>>6));
+            out->push_back(0x80 | (b&0x3F));
+        }
+    }
+}
+
+static void corpusFromLines(Corpus* corpus, const char** lines, int n) {
+    for (int i=0; i<n; i++) {
+        uint8_t tel[256];
+        int len = hexstr2bytes(lines[i], strlen(lines[i]), tel, sizeof(tel));
+        appendEnhanced(&corpus->enh, tel, len);
+    }
+    corpusFinish(corpus);
+}
+
+// master-slave mostly, some broadcasts and master-master, data with AA and A9 now and then, some NAKs.
+static void corpusSynthetic(Corpus* corpus, int n) {
+    static const uint8_t masters[] = { 0x10, 0x03, 0x71, 0xF1, 0x31 };
+    static const uint8_t slaves[]  = { 0x08, 0x76, 0x15, 0x26 };
+    uint32_t seed = 12345;
+    auto rnd = [&seed](int range) { seed = seed*1103515245 + 12345; return (int)((seed >> 16) % range); };
+    for (int i=0; i<n; i++) {
+        uint8_t tel[256];
+        int len = 0, kind = rnd(10);
+        tel[len++] = masters[rnd(sizeof(masters))];
+        tel[len++] = kind == 0 ? 0xFE : kind == 1 ? 0x10 : slaves[rnd(sizeof(slaves))];
+        tel[len++] = 0xB5;
+        tel[len++] = 0x10 + rnd(8);
+        int NN = 1 + rnd(9);
+        tel[len++] = NN;
+        for (int j=0; j<NN; j++) tel[len++] = rnd(8) == 0 ? 0xA9 + rnd(2) : rnd(256);
+        tel[len] = calcEbusCrc(tel, len);
+        len++;
+        if (kind == 1) {
+            tel[len++] = 0x00;
+        } else if (kind != 0) {
+            if (rnd(20) == 0) {
+                tel[len++] = 0xFF;      // NAK, the request is repeated
+                memcpy(&tel[len], tel, 6+NN);
+                len += 6+NN;
+            }
+            tel[len++] = 0x00;
+            int s = len, NNs = rnd(11);
+            tel[len++] = NNs;
+            for (int j=0; j<NNs; j++) tel[len++] = rnd(8) == 0 ? 0xA9 + rnd(2) : rnd(256);
+            tel[len] = calcEbusCrc(&tel[s], len-s);
+            len++;
+            tel[len++] = 0x00;
+        }
+        tel[len++] = 0xAA;
+        appendEnhanced(&corpus->enh, tel, len);
+    }
+    corpusFinish(corpus);
+}
+
+static bool corpusFromCapture(Corpus* corpus, const char* path) {
+    FILE* f = fopen(path, "rb");
+    uint8_t header[24], record[12];
+    if (!f || fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "1EBC", 4) != 0) {
+        printf("%s is not a capture file\n", path);
+        if (f) fclose(f);
+        return false;
+    }
+    while (fread(record, 1, sizeof(record), f) == sizeof(record)) {
+        uint32_t n;
+        memcpy(&n, record+8, 4);
+        if (n == 0) break;
+        size_t pos = corpus->enh.size();
+        corpus->enh.resize(pos+n);
+        if (fread(&corpus->enh[pos], 1, n, f) != n) break;
+    }
+    fclose(f);
+    corpusFinish(corpus);
+    return true;
+}
+
+static double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// one stage: fn processes the whole corpus once, returns the nr of bytes it consumed.
+typedef long StageFn(Corpus* corpus);
+static void stage(const char* name, StageFn* fn, Corpus* corpus, int iterations) {
+    long bytes = 0;
+    fn(corpus);  // warm up
+    long allocs = allocCount;
+    double start = nowNs();
+    for (int it=0; it<iterations; it++) {
+        bytes += fn(corpus);
+    }
+    double ns = nowNs() - start;
+    allocs = allocCount - allocs;
+    double telegrams = (double)corpus->telegrams.size() * iterations;
+    printf("%-14s %10.1f %12.0f %10.1f %10.2f\n", name, bytes/ns*1e3, telegrams/ns*1e9, ns/telegrams, allocs/telegrams);
+}
+
+static long stageEnhanced(Corpus* corpus) {
+    processEnhBusChars(&link, corpus->enh.data(), corpus->enh.size());
+    return corpus->enh.size();
+}
+static long stageBusChar(Corpus* corpus) {
+    for (uint8_t b : corpus->wire) processBusChar(&link, b);
+    return corpus->wire.size();
+}
+static volatile uint8_t sink;
+static long stageCrc(Corpus* corpus) {
+    long bytes = 0;
+    for (Telegram& t : corpus->telegrams) {
+        int len = t.len-1;  // without SYN
+        sink = calcEbusCrc(t.data, len);
+        bytes += len;
+    }
+    return bytes;
+}
+static long stageExpand(Corpus* corpus) {
+    Telegram out;
+    long bytes = 0;
+    for (Telegram& t : corpus->telegrams) {
+        telegramExpand(&t, &out);
+        bytes += t.len;
+    }
+    sink = out.len;
+    return bytes;
+}
+static long stageDeflate(Corpus* corpus) {
+    Telegram expanded, out;
+    long bytes = 0;
+    for (Telegram& t : corpus->telegrams) {
+        telegramExpand(&t, &expanded);  // (included in the time, see expand)
+        telegramDeflate(&expanded, &out);
+        bytes += expanded.len;
+    }
+    sink = out.len;
+    return bytes;
+}
+static long stageExpandEnh(Corpus* corpus) {
+    Telegram out;
+    long bytes = 0;
+    for (Telegram& t : corpus->telegrams) {
+        telegramExpandEnhanced(&t, &out);
+        bytes += t.len;
+    }
+    sink = out.len;
+    return bytes;
+}
+static long stageFrame(Corpus* corpus) {
+    EbusFrame frame;
+    long bytes = 0;
+    for (size_t i=0; i<corpus->telegrams.size(); i++) {
+        Telegram& t = corpus->telegrams[i];
+        frameSplit(t.data, t.len, corpus->flags[i], &frame);
+        bytes += t.len;
+    }
+    sink = frame.valid;
+    return bytes;
+}
+static long stageStruct2json(Corpus* corpus) {
+    char json[1024];
+    int len;
+    long bytes = 0;
+    for (size_t i=0; i<corpus->telegrams.size(); i++) {
+        struct2json(&corpus->telegrams[i], corpus->flags[i], json, sizeof(json), &len);
+        bytes += corpus->telegrams[i].len;
+    }
+    return bytes;
+}
+static long stageJson2struct(Corpus* corpus) {
+    static std::vector<std::vector<char>> jsons;  // prepared once per corpus, outside the timing
+    static Corpus* prepared = 0;
+    if (prepared != corpus) {
+        jsons.clear();
+        for (size_t i=0; i<corpus->telegrams.size(); i++) {
+            char json[1024];
+            int len;
+            struct2json(&corpus->telegrams[i], corpus->flags[i], json, sizeof(json), &len);
+            jsons.push_back(std::vector<char>(json, json+len+1));
+        }
+        prepared = corpus;
+    }
+    Telegram t;
+    long bytes = 0;
+    for (auto& json : jsons) {
+        json2struct(json.data(), &t);
+        bytes += json.size()-1;
+    }
+    return bytes;
+}
+static long stageStruct2bin(Corpus* corpus) {
+    char buf[512];
+    int len;
+    long bytes = 0;
+    for (size_t i=0; i<corpus->telegrams.size(); i++) {
+        struct2bin(&corpus->telegrams[i], corpus->flags[i], buf, sizeof(buf), &len);
+        bytes += corpus->telegrams[i].len;
+    }
+    return bytes;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = 200;
+    const char* capture = 0;
+    for (int i=1; i<argc; i++) {
+        if (atoi(argv[i]) > 0) iterations = atoi(argv[i]);
+        else capture = argv[i];
+    }
+    ebusLinkInit(&link);
+    link.onTelegram = countTelegram;
+    Corpus synthetic, recorded;
+    synthetic.name = "synthetic";
+    recorded.name  = capture ? capture : "recorded";
+    corpusSynthetic(&synthetic, 1000);
+    if (capture) {
+        if (!corpusFromCapture(&recorded, capture)) return 1;
+    } else {
+        corpusFromLines(&recorded, corpusRecorded, sizeof(corpusRecorded)/sizeof(corpusRecorded[0]));
+    }
+    Corpus* corpora[] = { &synthetic, &recorded };
+    for (Corpus* corpus : corpora) {
+        // about the same number of telegrams for both
+        int its = MAX(1, (int)((long)iterations*synthetic.telegrams.size() / MAX(1, (long)corpus->telegrams.size())));
+        printf("\n%s: %zu telegrams, %zu bytes from the adapter\n", corpus->name, corpus->telegrams.size(), corpus->enh.size());
+        if (corpus->telegrams.empty()) continue;
+        printf("%-14s %10s %12s %10s %10s\n", "stage", "MB/s", "telegrams/s", "ns/tel", "allocs/tel");
+        stage("processEnh",   stageEnhanced,    corpus, its);
+        stage("processBus",   stageBusChar,     corpus, its);
+        stage("calcEbusCrc",  stageCrc,         corpus, its);
+        stage("expand",       stageExpand,      corpus, its);
+        stage("expand+deflate", stageDeflate,   corpus, its);
+        stage("expandEnh",    stageExpandEnh,   corpus, its);
+        stage("frameSplit",   stageFrame,       corpus, its);
+        stage("struct2json",  stageStruct2json, corpus, its);
+        stage("json2struct",  stageJson2struct, corpus, its);
+        stage("struct2bin",   stageStruct2bin,  corpus, its);
+    }
+    return telegramsSeen > 0 ? 0 : 1;
+}
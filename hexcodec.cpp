@@ -0,0 +1,82 @@
+//Copyright (C) 2025 makischu
+
+//hexcodec: telegram bytes <-> hex strings as used on mqtt, "10 FE B5 16".
+// runs for every telegram in both directions, so no printf/strtoul, just table lookups.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "hexcodec.h"
+
+struct HexTables {
+    char    pair[256][2];   // byte -> 2 digits
+    int16_t nibble[256];    // char -> 0..15, or 0x100 if not a hex digit (sticks when or-ed)
+};
+
+static constexpr HexTables hexTablesBuild() {
+    HexTables t = {};
+    const char digits[] = "0123456789ABCDEF";
+    for (int i=0; i<256; i++) {
+        t.pair[i][0] = digits[i>>4];
+        t.pair[i][1] = digits[i&0xF];
+        t.nibble[i]  = 0x100;
+    }
+    for (int i=0; i<10; i++) {
+        t.nibble['0'+i] = i;
+    }
+    for (int i=0; i<6; i++) {
+        t.nibble['A'+i] = 10+i;
+        t.nibble['a'+i] = 10+i;
+    }
+    return t;
+}
+
+static constexpr HexTables hexTables = hexTablesBuild();
+
+void bytes2hexstr(const uint8_t* arr, int n, char* pStr, int maxlen) {
+    if (maxlen < 1) {
+        return;
+    }
+    if (n > maxlen/3) { // 3 chars per byte, the last space becomes the termination
+        n = maxlen/3;
+    }
+    for (int i=0; i<n; i++) {
+        pStr[3*i]   = hexTables.pair[arr[i]][0];
+        pStr[3*i+1] = hexTables.pair[arr[i]][1];
+        pStr[3*i+2] = ' ';
+    }
+    pStr[n ? 3*n-1 : 0] = 0;
+}
+
+int hexstr2bytes(const char* pStr, int len, uint8_t* arr, int maxn) {
+    const uint8_t* s = (const uint8_t*)pStr;
+    if (len == 0) {
+        return 0;
+    }
+    int n = (len+1)/3;
+    if (len%3 != 2 || n > maxn) {
+        return -1;
+    }
+    // no branches per byte: collect errors and check once at the end.
+    int bad = 0;
+    for (int i=0; i<n; i++) {
+        int hi = hexTables.nibble[s[3*i]];
+        int lo = hexTables.nibble[s[3*i+1]];
+        bad |= hi | lo;
+        arr[i] = (hi<<4) | (lo&0xF);
+    }
+    for (int i=0; i<n-1; i++) {
+        bad |= (s[3*i+2] != ' ') << 8;
+    }
+    return (bad & 0x100) ? -1 : n;
+}
@@ -0,0 +1,27 @@
+//Copyright (C) 2025 makischu
+
+//hexcodec: telegram bytes <-> hex strings as used on mqtt, "10 FE B5 16".
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+
+// [0 255] ==> "00 FF". writes at most maxlen chars incl. termination, bytes that do not fit are left out.
+void bytes2hexstr(const uint8_t* arr, int n, char* pStr, int maxlen);
+
+// "00 FF" ==> [0 255], returns 2.
+// strict: pairs of hex digits (upper or lower case) separated by exactly one space, nothing else.
+// returns -1 if malformed or more than maxn bytes, arr is undefined then.
+int hexstr2bytes(const char* pStr, int len, uint8_t* arr, int maxn);
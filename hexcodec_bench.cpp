@@ -0,0 +1,153 @@
+//Copyright (C) 2025 makischu
+
+//hexcodec_bench: hex encode/decode per telegram, hexcodec vs. the former sprintf/strtoul versions.
+// build: see CMakeLists.txt
+// run:   hexcodec_bench [iterations]
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "hexcodec.h"
+
+// the former implementation, for reference.
+static void bytes2hexstrSprintf(const uint8_t* arr, int n, char* pStr, int maxlen) {
+  int len = 0;
+  for (int i=0; i<n && len+2<maxlen; i++) {
+    len += sprintf(&pStr[len], "%02X ", arr[i]);
+  }
+  pStr[--len]=0; // replace last space by termination
+}
+
+static int hexstr2bytesStrtoul(const char* pStr, int len, uint8_t* arr, int maxn) {
+  const char* pBuf=pStr; int i=0;
+  char bytestr[3]; bytestr[2]=0;
+  for (i=0; i<maxn && pBuf+2<=pStr+len && *pBuf!=0; i++) {
+    bytestr[0] = *(pBuf++); bytestr[1] = *(pBuf++);
+    arr[i]=(uint8_t)strtoul(bytestr, 0, 16);
+    if (!isxdigit(*pBuf)) pBuf++; //skip space
+  }
+  return i;
+}
+
+// as seen on the bus (README) plus some longer ones.
+static const char* corpus[] = {
+    "10 08 B5 11 01 01 89 00 09 3D 3E 00 80 FF FF 00 00 FF C2 00 AA",
+    "10 76 B5 11 01 01 16 00 09 FF FF 20 0A FF FF 00 00 FF 15 00 AA",
+    "10 08 B5 10 09 00 00 40 FF FF FF 06 00 00 BC 00 01 01 9A 00 AA",
+    "03 76 B5 12 06 13 00 0C 4B 03 00 B6 00 02 00 FF D3 00 AA",
+    "10 08 B5 11 01 00 88 00 09 EE 01 0C 00 00 08 00 00 00 D1 00 AA",
+    "10 FE B5 16 03 01 70 10 52 AA",
+    "31 15 B5 55 07 A5 00 04 00 01 FF FF 1E 00 07 00 15 00 18 00 FF FF 8E 00 AA",
+    "31 15 B5 55 0C A6 00 04 00 01 02 15 00 18 00 FF FF 64 00 01 00 9B 00 AA",
+    "71 08 B5 1A 04 05 01 32 3C 24 00 0A 01 08 0E 4B 03 00 00 00 00 00 86 00 AA",
+};
+#define NCORPUS ((int)(sizeof(corpus)/sizeof(corpus[0])))
+
+struct Tel {
+    uint8_t data[64];
+    int     len;
+};
+
+static double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+typedef void EncodeFn(const uint8_t* arr, int n, char* pStr, int maxlen);
+typedef int  DecodeFn(const char* pStr, int len, uint8_t* arr, int maxn);
+
+static double benchEncode(EncodeFn* encode, const Tel* tels, int iterations, unsigned* check) {
+    char str[256];
+    double start = nowNs();
+    for (int it=0; it<iterations; it++) {
+        for (int i=0; i<NCORPUS; i++) {
+            encode(tels[i].data, tels[i].len, str, sizeof(str));
+            *check += str[0];
+        }
+    }
+    return (nowNs()-start) / ((double)iterations*NCORPUS);
+}
+
+static double benchDecode(DecodeFn* decode, int iterations, unsigned* check) {
+    uint8_t arr[64];
+    int lens[NCORPUS];
+    for (int i=0; i<NCORPUS; i++) {
+        lens[i] = strlen(corpus[i]);
+    }
+    double start = nowNs();
+    for (int it=0; it<iterations; it++) {
+        for (int i=0; i<NCORPUS; i++) {
+            *check += decode(corpus[i], lens[i], arr, sizeof(arr)) + arr[0];
+        }
+    }
+    return (nowNs()-start) / ((double)iterations*NCORPUS);
+}
+
+// same results as before for well-formed input, errors for malformed input.
+static bool selfTest(Tel* tels) {
+    char a[256], b[256];
+    uint8_t arr[64];
+    for (int i=0; i<NCORPUS; i++) {
+        tels[i].len = hexstr2bytes(corpus[i], strlen(corpus[i]), tels[i].data, sizeof(tels[i].data));
+        if (tels[i].len != hexstr2bytesStrtoul(corpus[i], strlen(corpus[i]), arr, sizeof(arr)) || memcmp(arr, tels[i].data, tels[i].len)) {
+            printf("decode mismatch: %s\n", corpus[i]);
+            return false;
+        }
+        bytes2hexstr(tels[i].data, tels[i].len, a, sizeof(a));
+        bytes2hexstrSprintf(tels[i].data, tels[i].len, b, sizeof(b));
+        if (strcmp(a, b) || strcmp(a, corpus[i])) {
+            printf("encode mismatch: %s\n", corpus[i]);
+            return false;
+        }
+    }
+    const char* malformed[] = { "1", "10 F", "10  FE", "10-FE", "1G FE", "10 FE ", " 10 FE", "10FE", "10 FE\n" };
+    for (const char* m : malformed) {
+        if (hexstr2bytes(m, strlen(m), arr, sizeof(arr)) != -1) {
+            printf("accepted malformed input: \"%s\"\n", m);
+            return false;
+        }
+    }
+    if (hexstr2bytes("10 fe", 5, arr, 1) != -1 || hexstr2bytes("10 fe", 5, arr, 2) != 2 || arr[1] != 0xFE) {
+        printf("length/case handling broken\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    Tel tels[NCORPUS];
+    unsigned check = 0;
+    if (!selfTest(tels)) {
+        return 1;
+    }
+    int bytes = 0;
+    for (int i=0; i<NCORPUS; i++) {
+        bytes += tels[i].len;
+    }
+    printf("%d telegrams, %.1f bytes average\n", NCORPUS, (double)bytes/NCORPUS);
+    printf("%-8s %14s %14s\n", "", "table[ns/tel]", "libc[ns/tel]");
+    double encTable = benchEncode(bytes2hexstr,        tels, iterations, &check);
+    double encLibc  = benchEncode(bytes2hexstrSprintf, tels, iterations, &check);
+    printf("%-8s %14.1f %14.1f\n", "encode", encTable, encLibc);
+    double decTable = benchDecode(hexstr2bytes,        iterations, &check);
+    double decLibc  = benchDecode(hexstr2bytesStrtoul, iterations, &check);
+    printf("%-8s %14.1f %14.1f\n", "decode", decTable, decLibc);
+    return check == 0xFFFFFFFF; // keep the results alive
+}
@@ -0,0 +1,517 @@
+//Copyright (C) 2025 makischu
+
+//timeseries: compressed store for numeric series, see timeseries.h
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "timeseries.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+#define TS_SEGMENT_MAGIC    0x53544531  // "1ETS"
+#define TS_SEGMENT_VERSION  1
+#define TS_CHUNK_MAGIC      0x43535431  // "1TSC"
+#define TS_SEGMENT_SIZE     ((size_t)TS_CHUNK_SIZE*TS_SEGMENT_CHUNKS)
+#define TS_CHUNK_BITS       ((TS_CHUNK_SIZE-TS_CHUNK_HEADER_LEN)*8)
+#define TS_MAX_SAMPLE_BITS  (4+32 + 2+5+6+64)  // worst case: 32 bit delta of delta, all value bits
+
+struct TsSegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t used;
+    uint32_t chunkSize;
+};
+struct TsChunkHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t bits;
+    uint32_t reserved;
+    int64_t  tFirst;
+    int64_t  tLast;
+    char     name[TS_NAME_LEN];
+};
+static_assert(sizeof(TsChunkHeader) == TS_CHUNK_HEADER_LEN, "see timeseries.h for the format");
+
+
+//////////////////////////
+// Bits, msb first. the chunk is zero when it is new, so writing is or'ing.
+
+static void bitsPut(uint8_t* p, uint32_t* pos, uint64_t v, int n) {
+    while (n > 0) {
+        int room = 8 - (*pos & 7);
+        int k = MIN(room, n);
+        p[*pos >> 3] |= (uint8_t)(((v >> (n-k)) & ((1u<<k)-1)) << (room-k));
+        *pos += k;
+        n -= k;
+    }
+}
+
+static uint64_t bitsGet(const uint8_t* p, uint32_t* pos, int n) {
+    uint64_t v = 0;
+    while (n > 0) {
+        int room = 8 - (*pos & 7);
+        int k = MIN(room, n);
+        v = (v << k) | ((p[*pos >> 3] >> (room-k)) & ((1u<<k)-1));
+        *pos += k;
+        n -= k;
+    }
+    return v;
+}
+
+static int64_t signExtend(uint64_t v, int n) {
+    return (int64_t)(v << (64-n)) >> (64-n);
+}
+
+static uint32_t hashName(const char* name) { // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    }
+    return h;
+}
+
+
+//////////////////////////
+// Segments
+
+static void segmentPath(TsStore* store, int nr, char* path, int maxLen) {
+    snprintf(path, maxLen, "%s/ts-%06d.seg", store->dir, nr);
+}
+
+static uint8_t* segmentMap(const char* path, bool create) {
+    int fd = open(path, O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    struct stat st;
+    if (fd < 0) {
+        return 0;
+    }
+    if ((create && ftruncate(fd, TS_SEGMENT_SIZE) != 0) || fstat(fd, &st) != 0 || (size_t)st.st_size != TS_SEGMENT_SIZE) {
+        close(fd);
+        return 0;
+    }
+    uint8_t* map = (uint8_t*)mmap(0, TS_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays
+    return map == MAP_FAILED ? 0 : map;
+}
+
+static void segmentRemoveOldest(TsStore* store) {
+    char path[256];
+    // the chunks in it are the oldest of every series
+    for (int i=0; i<store->nseries; i++) {
+        TsSeries* s = &store->series[i];
+        int k = 0;
+        while (k < s->nchunks && s->chunks[k].segNr == store->seg[0].nr) {
+            k++;
+        }
+        memmove(&s->chunks[0], &s->chunks[k], (s->nchunks-k) * sizeof(TsChunkRef));
+        s->nchunks -= k;
+    }
+    segmentPath(store, store->seg[0].nr, path, sizeof(path));
+    munmap(store->seg[0].map, TS_SEGMENT_SIZE);
+    unlink(path);
+    memmove(&store->seg[0], &store->seg[1], (store->nseg-1) * sizeof(TsSegment));
+    store->nseg--;
+    store->countRemoved++;
+}
+
+static TsSegment* segmentNew(TsStore* store) {
+    char path[256];
+    int nr = store->nseg ? store->seg[store->nseg-1].nr + 1 : 1;
+    if (store->nseg == TS_MAX_SEGMENTS) {
+        segmentRemoveOldest(store);
+    }
+    segmentPath(store, nr, path, sizeof(path));
+    uint8_t* map = segmentMap(path, true);
+    if (!map) {
+        printf("timeseries: could not create %s\n", path);
+        return 0;
+    }
+    TsSegmentHeader* h = (TsSegmentHeader*)map;
+    h->magic     = TS_SEGMENT_MAGIC;
+    h->version   = TS_SEGMENT_VERSION;
+    h->used      = 1;
+    h->chunkSize = TS_CHUNK_SIZE;
+    TsSegment* seg = &store->seg[store->nseg++];
+    seg->nr  = nr;
+    seg->map = map;
+    return seg;
+}
+
+// the current chunk of a series is almost always in the newest segment.
+static TsChunkHeader* chunkAt(TsStore* store, int segNr, int chunk) {
+    for (int i=store->nseg-1; i>=0; i--) {
+        if (store->seg[i].nr == segNr) {
+            return (TsChunkHeader*)(store->seg[i].map + (size_t)chunk*TS_CHUNK_SIZE);
+        }
+    }
+    return 0; // removed meanwhile
+}
+
+static TsChunkHeader* chunkNew(TsStore* store, TsSeries* s) {
+    TsSegment* seg = store->nseg ? &store->seg[store->nseg-1] : 0;
+    if (!seg || ((TsSegmentHeader*)seg->map)->used >= TS_SEGMENT_CHUNKS) {
+        if (!(seg = segmentNew(store))) {
+            return 0;
+        }
+    }
+    TsSegmentHeader* sh = (TsSegmentHeader*)seg->map;
+    s->segNr = seg->nr;
+    s->chunk = sh->used++;
+    TsChunkHeader* c = (TsChunkHeader*)(seg->map + (size_t)s->chunk*TS_CHUNK_SIZE);
+    memset(c, 0, TS_CHUNK_SIZE); // in case an unclean shutdown left sth there
+    c->magic = TS_CHUNK_MAGIC;
+    memcpy(c->name, s->name, TS_NAME_LEN);
+    store->countChunks++;
+    return c;
+}
+
+
+// the index of a series gets one more chunk. false if there is no memory for it, the chunk is not found then.
+static bool chunkIndexAdd(TsSeries* s, int segNr, int chunk, int64_t tFirst, int64_t tLast) {
+    if (s->nchunks == s->maxChunks) {
+        int n = s->maxChunks ? 2*s->maxChunks : 64;
+        TsChunkRef* p = (TsChunkRef*)realloc(s->chunks, n * sizeof(TsChunkRef));
+        if (!p) {
+            return false;
+        }
+        s->chunks    = p;
+        s->maxChunks = n;
+    }
+    TsChunkRef* r = &s->chunks[s->nchunks++];
+    r->tFirst = tFirst;
+    r->tLast  = tLast;
+    r->segNr  = segNr;
+    r->chunk  = chunk;
+    return true;
+}
+
+static int seriesFind(TsStore* store, const char* name) {
+    uint32_t h = hashName(name);
+    for (int i=0; i<store->nseries; i++) {
+        if (store->series[i].hash == h && strcmp(store->series[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+//////////////////////////
+// Store
+
+bool tsOpen(TsStore* store, const char* dir) {
+    memset(store, 0, sizeof(*store));
+    if (strlen(dir) >= sizeof(store->dir)) {
+        printf("timeseries: directory name too long\n");
+        return false;
+    }
+    strcpy(store->dir, dir);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("timeseries: could not create %s\n", dir);
+        return false;
+    }
+    DIR* d = opendir(dir);
+    if (!d) {
+        printf("timeseries: could not open %s\n", dir);
+        return false;
+    }
+    // the newest TS_MAX_SEGMENTS, oldest first. older ones are left alone.
+    int nrs[TS_MAX_SEGMENTS], n = 0, nr, i;
+    struct dirent* e;
+    while ((e = readdir(d))) {
+        char ext[8];
+        if (sscanf(e->d_name, "ts-%d.%7s", &nr, ext) != 2 || nr <= 0 || strcmp(ext, "seg") != 0) {
+            continue;
+        }
+        if (n == TS_MAX_SEGMENTS) {
+            if (nr < nrs[0]) {
+                continue;
+            }
+            memmove(&nrs[0], &nrs[1], (--n)*sizeof(int));
+        }
+        for (i=n++; i>0 && nrs[i-1] > nr; i--) {
+            nrs[i] = nrs[i-1];
+        }
+        nrs[i] = nr;
+    }
+    closedir(d);
+    for (i=0; i<n; i++) {
+        char path[256];
+        segmentPath(store, nrs[i], path, sizeof(path));
+        uint8_t* map = segmentMap(path, false);
+        TsSegmentHeader* h = (TsSegmentHeader*)map;
+        if (!map || h->magic != TS_SEGMENT_MAGIC || h->version != TS_SEGMENT_VERSION || h->chunkSize != TS_CHUNK_SIZE || h->used > TS_SEGMENT_CHUNKS) {
+            printf("timeseries: %s is not a segment, ignored\n", path);
+            if (map) munmap(map, TS_SEGMENT_SIZE);
+            continue;
+        }
+        store->seg[store->nseg].nr  = nrs[i];
+        store->seg[store->nseg].map = map;
+        store->nseg++;
+        // the only time the chunk headers are read all
+        for (uint32_t k=1; k<h->used; k++) {
+            const TsChunkHeader* c = (const TsChunkHeader*)(map + (size_t)k*TS_CHUNK_SIZE);
+            if (c->magic != TS_CHUNK_MAGIC || c->count == 0 || c->name[TS_NAME_LEN-1] != 0) {
+                continue;
+            }
+            int series = tsSeries(store, c->name);
+            if (series < 0 || !chunkIndexAdd(&store->series[series], nrs[i], k, c->tFirst, c->tLast)) {
+                store->countUnindexed++;
+            }
+        }
+    }
+    if (store->countUnindexed) {
+        printf("timeseries: %d chunks not indexed, more than %d names?\n", store->countUnindexed, TS_MAX_SERIES);
+    }
+    return true;
+}
+
+void tsClose(TsStore* store) {
+    for (int i=0; i<store->nseg; i++) {
+        munmap(store->seg[i].map, TS_SEGMENT_SIZE);
+    }
+    for (int i=0; i<store->nseries; i++) {
+        free(store->series[i].chunks);
+    }
+    store->nseg    = 0;
+    store->nseries = 0;
+}
+
+int tsSeries(TsStore* store, const char* name) {
+    int i = seriesFind(store, name);
+    if (i >= 0) {
+        return i;
+    }
+    if (store->nseries == TS_MAX_SERIES || strlen(name) >= TS_NAME_LEN) {
+        return -1;
+    }
+    TsSeries* s = &store->series[store->nseries];
+    memset(s, 0, sizeof(*s));
+    strcpy(s->name, name);
+    s->hash  = hashName(name);
+    s->segNr = -1;
+    return store->nseries++;
+}
+
+bool tsAppend(TsStore* store, int series, int64_t t, double v) {
+    TsSeries* s = &store->series[series];
+    TsChunkHeader* c = s->segNr >= 0 ? chunkAt(store, s->segNr, s->chunk) : 0;
+    uint64_t bits;
+    memcpy(&bits, &v, 8);
+    if (c && t < s->prevT) {
+        return false;
+    }
+    int64_t delta = t - s->prevT;
+    int64_t dod   = delta - s->prevDelta;
+    if (!c || c->bits + TS_MAX_SAMPLE_BITS > TS_CHUNK_BITS || dod < INT32_MIN || dod > INT32_MAX) {
+        // first one of a chunk: raw value, time in the header.
+        if (!(c = chunkNew(store, s))) {
+            return false;
+        }
+        if (!chunkIndexAdd(s, s->segNr, s->chunk, t, t)) {
+            store->countUnindexed++;
+        }
+        uint32_t pos = 0;
+        bitsPut((uint8_t*)c + TS_CHUNK_HEADER_LEN, &pos, bits, 64);
+        c->tFirst = c->tLast = t;
+        c->bits  = pos;
+        c->count = 1;
+        s->prevT     = t;
+        s->prevDelta = 0;
+        s->prevV     = bits;
+        s->leading   = -1;
+        store->countSamples++;
+        store->countBits += 64;
+        return true;
+    }
+    uint8_t* p = (uint8_t*)c + TS_CHUNK_HEADER_LEN;
+    uint32_t pos = c->bits;
+    // timestamp: delta of delta, in the smallest of the ranges that fits
+    if (dod == 0) {
+        bitsPut(p, &pos, 0x0, 1);
+    } else if (dod >= -64 && dod < 64) {
+        bitsPut(p, &pos, 0x2, 2);
+        bitsPut(p, &pos, dod, 7);
+    } else if (dod >= -256 && dod < 256) {
+        bitsPut(p, &pos, 0x6, 3);
+        bitsPut(p, &pos, dod, 9);
+    } else if (dod >= -2048 && dod < 2048) {
+        bitsPut(p, &pos, 0xE, 4);
+        bitsPut(p, &pos, dod, 12);
+    } else {
+        bitsPut(p, &pos, 0xF, 4);
+        bitsPut(p, &pos, dod, 32);
+    }
+    // value: xor with the previous one. unchanged is a single bit, small changes keep the window of the previous.
+    uint64_t x = bits ^ s->prevV;
+    if (x == 0) {
+        bitsPut(p, &pos, 0x0, 1);
+    } else {
+        int leading  = MIN(__builtin_clzll(x), 31);
+        int trailing = __builtin_ctzll(x);
+        if (s->leading >= 0 && leading >= s->leading && trailing >= s->trailing) {
+            bitsPut(p, &pos, 0x2, 2);
+            bitsPut(p, &pos, x >> s->trailing, 64 - s->leading - s->trailing);
+        } else {
+            int len = 64 - leading - trailing;
+            bitsPut(p, &pos, 0x3, 2);
+            bitsPut(p, &pos, leading, 5);
+            bitsPut(p, &pos, len & 63, 6); // 64 as 0
+            bitsPut(p, &pos, x >> trailing, len);
+            s->leading  = leading;
+            s->trailing = trailing;
+        }
+    }
+    store->countBits += pos - c->bits;
+    store->countSamples++;
+    s->prevT     = t;
+    s->prevDelta = delta;
+    s->prevV     = bits;
+    // header last, so that a crash leaves the chunk readable up to the previous sample
+    if (s->nchunks && s->chunks[s->nchunks-1].segNr == s->segNr && s->chunks[s->nchunks-1].chunk == s->chunk) {
+        s->chunks[s->nchunks-1].tLast = t;
+    }
+    c->tLast = t;
+    c->bits  = pos;
+    c->count++;
+    return true;
+}
+
+
+//////////////////////////
+// Queries
+
+// the whole chunk is decoded from its start, the samples in range are passed on. stops after to.
+static int chunkRead(const TsChunkHeader* c, int64_t from, int64_t to, TsPointFn* fn, void* ctx) {
+    const uint8_t* p = (const uint8_t*)c + TS_CHUNK_HEADER_LEN;
+    uint32_t pos = 0;
+    int64_t  t = c->tFirst, delta = 0;
+    uint64_t bits = bitsGet(p, &pos, 64);
+    int      leading = 0, trailing = 0, n = 0;
+    double   v;
+    for (uint32_t i=0; i<c->count; i++) {
+        if (i > 0) {
+            int64_t dod;
+            if      (!bitsGet(p, &pos, 1)) dod = 0;
+            else if (!bitsGet(p, &pos, 1)) dod = signExtend(bitsGet(p, &pos,  7),  7);
+            else if (!bitsGet(p, &pos, 1)) dod = signExtend(bitsGet(p, &pos,  9),  9);
+            else if (!bitsGet(p, &pos, 1)) dod = signExtend(bitsGet(p, &pos, 12), 12);
+            else                           dod = signExtend(bitsGet(p, &pos, 32), 32);
+            delta += dod;
+            t += delta;
+            if (bitsGet(p, &pos, 1)) {
+                if (bitsGet(p, &pos, 1)) {
+                    leading = bitsGet(p, &pos, 5);
+                    int len = bitsGet(p, &pos, 6);
+                    trailing = 64 - leading - (len ? len : 64);
+                }
+                bits ^= bitsGet(p, &pos, 64 - leading - trailing) << trailing;
+            }
+        }
+        if (t > to) {
+            break;
+        }
+        if (t >= from) {
+            memcpy(&v, &bits, 8);
+            fn(ctx, t, v);
+            n++;
+        }
+    }
+    return n;
+}
+
+int tsRead(TsStore* store, const char* name, int64_t from, int64_t to, TsPointFn* fn, void* ctx) {
+    int n = 0, series = seriesFind(store, name);
+    TsSeries* s = series >= 0 ? &store->series[series] : 0;
+    for (int i=0; s && i<s->nchunks; i++) {
+        const TsChunkRef* r = &s->chunks[i];
+        const TsChunkHeader* c;
+        if (r->tLast >= from && r->tFirst <= to && (c = chunkAt(store, r->segNr, r->chunk))) {
+            n += chunkRead(c, from, to, fn, ctx);
+        }
+    }
+    return n;
+}
+
+struct TsBucket {
+    int64_t     from, step, t;
+    int         n, buckets;
+    double      min, max, sum;
+    TsBucketFn* fn;
+    void*       ctx;
+};
+
+static void bucketFlush(TsBucket* b) {
+    if (b->n > 0) {
+        b->fn(b->ctx, b->t, b->n, b->min, b->max, b->sum / b->n);
+        b->buckets++;
+        b->n = 0;
+    }
+}
+
+static void bucketAdd(void* ctx, int64_t t, double v) {
+    TsBucket* b = (TsBucket*)ctx;
+    int64_t start = b->from + (t - b->from) / b->step * b->step;
+    if (b->n > 0 && start != b->t) {
+        bucketFlush(b);
+    }
+    if (b->n == 0) {
+        b->t   = start;
+        b->min = b->max = v;
+        b->sum = 0;
+    }
+    b->min = v < b->min ? v : b->min;
+    b->max = v > b->max ? v : b->max;
+    b->sum += v;
+    b->n++;
+}
+
+int tsReadDownsampled(TsStore* store, const char* name, int64_t from, int64_t to, int64_t step, TsBucketFn* fn, void* ctx) {
+    TsBucket b;
+    memset(&b, 0, sizeof(b));
+    b.from = from;
+    b.step = step > 0 ? step : 1;
+    b.fn   = fn;
+    b.ctx  = ctx;
+    tsRead(store, name, from, to, bucketAdd, &b);
+    bucketFlush(&b);
+    return b.buckets;
+}
+
+int tsNames(TsStore* store, TsNameFn* fn, void* ctx) {
+    int n = 0;
+    for (int i=0; i<store->nseries; i++) {
+        if (store->series[i].nchunks > 0) {
+            fn(ctx, store->series[i].name);
+            n++;
+        }
+    }
+    return n;
+}
+
+int64_t tsBytes(TsStore* store) {
+    int64_t bytes = 0;
+    for (int i=0; i<store->nseg; i++) {
+        bytes += (int64_t)((TsSegmentHeader*)store->seg[i].map)->used * TS_CHUNK_SIZE;
+    }
+    return bytes;
+}
@@ -0,0 +1,98 @@
+//Copyright (C) 2025 makischu
+
+//timeseries: compressed store for numeric series, e.g. decoded values over weeks, queryable in place.
+// Gorilla style (Pelkonen et al., VLDB 2015): timestamps as delta of delta, values xor'ed with the previous one,
+// both bit packed. a series is a list of chunks, each chunk starts from scratch (first value raw) and is
+// decoded as a whole. chunks of all series share append-only segment files, memory-mapped, so what is
+// written survives a crash of the process. each series keeps the time range of its chunks in memory (read from
+// the chunk headers once, at open), so a query decodes the chunks that overlap its range and touches nothing else.
+// see README for the query interface of ebusd-light.
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+
+// segment file <dir>/ts-NNNNNN.seg, host byte order:
+//  chunk 0   segment header: u32 magic, u32 version, u32 chunks used (incl. this one), u32 chunk size
+//  chunk 1.. chunk header (TS_CHUNK_HEADER_LEN): u32 magic, u32 nr of samples, u32 nr of bits, u32 reserved,
+//            i64 first timestamp, i64 last timestamp, name (zero-terminated), then the bits, msb first.
+// the headers are updated after every sample, so a chunk is always readable up to its count.
+// timestamps are in ms (since epoch, for ebusd-light), delta of delta in 1/7/9/12/32 bits + prefix.
+#define TS_NAME_LEN          48
+#define TS_CHUNK_SIZE        4096
+#define TS_CHUNK_HEADER_LEN  (32+TS_NAME_LEN)
+#define TS_SEGMENT_CHUNKS    1024     // 4 MB per file
+#define TS_MAX_SEGMENTS      256      // the oldest one is deleted beyond that
+#define TS_MAX_SERIES        256      // names in the store, more are not written nor found
+
+struct TsSegment {
+    int      nr;        // from the file name, increasing
+    uint8_t* map;
+};
+
+// where a chunk is and what time it covers, so that queries don't have to look at every chunk header.
+struct TsChunkRef {
+    int64_t  tFirst, tLast;
+    int      segNr;
+    int      chunk;
+};
+
+// encoder state of a series, for its current chunk, and its chunks.
+struct TsSeries {
+    char     name[TS_NAME_LEN];
+    uint32_t hash;
+    int      segNr;     // current chunk, segNr -1: none yet
+    int      chunk;
+    int64_t  prevT, prevDelta;
+    uint64_t prevV;
+    int      leading, trailing;  // meaningful bits of the previous xor, leading -1: none yet
+    TsChunkRef* chunks;          // oldest first, the current one last
+    int      nchunks, maxChunks;
+};
+
+struct TsStore {
+    char      dir[200];
+    TsSegment seg[TS_MAX_SEGMENTS];  // oldest first
+    int       nseg;
+    TsSeries  series[TS_MAX_SERIES];
+    int       nseries;
+    // statistics
+    int64_t   countSamples, countChunks, countBits;
+    int       countRemoved, countUnindexed;
+};
+
+// maps the segments in dir (creates it if needed). new samples always go into new chunks.
+bool tsOpen(TsStore* store, const char* dir);
+void tsClose(TsStore* store);
+
+// handle for the series of that name, created if new. -1 if there are too many or the name is too long.
+int  tsSeries(TsStore* store, const char* name);
+// t has to be >= the previous one of the series, otherwise the sample is dropped (returns false).
+bool tsAppend(TsStore* store, int series, int64_t t, double v);
+
+// samples of name with from <= t <= to, in order.
+typedef void TsPointFn(void* ctx, int64_t t, double v);
+int  tsRead(TsStore* store, const char* name, int64_t from, int64_t to, TsPointFn* fn, void* ctx);
+
+// same in buckets of step from from on: one call per bucket that has samples. returns the nr of buckets.
+typedef void TsBucketFn(void* ctx, int64_t t, int n, double min, double max, double avg);
+int  tsReadDownsampled(TsStore* store, const char* name, int64_t from, int64_t to, int64_t step, TsBucketFn* fn, void* ctx);
+
+// every name there are chunks of, once.
+typedef void TsNameFn(void* ctx, const char* name);
+int  tsNames(TsStore* store, TsNameFn* fn, void* ctx);
+
+// bytes in use, over all segments.
+int64_t tsBytes(TsStore* store);
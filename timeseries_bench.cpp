@@ -0,0 +1,164 @@
+//Copyright (C) 2025 makischu
+
+//timeseries_bench: size per sample, append time and query time of the time-series store, on synthetic sensor data.
+// build: see CMakeLists.txt
+// run:   timeseries_bench [dir] [days]   (dir is emptied of segment files first, default /tmp/timeseries_bench)
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "timeseries.h"
+
+static double nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// what the decoder delivers: values in steps of their register (1/16 C, 1/256 C, whole l/h), changing slowly,
+// at roughly the period of their telegram with some ms of jitter.
+struct Signal {
+    const char* name;
+    int         periodMs;
+    double      resolution;
+    double      base, amplitude;  // daily swing
+};
+static const Signal signals[] = {
+    { "ForwTemp[C]",  1000, 1.0/16,  30.0, 5.0 },
+    { "OutdTemp[C]", 10000, 1.0/256,  8.0, 6.0 },
+    { "WFlow[l/h]",   1000, 1.0,    840.0, 20.0 },
+};
+#define NSIGNALS ((int)(sizeof(signals)/sizeof(signals[0])))
+
+static double signalValue(const Signal* s, int64_t t) {
+    double v = s->base + s->amplitude * sin(t / 86400e3 * 2*M_PI) + ((t/60000) % 7 == 0 ? s->resolution : 0);
+    return floor(v / s->resolution) * s->resolution;
+}
+
+static int64_t signalTime(const Signal* s, int64_t i) {
+    return 1758844800000LL + i*s->periodMs + (i*7919 % 13) - 6; // 2025-09-26
+}
+
+static void removeSegments(const char* dir) {
+    DIR* d = opendir(dir);
+    struct dirent* e;
+    char path[512];
+    while (d && (e = readdir(d))) {
+        if (strncmp(e->d_name, "ts-", 3) == 0) {
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+    }
+    if (d) closedir(d);
+}
+
+struct Check {
+    const Signal* s;
+    int64_t       i;
+    bool          ok;
+};
+
+static void checkPoint(void* ctx, int64_t t, double v) {
+    Check* c = (Check*)ctx;
+    if (t != signalTime(c->s, c->i) || v != signalValue(c->s, t)) {
+        c->ok = false;
+    }
+    c->i++;
+}
+
+static void countBucket(void* ctx, int64_t t, int n, double min, double max, double avg) {
+    (*(int*)ctx) += n;
+}
+
+static void countName(void* ctx, const char* name) {
+    (*(int*)ctx)++;
+}
+
+int main(int argc, char* argv[]) {
+    const char* dir = argc > 1 ? argv[1] : "/tmp/timeseries_bench";
+    int days = argc > 2 ? atoi(argv[2]) : 7;
+    static TsStore store;
+    removeSegments(dir);
+    if (!tsOpen(&store, dir)) {
+        return 1;
+    }
+    // appended interleaved, as they come from the bus
+    int series[NSIGNALS];
+    int64_t n[NSIGNALS], total = 0;
+    for (int k=0; k<NSIGNALS; k++) {
+        series[k] = tsSeries(&store, signals[k].name);
+        n[k] = (int64_t)days*86400000 / signals[k].periodMs;
+    }
+    double start = nowNs();
+    for (int64_t i=0; i<n[0]; i++) {
+        for (int k=0; k<NSIGNALS; k++) {
+            int64_t j = i * signals[0].periodMs / signals[k].periodMs;
+            if (j * signals[k].periodMs / signals[0].periodMs == i && j < n[k]) {
+                int64_t t = signalTime(&signals[k], j);
+                tsAppend(&store, series[k], t, signalValue(&signals[k], t));
+                total++;
+            }
+        }
+    }
+    double appendNs = (nowNs()-start) / total;
+    printf("%d days, %d series, %lld samples, %.1f ns/sample append\n", days, NSIGNALS, (long long)total, appendNs);
+    printf("%.2f MB in %lld chunks, %.2f bits/sample encoded, %.2f bytes/sample with chunk overhead\n",
+        tsBytes(&store)/1e6, (long long)store.countChunks, (double)store.countBits/total, (double)tsBytes(&store)/total);
+
+    // everything back as it went in, also after reopening
+    tsClose(&store);
+    if (!tsOpen(&store, dir)) {
+        return 1;
+    }
+    int names = 0;
+    tsNames(&store, countName, &names);
+    if (names != NSIGNALS) {
+        printf("%d names instead of %d\n", names, NSIGNALS);
+        return 1;
+    }
+    for (int k=0; k<NSIGNALS; k++) {
+        Check c = { &signals[k], 0, true };
+        start = nowNs();
+        int got = tsRead(&store, signals[k].name, INT64_MIN, INT64_MAX, checkPoint, &c);
+        double readMs = (nowNs()-start) / 1e6;
+        if (got != n[k] || !c.ok) {
+            printf("%s: %d of %lld samples read back, %s\n", signals[k].name, got, (long long)n[k], c.ok ? "ok" : "mismatch");
+            return 1;
+        }
+        // the last day, and the whole range in 15 min buckets
+        int64_t to = signalTime(&signals[k], n[k]-1), from = to - 86400000;
+        for (c.i = n[k]-1; c.i > 0 && signalTime(&signals[k], c.i-1) >= from; c.i--);
+        start = nowNs();
+        int day = tsRead(&store, signals[k].name, from, to, checkPoint, &c);
+        double dayMs = (nowNs()-start) / 1e6;
+        int inBuckets = 0;
+        start = nowNs();
+        int buckets = tsReadDownsampled(&store, signals[k].name, signalTime(&signals[k], 0), to, 900000, countBucket, &inBuckets);
+        double downMs = (nowNs()-start) / 1e6;
+        if (!c.ok || inBuckets != n[k]) {
+            printf("%s: range query mismatch\n", signals[k].name);
+            return 1;
+        }
+        printf("%-12s all %8d samples %7.2f ms, last day %6d samples %6.2f ms, %5d buckets of 15 min %7.2f ms\n",
+            signals[k].name, got, readMs, day, dayMs, buckets, downMs);
+    }
+    tsClose(&store);
+    return 0;
+}